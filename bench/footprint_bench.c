@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../src/refmem.h"
+#include "../demo/Z92/data_structures/hash_table.h"
+#include "../demo/Z92/data_structures/linked_list.h"
+
+/**
+ * @file footprint_bench.c
+ * @brief Measures the memory taken per entry by the demo's hash table and linked list.
+ *
+ * Fills a hash table and a list, and divides the growth of the resident memory by
+ * the number of entries. The list holds integers, so every entry is one link. The hash table
+ * retains its values when it grows, so it maps integers to boxed integers and every entry is
+ * an entry object and a box; its bucket arrays are included as well. The results move with
+ * the size of the object header and the size classes of the slabs.
+ *
+ * Usage: ./footprint_bench.out [entries] [table|list], default 200000 table
+*/
+
+#define DEFAULT_ENTRIES 200000
+
+// the resident memory of the process, large objects are mapped outside of malloc's view
+static size_t heap_bytes()
+{
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL)
+    {
+        fscanf(statm, "%*s %ld", &pages);
+        fclose(statm);
+    }
+    return pages * sysconf(_SC_PAGESIZE);
+}
+
+static unsigned int hash_int(elem_t key)
+{
+    return key.unsigned_integer;
+}
+
+static bool int_eq(elem_t a, elem_t b)
+{
+    return a.integer == b.integer;
+}
+
+static void measure_hash_table(int entries)
+{
+    size_t before = heap_bytes();
+    ioopm_hash_table_t *ht = ioopm_hash_table_create(hash_int, int_eq);
+    for (int i = 0; i < entries; i++)
+    {
+        int *box = allocate_atomic(sizeof(int));
+        retain(box);
+        *box = i;
+        ioopm_hash_table_insert(ht, int_elem(i), void_elem(box));
+    }
+    printf("hash table: %.1f bytes/entry\n", (double)(heap_bytes() - before) / entries);
+    ioopm_hash_table_destroy(ht);
+    shutdown();
+}
+
+static void measure_linked_list(int entries)
+{
+    size_t before = heap_bytes();
+    ioopm_list_t *list = ioopm_linked_list_create(int_eq);
+    for (int i = 0; i < entries; i++)
+    {
+        ioopm_linked_list_prepend(list, int_elem(i));
+    }
+    printf("linked list: %.1f bytes/entry\n", (double)(heap_bytes() - before) / entries);
+    ioopm_linked_list_destroy(list);
+    shutdown();
+}
+
+int main(int argc, char *argv[])
+{
+    int entries = argc > 1 ? atoi(argv[1]) : DEFAULT_ENTRIES;
+    char *structure = argc > 2 ? argv[2] : "table";
+
+    // freed memory stays resident, so every structure is measured in a process of its own
+    if (strcmp(structure, "list") == 0)
+    {
+        measure_linked_list(entries);
+    }
+    else
+    {
+        measure_hash_table(entries);
+    }
+
+    return 0;
+}
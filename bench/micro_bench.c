@@ -0,0 +1,324 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/refmem.h"
+
+/**
+ * @file micro_bench.c
+ * @brief Times the basic operations of refmem against plain malloc and free, and prints JSON.
+ *
+ * Every benchmark is run by refmem and by a baseline doing the same work with malloc and
+ * free, and the best of a few repetitions is kept. The cases are allocate and allocate_array
+ * at several sizes, retain/release pairs, release followed by cleanup, the default destructor
+ * scanning large objects, and shutdown and refmem_teardown with 10^3 up to the given number
+ * of live objects.
+ * Retain/release has no counterpart in malloc, so its baseline is null. Timed per object
+ * are: the allocation for the allocate cases, the release and the deallocation for cleanup
+ * and shutdown, and the allocation, filling and deallocation of an array of 4096 words for
+ * the scan, and only the teardown itself for teardown. Shutdown does not free objects that
+ * are still retained, so they are all released right before it, while refmem_teardown frees
+ * them retained.
+ *
+ * Usage: ./micro_bench.out [max live objects] [label], default 10^7 and no label
+*/
+
+#define DEFAULT_MAX_LIVE 10000000
+#define OPERATIONS 1000000
+#define LARGE_OPERATIONS 20000
+#define PAIRS 20000000
+#define SCAN_WORDS 4096
+#define SCAN_OPERATIONS 200
+#define SCAN_LIVE 100000
+#define REPEATS 3
+
+typedef double (*bench_function)(size_t param, size_t ops, bool baseline);
+
+static bool first_result = true;
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// the pointers are kept and touched so that the compiler cannot pair up malloc and free
+static void **objects_for(size_t ops)
+{
+    void **objects = calloc(ops, sizeof(void *));
+    if (objects == NULL)
+    {
+        fprintf(stderr, "micro_bench: out of memory for %zu objects\n", ops);
+        exit(1);
+    }
+    return objects;
+}
+
+static double bench_allocate(size_t size, size_t ops, bool baseline)
+{
+    void **objects = objects_for(ops);
+
+    double start = now_ns();
+    for (size_t i = 0; i < ops; i++)
+    {
+        objects[i] = baseline ? malloc(size) : allocate(size, NULL);
+        *(char *)objects[i] = 1;
+    }
+    double elapsed = now_ns() - start;
+
+    for (size_t i = 0; i < ops; i++)
+    {
+        baseline ? free(objects[i]) : deallocate(objects[i]);
+    }
+    free(objects);
+    shutdown();
+    return elapsed;
+}
+
+static double bench_allocate_array(size_t elements, size_t ops, bool baseline)
+{
+    void **objects = objects_for(ops);
+
+    double start = now_ns();
+    for (size_t i = 0; i < ops; i++)
+    {
+        objects[i] = baseline ? malloc(elements * sizeof(int)) : allocate_array(elements, sizeof(int), NULL);
+        *(char *)objects[i] = 1;
+    }
+    double elapsed = now_ns() - start;
+
+    for (size_t i = 0; i < ops; i++)
+    {
+        baseline ? free(objects[i]) : deallocate(objects[i]);
+    }
+    free(objects);
+    shutdown();
+    return elapsed;
+}
+
+static double bench_retain_release(size_t size, size_t pairs, bool baseline)
+{
+    obj *object = allocate(size, NULL);
+    retain(object);
+
+    double start = now_ns();
+    for (size_t i = 0; i < pairs; i++)
+    {
+        retain(object);
+        release(object);
+    }
+    double elapsed = now_ns() - start;
+
+    release(object);
+    shutdown();
+    return elapsed;
+}
+
+static double bench_cleanup(size_t size, size_t ops, bool baseline)
+{
+    void **objects = objects_for(ops);
+
+    for (size_t i = 0; i < ops; i++)
+    {
+        objects[i] = baseline ? malloc(size) : allocate(size, NULL);
+        *(char *)objects[i] = 1;
+        if (!baseline)
+        {
+            retain(objects[i]);
+        }
+    }
+
+    double start = now_ns();
+    for (size_t i = 0; i < ops; i++)
+    {
+        baseline ? free(objects[i]) : release(objects[i]);
+    }
+    if (!baseline)
+    {
+        cleanup();
+    }
+    double elapsed = now_ns() - start;
+
+    free(objects);
+    shutdown();
+    return elapsed;
+}
+
+// a quarter of the words point to live objects, the rest are integers and interior pointers
+static double bench_scan(size_t live_count, size_t ops, bool baseline)
+{
+    obj **live = (obj **)objects_for(live_count);
+    for (size_t i = 0; i < live_count; i++)
+    {
+        live[i] = allocate(2 * sizeof(int), NULL);
+        retain(live[i]);
+    }
+
+    double start = now_ns();
+    for (size_t i = 0; i < ops; i++)
+    {
+        void **words = baseline ? malloc(SCAN_WORDS * sizeof(void *)) : allocate_array(SCAN_WORDS, sizeof(void *), NULL);
+
+        for (size_t w = 0; w < SCAN_WORDS; w++)
+        {
+            obj *target = live[(i * SCAN_WORDS + w) % live_count];
+
+            switch (w % 4)
+            {
+            case 0:
+                words[w] = target;
+                if (!baseline)
+                {
+                    retain(target);
+                }
+                break;
+            case 1:
+                words[w] = (char *)target + sizeof(int);
+                break;
+            default:
+                words[w] = (void *)(w * i);
+                break;
+            }
+        }
+
+        baseline ? free(words) : deallocate(words);
+    }
+    double elapsed = now_ns() - start;
+
+    for (size_t i = 0; i < live_count; i++)
+    {
+        release(live[i]);
+    }
+    free(live);
+    shutdown();
+    return elapsed;
+}
+
+static double bench_shutdown(size_t size, size_t live_count, bool baseline)
+{
+    void **objects = objects_for(live_count);
+
+    for (size_t i = 0; i < live_count; i++)
+    {
+        objects[i] = baseline ? malloc(size) : allocate(size, NULL);
+        *(char *)objects[i] = 1;
+        if (!baseline)
+        {
+            retain(objects[i]);
+        }
+    }
+
+    // shutdown frees what the releases left in the queue, the baseline frees one by one
+    double start = now_ns();
+    for (size_t i = 0; i < live_count; i++)
+    {
+        baseline ? free(objects[i]) : release(objects[i]);
+    }
+    if (!baseline)
+    {
+        shutdown();
+    }
+    double elapsed = now_ns() - start;
+
+    free(objects);
+    return elapsed;
+}
+
+static double bench_teardown(size_t size, size_t live_count, bool baseline)
+{
+    void **objects = objects_for(live_count);
+
+    for (size_t i = 0; i < live_count; i++)
+    {
+        objects[i] = baseline ? malloc(size) : allocate(size, NULL);
+        *(char *)objects[i] = 1;
+        if (!baseline)
+        {
+            retain(objects[i]);
+        }
+    }
+
+    // the objects stay retained, refmem_teardown frees their slabs whole
+    double start = now_ns();
+    if (baseline)
+    {
+        for (size_t i = 0; i < live_count; i++)
+        {
+            free(objects[i]);
+        }
+    }
+    else
+    {
+        refmem_teardown(REFMEM_TEARDOWN_SKIP_DESTRUCTORS);
+    }
+    double elapsed = now_ns() - start;
+
+    free(objects);
+    return elapsed;
+}
+
+static double best_of(bench_function bench, size_t param, size_t ops, bool baseline)
+{
+    double best = 0;
+
+    for (int i = 0; i < REPEATS; i++)
+    {
+        double elapsed = bench(param, ops, baseline);
+        best = i == 0 || elapsed < best ? elapsed : best;
+    }
+    return best;
+}
+
+static void report(char *name, char *param_name, size_t param, bench_function bench, size_t ops, bool has_baseline)
+{
+    double elapsed = best_of(bench, param, ops, false) / ops;
+
+    printf("%s\n    {\"name\": \"%s\", \"%s\": %zu, \"ops\": %zu, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f, \"malloc_ns_per_op\": ",
+           first_result ? "" : ",", name, param_name, param, ops, elapsed, 1e9 / elapsed);
+    if (has_baseline)
+    {
+        printf("%.2f}", best_of(bench, param, ops, true) / ops);
+    }
+    else
+    {
+        printf("null}");
+    }
+    fflush(stdout);
+    first_result = false;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t max_live = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_MAX_LIVE;
+    char *label = argc > 2 ? argv[2] : "";
+    size_t sizes[] = {16, 64, 256, 4096, 65536};
+    size_t elements[] = {4, 64, 1024, 16384};
+
+    printf("{\n  \"label\": \"%s\",\n  \"benchmarks\": [", label);
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        report("allocate", "bytes", sizes[i], bench_allocate, sizes[i] < 4096 ? OPERATIONS : LARGE_OPERATIONS, true);
+    }
+    for (size_t i = 0; i < sizeof(elements) / sizeof(elements[0]); i++)
+    {
+        report("allocate_array", "elements", elements[i], bench_allocate_array, elements[i] < 1024 ? OPERATIONS : LARGE_OPERATIONS, true);
+    }
+    report("retain_release", "bytes", 16, bench_retain_release, PAIRS, false);
+    report("release_cleanup", "bytes", 16, bench_cleanup, OPERATIONS, true);
+    report("release_cleanup", "bytes", 256, bench_cleanup, OPERATIONS, true);
+    report("scan", "live_objects", SCAN_LIVE, bench_scan, SCAN_OPERATIONS, true);
+    for (size_t live_count = 1000; live_count <= max_live; live_count *= 10)
+    {
+        report("shutdown", "bytes", 16, bench_shutdown, live_count, true);
+    }
+    for (size_t live_count = 1000; live_count <= max_live; live_count *= 10)
+    {
+        report("teardown", "bytes", 16, bench_teardown, live_count, true);
+    }
+
+    printf("\n  ]\n}\n");
+    return 0;
+}
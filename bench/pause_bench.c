@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/refmem.h"
+
+/**
+ * @file pause_bench.c
+ * @brief Compares the pauses inside allocate() of the cascade limit and the two budgets.
+ *
+ * Objects are released in a mix that resembles the Z92 demo: mostly small entries,
+ * and now and then a large table whose default destructor scans every slot and
+ * releases the entries it points to. The same workload is run with the count limit,
+ * a time budget and a byte budget, printing the pause distribution refmem observed.
+ *
+ * Usage: ./pause_bench.out [operations]
+*/
+
+#define DEFAULT_OPERATIONS 2000000
+#define TABLE_SLOTS 4096
+#define TABLE_EVERY 1000
+
+static uint64_t percentile(refmem_pause_stats_t *stats, double fraction)
+{
+    uint64_t wanted = stats->pauses * fraction;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < REFMEM_PAUSE_BUCKETS; i++)
+    {
+        seen += stats->histogram[i];
+        if (seen > wanted)
+        {
+            return (uint64_t)1 << (i + 1);
+        }
+    }
+    return stats->max_ns;
+}
+
+static void run(const char *name, size_t operations)
+{
+    reset_pause_stats();
+
+    for (size_t i = 0; i < operations; i++)
+    {
+        if (i % TABLE_EVERY == 0)
+        {
+            obj **table = allocate_array(TABLE_SLOTS, sizeof(obj *), NULL);
+            for (size_t j = 0; j < TABLE_SLOTS; j++)
+            {
+                table[j] = allocate(24, NULL);
+                retain(table[j]);
+            }
+            retain(table);
+            release(table);
+        }
+        else
+        {
+            obj *entry = allocate(24, NULL);
+            retain(entry);
+            release(entry);
+        }
+    }
+    cleanup();
+
+    refmem_pause_stats_t stats;
+    get_pause_stats(&stats);
+    printf("%s: pauses: %llu, mean: %.0f ns, p50 < %llu ns, p99 < %llu ns, p99.9 < %llu ns, max: %llu ns\n",
+           name, (unsigned long long)stats.pauses, (double)stats.total_ns / stats.pauses,
+           (unsigned long long)percentile(&stats, 0.5), (unsigned long long)percentile(&stats, 0.99),
+           (unsigned long long)percentile(&stats, 0.999), (unsigned long long)stats.max_ns);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t operations = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_OPERATIONS;
+
+    run("cascade limit 5", operations);
+
+    set_cascade_time_budget(2000);
+    run("time budget 2000 ns", operations);
+    set_cascade_time_budget(0);
+
+    set_cascade_byte_budget(4096);
+    run("byte budget 4096 B", operations);
+    set_cascade_byte_budget(0);
+
+    shutdown();
+    return 0;
+}
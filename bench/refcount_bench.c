@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/refmem.h"
+#ifdef REFMEM_THREAD_SAFE
+#include <pthread.h>
+#endif
+
+/**
+ * @file refcount_bench.c
+ * @brief Measures the cost of a retain/release pair on the biased and the shared path.
+ *
+ * "owner" retains and releases an object in the thread that allocated it, which is
+ * plain arithmetic on the biased counter. The Makefile builds this file twice, so the
+ * owner numbers of the single threaded and the thread safe build can be compared.
+ * In the thread safe build, "shared" lets every thread count its own object owned by
+ * the main thread, and "contended" lets all threads count the same object, both
+ * through the atomic shared counter.
+ *
+ * Usage: ./refcount_bench.out [pairs per thread] [max threads]
+*/
+
+#define DEFAULT_PAIRS 20000000
+#define SPREAD_BYTES 128 // keeps the objects of different threads on different cache lines
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void retain_release(obj *object, size_t pairs)
+{
+    for (size_t i = 0; i < pairs; i++)
+    {
+        retain(object);
+        release(object);
+    }
+}
+
+#ifdef REFMEM_THREAD_SAFE
+typedef struct
+{
+    obj *object;
+    size_t pairs;
+} worker_t;
+
+static void *worker(void *arg)
+{
+    worker_t *work = arg;
+    retain_release(work->object, work->pairs);
+    return NULL;
+}
+
+static double run(size_t threads, size_t pairs, bool contended)
+{
+    pthread_t ids[threads];
+    worker_t work[threads];
+    obj *objects[threads];
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        objects[i] = contended && i > 0 ? objects[0] : allocate(SPREAD_BYTES, NULL);
+        if (!contended || i == 0)
+        {
+            retain(objects[i]);
+        }
+        work[i] = (worker_t){objects[i], pairs};
+    }
+
+    double start = now_ns();
+    for (size_t i = 0; i < threads; i++)
+    {
+        pthread_create(&ids[i], NULL, worker, &work[i]);
+    }
+    for (size_t i = 0; i < threads; i++)
+    {
+        pthread_join(ids[i], NULL);
+    }
+    double elapsed = now_ns() - start;
+
+    for (size_t i = 0; i < (contended ? 1 : threads); i++)
+    {
+        release(objects[i]);
+    }
+    cleanup();
+
+    // wall time divided by the pairs of all threads, falls with more threads while they scale
+    return elapsed / (pairs * threads);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    size_t pairs = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_PAIRS;
+
+    obj *object = allocate(SPREAD_BYTES, NULL);
+    retain(object);
+    double start = now_ns();
+    retain_release(object, pairs);
+    printf("owner: %.2f ns/pair\n", (now_ns() - start) / pairs);
+    release(object);
+
+#ifdef REFMEM_THREAD_SAFE
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = argc > 2 ? strtoull(argv[2], NULL, 10) : (size_t)(cores > 0 ? cores : 1);
+
+    // powers of two up to the number of cores, and the number of cores itself
+    for (size_t threads = 1; threads <= max_threads; threads = threads * 2 > max_threads && threads < max_threads ? max_threads : threads * 2)
+    {
+        double shared = run(threads, pairs, false);
+        double contended = run(threads, pairs, true);
+        printf("threads: %zu, shared: %.2f ns/pair, contended: %.2f ns/pair\n", threads, shared, contended);
+    }
+#endif
+
+    shutdown();
+    return 0;
+}
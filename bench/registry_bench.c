@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../src/refmem.h"
+
+/**
+ * @file registry_bench.c
+ * @brief Measures the cost of refmem's allocated-pointer registry as the number of live objects grows.
+ *
+ * Every timed operation allocates an object holding a pointer to a live object, retains
+ * the live object and deallocates the new object again. This goes through a registry
+ * insert, a membership check in the default destructor and a registry removal, so the
+ * cost per operation should stay flat no matter how many objects are alive.
+ *
+ * Usage: ./registry_bench.out [max live objects], default 10^7
+*/
+
+#define DEFAULT_MAX_LIVE 10000000
+#define OPERATIONS 200000
+
+struct holder
+{
+    obj *live;
+};
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double measure(obj **live, size_t live_count)
+{
+    double start = now_ns();
+
+    for (size_t i = 0; i < OPERATIONS; i++)
+    {
+        struct holder *holder = allocate(sizeof(struct holder), NULL);
+        holder->live = live[i % live_count];
+        retain(holder->live);
+        deallocate(holder);
+    }
+
+    return (now_ns() - start) / OPERATIONS;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t max_live = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_MAX_LIVE;
+
+    printf("%12s %12s\n", "live objects", "ns/op");
+
+    for (size_t live_count = 1000; live_count <= max_live; live_count *= 10)
+    {
+        obj **live = calloc(live_count, sizeof(obj *));
+
+        for (size_t i = 0; i < live_count; i++)
+        {
+            live[i] = allocate(sizeof(int), NULL);
+            retain(live[i]);
+        }
+
+        printf("%12zu %12.1f\n", live_count, measure(live, live_count));
+
+        for (size_t i = 0; i < live_count; i++)
+        {
+            release(live[i]);
+        }
+        free(live);
+        shutdown();
+    }
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../src/refmem.h"
+
+/**
+ * @file scan_bench.c
+ * @brief Measures the default destructor's scan of large objects as the number of live objects grows.
+ *
+ * Each timed operation allocates an array of words holding a mix of integers, pointers
+ * into the heap that are not object starts, and pointers to live objects, then
+ * deallocates it so that the default destructor scans every word. The cost per scanned
+ * word should not depend on how many objects are alive.
+ *
+ * Usage: ./scan_bench.out [max live objects], default 10^6
+*/
+
+#define DEFAULT_MAX_LIVE 1000000
+#define WORDS 4096
+#define OPERATIONS 200
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static double measure(obj **live, size_t live_count)
+{
+    double start = now_ns();
+
+    for (size_t i = 0; i < OPERATIONS; i++)
+    {
+        void **words = allocate_array(WORDS, sizeof(void *), NULL);
+
+        for (size_t w = 0; w < WORDS; w++)
+        {
+            obj *target = live[(i * WORDS + w) % live_count];
+
+            switch (w % 4)
+            {
+            case 0:
+                words[w] = target;
+                retain(target);
+                break;
+            case 1:
+                words[w] = (char *)target + sizeof(int);
+                break;
+            default:
+                words[w] = (void *)(w * i);
+                break;
+            }
+        }
+
+        deallocate(words);
+    }
+
+    return (now_ns() - start) / (OPERATIONS * WORDS);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t max_live = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_MAX_LIVE;
+
+    printf("%12s %16s\n", "live objects", "ns/scanned word");
+
+    for (size_t live_count = 1000; live_count <= max_live; live_count *= 10)
+    {
+        obj **live = calloc(live_count, sizeof(obj *));
+
+        for (size_t i = 0; i < live_count; i++)
+        {
+            live[i] = allocate(2 * sizeof(int), NULL);
+            retain(live[i]);
+        }
+
+        printf("%12zu %16.2f\n", live_count, measure(live, live_count));
+
+        for (size_t i = 0; i < live_count; i++)
+        {
+            release(live[i]);
+        }
+        free(live);
+        shutdown();
+    }
+
+    return 0;
+}
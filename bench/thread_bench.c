@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "../src/refmem.h"
+
+/**
+ * @file thread_bench.c
+ * @brief Measures how allocate/retain/release/deallocate throughput scales with threads.
+ *
+ * Every thread keeps its own window of small objects and replaces them in a loop, so
+ * the only sharing between threads is inside the allocator. In the "handover" mode
+ * every object is released by the next thread instead, which exercises remote frees.
+ * Built with REFMEM_THREAD_SAFE by the Makefile.
+ *
+ * Usage: ./thread_bench.out [operations per thread] [max threads]
+*/
+
+#define DEFAULT_OPERATIONS 2000000
+#define WINDOW 1024
+
+typedef struct
+{
+    size_t operations;
+    size_t threads;
+    obj **handover; // objects to be released by this thread, filled by the previous one
+    obj **next_handover;
+    pthread_barrier_t *barrier;
+} worker_t;
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void *private_worker(void *arg)
+{
+    worker_t *worker = arg;
+    obj *window[WINDOW] = {NULL};
+
+    pthread_barrier_wait(worker->barrier);
+    for (size_t i = 0; i < worker->operations; i++)
+    {
+        size_t slot = i % WINDOW;
+        if (window[slot] != NULL)
+        {
+            release(window[slot]);
+        }
+        window[slot] = allocate(16 + (i % 4) * 16, NULL);
+        retain(window[slot]);
+    }
+    for (size_t i = 0; i < WINDOW; i++)
+    {
+        release(window[i]);
+    }
+    cleanup();
+
+    return NULL;
+}
+
+static void *handover_worker(void *arg)
+{
+    worker_t *worker = arg;
+
+    pthread_barrier_wait(worker->barrier);
+    for (size_t i = 0; i < worker->operations; i++)
+    {
+        worker->next_handover[i] = allocate(16 + (i % 4) * 16, NULL);
+        retain(worker->next_handover[i]);
+    }
+    pthread_barrier_wait(worker->barrier);
+    for (size_t i = 0; i < worker->operations; i++)
+    {
+        release(worker->handover[i]);
+    }
+    cleanup();
+
+    return NULL;
+}
+
+static double run(size_t threads, size_t operations, void *(*body)(void *))
+{
+    pthread_t ids[threads];
+    worker_t workers[threads];
+    obj **handovers[threads];
+    pthread_barrier_t barrier;
+
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+    for (size_t i = 0; i < threads; i++)
+    {
+        handovers[i] = calloc(operations, sizeof(obj *));
+    }
+    for (size_t i = 0; i < threads; i++)
+    {
+        workers[i] = (worker_t){operations, threads, handovers[i], handovers[(i + 1) % threads], &barrier};
+        pthread_create(&ids[i], NULL, body, &workers[i]);
+    }
+
+    pthread_barrier_wait(&barrier);
+    double start = now_ns();
+    if (body == handover_worker)
+    {
+        pthread_barrier_wait(&barrier);
+    }
+    for (size_t i = 0; i < threads; i++)
+    {
+        pthread_join(ids[i], NULL);
+    }
+    double elapsed = now_ns() - start;
+
+    for (size_t i = 0; i < threads; i++)
+    {
+        free(handovers[i]);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    return threads * operations / (elapsed / 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t operations = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_OPERATIONS;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = argc > 2 ? strtoull(argv[2], NULL, 10) : (size_t)(cores > 0 ? cores : 1);
+
+    // powers of two up to the number of cores, and the number of cores itself
+    for (size_t threads = 1; threads <= max_threads; threads = threads * 2 > max_threads && threads < max_threads ? max_threads : threads * 2)
+    {
+        double private = run(threads, operations, private_worker);
+        double handover = run(threads, operations, handover_worker);
+        printf("threads: %zu, private: %.2f Mops/s, handover: %.2f Mops/s\n",
+               threads, private / 1e6, handover / 1e6);
+    }
+
+    shutdown();
+    return 0;
+}
@@ -0,0 +1,365 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "../src/refmem.h"
+#include "../demo/Z92/logic/merch_storage.h"
+#include "../demo/Z92/logic/shop_cart.h"
+#include "../demo/Z92/utils/hash_fun.h"
+
+/**
+ * @file warehouse_bench.c
+ * @brief A synthetic load on the demo's warehouse, reporting throughput, latencies and peak RSS.
+ *
+ * Stocks a store with the given number of merch on the given number of shelves each, opens
+ * the given number of carts, and then runs a random mix of operations through the
+ * merch_storage.h and shop_cart.h APIs, checking stock the way ui.c does. Every operation
+ * runs in an autorelease pool of its own, like a command of the ui, and is timed on its own.
+ * The choice of a merch or a shelf, restocking an empty merch, opening a new cart after a
+ * checkout and putting new merch in place of removed merch are not timed.
+ *
+ * The mix holds the weights of add, remove, cost, checkout, rename and delete, in that order.
+ *
+ * Usage: ./warehouse_bench.out [merch] [shelves] [carts] [operations] [mix],
+ * default 1000 4 100 200000 40:15:25:10:5:5
+*/
+
+#define DEFAULT_MERCH 1000
+#define DEFAULT_SHELVES 4
+#define DEFAULT_CARTS 100
+#define DEFAULT_OPERATIONS 200000
+#define DEFAULT_MIX "40:15:25:10:5:5"
+#define NAME_SIZE 48
+#define SHELF_STOCK 50
+#define RESTOCK 100
+#define MAX_AMOUNT 3
+
+typedef enum { OP_ADD, OP_REMOVE, OP_COST, OP_CHECKOUT, OP_RENAME, OP_DELETE, OPS } op_t;
+
+static char *op_names[OPS] = {"cart_add", "cart_remove", "cost_calculate", "cart_checkout", "name_set", "store_remove"};
+
+typedef struct
+{
+    uint32_t *nanoseconds;
+    size_t count;
+    size_t capacity;
+    double total;
+} latencies_t;
+
+typedef struct
+{
+    char name[NAME_SIZE];
+    int generation;
+} merch_slot_t;
+
+typedef struct
+{
+    ioopm_store_t *store;
+    ioopm_carts_t *carts;
+    merch_slot_t *merch;
+    size_t merch_count;
+    size_t shelves;
+    int *cart_ids;
+    size_t cart_count;
+    unsigned seed;
+    latencies_t latencies[OPS];
+} warehouse_t;
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void record(warehouse_t *warehouse, op_t op, double start)
+{
+    latencies_t *latencies = &warehouse->latencies[op];
+    double elapsed = now_ns() - start;
+
+    if (latencies->count == latencies->capacity)
+    {
+        latencies->capacity = latencies->capacity == 0 ? 1024 : latencies->capacity * 2;
+        latencies->nanoseconds = realloc(latencies->nanoseconds, latencies->capacity * sizeof(uint32_t));
+    }
+    latencies->nanoseconds[latencies->count++] = elapsed > UINT32_MAX ? UINT32_MAX : elapsed;
+    latencies->total += elapsed;
+}
+
+// a merch of a slot is renamed to a new generation, so names are never reused
+static void slot_name(warehouse_t *warehouse, size_t slot, char *name)
+{
+    snprintf(name, NAME_SIZE, "merch%zu.%d", slot, warehouse->merch[slot].generation);
+}
+
+static char *shelf_name(char *buffer, size_t slot, size_t shelf)
+{
+    snprintf(buffer, NAME_SIZE, "S%zu.%zu", slot, shelf);
+    return buffer;
+}
+
+static void merch_add(warehouse_t *warehouse, size_t slot)
+{
+    char shelf[NAME_SIZE];
+
+    slot_name(warehouse, slot, warehouse->merch[slot].name);
+    ioopm_merch_t *merch = ioopm_merch_create(duplicate_string(warehouse->merch[slot].name), duplicate_string("generated"),
+                                              1 + rand_r(&warehouse->seed) % 1000, ioopm_linked_list_create(ioopm_string_eq), 0);
+    ioopm_store_add(warehouse->store, merch);
+
+    for (size_t i = 0; i < warehouse->shelves; i++)
+    {
+        ioopm_location_add(merch, duplicate_string(shelf_name(shelf, slot, i)), SHELF_STOCK);
+    }
+}
+
+static void cart_open(warehouse_t *warehouse, size_t slot)
+{
+    warehouse->cart_ids[slot] = warehouse->carts->total_carts;
+    ioopm_cart_create(warehouse->carts);
+    warehouse->carts->total_carts++;
+}
+
+static void cart_add(warehouse_t *warehouse, size_t cart, size_t slot)
+{
+    char shelf[NAME_SIZE];
+    int amount = 1 + rand_r(&warehouse->seed) % MAX_AMOUNT;
+    char *name = warehouse->merch[slot].name;
+
+    refmem_pool_push();
+    ioopm_merch_t *merch = ioopm_merch_get(warehouse->store, name);
+    if (merch->stock_size - merch->reserved_stock < amount)
+    {
+        ioopm_location_add(merch, duplicate_string(shelf_name(shelf, slot, 0)), RESTOCK);
+    }
+    refmem_pool_pop();
+
+    double start = now_ns();
+    refmem_pool_push();
+    merch = ioopm_merch_get(warehouse->store, name);
+    merch->reserved_stock += amount;
+    ioopm_cart_add(warehouse->carts, warehouse->cart_ids[cart], merch->name, amount);
+    refmem_pool_pop();
+    record(warehouse, OP_ADD, start);
+}
+
+static void cart_remove(warehouse_t *warehouse, size_t cart)
+{
+    char name[NAME_SIZE];
+    int amount = 1 + rand_r(&warehouse->seed) % MAX_AMOUNT;
+
+    refmem_pool_push();
+    ioopm_hash_table_t *cart_items = ioopm_items_in_cart_get(warehouse->carts, warehouse->cart_ids[cart]);
+    ioopm_list_t *keys = ioopm_hash_table_keys(cart_items);
+    size_t items = ioopm_linked_list_size(keys);
+    // the list releases its elements, but the names are still keys of the cart
+    for (size_t i = 0; i < items; i++)
+    {
+        retain(ioopm_linked_list_get(keys, i).string);
+    }
+    if (items > 0)
+    {
+        snprintf(name, NAME_SIZE, "%s", ioopm_linked_list_get(keys, rand_r(&warehouse->seed) % items).string);
+        int in_cart = ioopm_item_in_cart_amount(warehouse->carts, warehouse->cart_ids[cart], name);
+        amount = amount < in_cart ? amount : in_cart;
+    }
+    release(keys);
+    refmem_pool_pop();
+
+    // an empty cart has nothing to remove, it is filled instead
+    if (items == 0)
+    {
+        cart_add(warehouse, cart, rand_r(&warehouse->seed) % warehouse->merch_count);
+        return;
+    }
+
+    double start = now_ns();
+    refmem_pool_push();
+    ioopm_merch_t *merch = ioopm_merch_get(warehouse->store, name);
+    merch->reserved_stock -= amount;
+    ioopm_cart_remove(ioopm_items_in_cart_get(warehouse->carts, warehouse->cart_ids[cart]), name, amount);
+    refmem_pool_pop();
+    record(warehouse, OP_REMOVE, start);
+}
+
+static void cost_calculate(warehouse_t *warehouse, size_t cart)
+{
+    double start = now_ns();
+    refmem_pool_push();
+    ioopm_cost_calculate(warehouse->store, warehouse->carts, warehouse->cart_ids[cart]);
+    refmem_pool_pop();
+    record(warehouse, OP_COST, start);
+}
+
+static void cart_checkout(warehouse_t *warehouse, size_t cart)
+{
+    double start = now_ns();
+    refmem_pool_push();
+    ioopm_cart_checkout(warehouse->store, warehouse->carts, warehouse->cart_ids[cart]);
+    refmem_pool_pop();
+    record(warehouse, OP_CHECKOUT, start);
+
+    cart_open(warehouse, cart);
+}
+
+static void name_set(warehouse_t *warehouse, size_t slot)
+{
+    char new_name[NAME_SIZE];
+
+    warehouse->merch[slot].generation++;
+    slot_name(warehouse, slot, new_name);
+
+    double start = now_ns();
+    refmem_pool_push();
+    ioopm_merch_t *merch = ioopm_merch_get(warehouse->store, warehouse->merch[slot].name);
+    // the new merch starts without reservations, but the carts keep theirs under the new name
+    int reserved = merch->reserved_stock;
+    ioopm_name_set(warehouse->store, merch, duplicate_string(new_name), warehouse->carts->carts);
+    ioopm_merch_get(warehouse->store, new_name)->reserved_stock = reserved;
+    refmem_pool_pop();
+    record(warehouse, OP_RENAME, start);
+
+    strcpy(warehouse->merch[slot].name, new_name);
+}
+
+static void store_remove(warehouse_t *warehouse, size_t slot)
+{
+    double start = now_ns();
+    refmem_pool_push();
+    ioopm_store_remove(warehouse->store, warehouse->carts->carts, warehouse->merch[slot].name);
+    refmem_pool_pop();
+    record(warehouse, OP_DELETE, start);
+
+    warehouse->merch[slot].generation++;
+    merch_add(warehouse, slot);
+}
+
+static op_t pick_op(warehouse_t *warehouse, int weights[OPS], int total_weight)
+{
+    int pick = rand_r(&warehouse->seed) % total_weight;
+
+    for (op_t op = 0; op < OPS; op++)
+    {
+        if (pick < weights[op])
+        {
+            return op;
+        }
+        pick -= weights[op];
+    }
+    return OP_COST;
+}
+
+static int compare_latencies(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(latencies_t *latencies, double fraction)
+{
+    size_t index = fraction * latencies->count;
+    return latencies->nanoseconds[index < latencies->count ? index : latencies->count - 1];
+}
+
+static void report(warehouse_t *warehouse, size_t operations, double elapsed)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("%zu operations in %.2f s, %.0f ops/sec, peak RSS: %ld KiB\n", operations, elapsed / 1e9, operations / (elapsed / 1e9), usage.ru_maxrss);
+    printf("%-16s %10s %12s %10s %10s %10s\n", "operation", "count", "ops/sec", "p50 ns", "p99 ns", "p999 ns");
+
+    for (op_t op = 0; op < OPS; op++)
+    {
+        latencies_t *latencies = &warehouse->latencies[op];
+        if (latencies->count == 0)
+        {
+            continue;
+        }
+
+        qsort(latencies->nanoseconds, latencies->count, sizeof(uint32_t), compare_latencies);
+        printf("%-16s %10zu %12.0f %10u %10u %10u\n", op_names[op], latencies->count, latencies->count / (latencies->total / 1e9),
+               percentile(latencies, 0.5), percentile(latencies, 0.99), percentile(latencies, 0.999));
+        free(latencies->nanoseconds);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    warehouse_t warehouse = {.seed = 42};
+    warehouse.merch_count = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_MERCH;
+    warehouse.shelves = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_SHELVES;
+    warehouse.cart_count = argc > 3 ? strtoull(argv[3], NULL, 10) : DEFAULT_CARTS;
+    size_t operations = argc > 4 ? strtoull(argv[4], NULL, 10) : DEFAULT_OPERATIONS;
+    char *mix = argc > 5 ? argv[5] : DEFAULT_MIX;
+
+    int weights[OPS] = {0};
+    int total_weight = 0;
+    sscanf(mix, "%d:%d:%d:%d:%d:%d", &weights[0], &weights[1], &weights[2], &weights[3], &weights[4], &weights[5]);
+    for (op_t op = 0; op < OPS; op++)
+    {
+        total_weight += weights[op] > 0 ? weights[op] : 0;
+    }
+    if (warehouse.merch_count == 0 || warehouse.shelves == 0 || warehouse.cart_count == 0 || total_weight == 0)
+    {
+        fprintf(stderr, "usage: %s [merch] [shelves] [carts] [operations] [add:remove:cost:checkout:rename:delete]\n", argv[0]);
+        return 1;
+    }
+
+    warehouse.store = ioopm_store_create();
+    warehouse.carts = ioopm_cart_storage_create();
+    warehouse.merch = calloc(warehouse.merch_count, sizeof(merch_slot_t));
+    warehouse.cart_ids = calloc(warehouse.cart_count, sizeof(int));
+
+    for (size_t i = 0; i < warehouse.merch_count; i++)
+    {
+        merch_add(&warehouse, i);
+    }
+    for (size_t i = 0; i < warehouse.cart_count; i++)
+    {
+        cart_open(&warehouse, i);
+    }
+    cleanup();
+
+    double start = now_ns();
+    for (size_t i = 0; i < operations; i++)
+    {
+        size_t cart = rand_r(&warehouse.seed) % warehouse.cart_count;
+        size_t slot = rand_r(&warehouse.seed) % warehouse.merch_count;
+
+        switch (pick_op(&warehouse, weights, total_weight))
+        {
+        case OP_ADD:
+            cart_add(&warehouse, cart, slot);
+            break;
+        case OP_REMOVE:
+            cart_remove(&warehouse, cart);
+            break;
+        case OP_COST:
+            cost_calculate(&warehouse, cart);
+            break;
+        case OP_CHECKOUT:
+            cart_checkout(&warehouse, cart);
+            break;
+        case OP_RENAME:
+            name_set(&warehouse, slot);
+            break;
+        default:
+            store_remove(&warehouse, slot);
+            break;
+        }
+    }
+    double elapsed = now_ns() - start;
+
+    report(&warehouse, operations, elapsed);
+
+    ioopm_cart_storage_destroy(warehouse.carts);
+    ioopm_store_destroy(warehouse.store);
+    free(warehouse.merch);
+    free(warehouse.cart_ids);
+    shutdown();
+    return 0;
+}
@@ -26,6 +26,9 @@ struct entry
     entry_t *next; // points to the next entry (possibly NULL)
 };
 
+// keys and values may be integers, so only the words that hold an object are released
+REFMEM_DECLARE_TYPE(entry_type, entry_t, REFMEM_FIELD(entry_t, next), REFMEM_FIELD(entry_t, key) | REFMEM_FIELD(entry_t, value));
+
 struct hash_table
 {
     entry_t *buckets;
@@ -61,7 +64,7 @@ ioopm_hash_table_t *ioopm_hash_table_create(ioopm_hash_function hash_fun, ioopm_
 {
     ioopm_hash_table_t *ht = allocate(sizeof(ioopm_hash_table_t), hash_table_destructor);
     retain(ht);
-    ht->buckets = allocate_array(HASHTABLE_INITIAL_CAPACITY, sizeof(entry_t), NULL);
+    ht->buckets = allocate_array_typed(HASHTABLE_INITIAL_CAPACITY, &entry_type);
     retain(ht->buckets);
     ht->hash_fun = hash_fun;
     ht->eq_fun = eq_fun;
@@ -88,7 +91,7 @@ void ioopm_hash_table_clear(ioopm_hash_table_t *ht)
 // Creates a new entry with a given key, value and next pointer
 static entry_t *entry_create(elem_t key, elem_t value, entry_t *next)
 {
-    entry_t *new_entry = allocate(sizeof(entry_t), NULL);
+    entry_t *new_entry = allocate_typed(&entry_type);
 
     new_entry->key = key;
     new_entry->value = value;
@@ -118,40 +121,26 @@ static entry_t *find_previous_entry_for_key(entry_t *bucket, elem_t key, ioopm_e
     return prev;
 }
 
+// moves the entries over to the new buckets, every entry keeps the references it holds
 static void resize(ioopm_hash_table_t *ht, size_t new_ht_capacity)
 {
-    entry_t *new_buckets = allocate_array(new_ht_capacity, sizeof(entry_t), NULL);
+    entry_t *new_buckets = allocate_array_typed(new_ht_capacity, &entry_type);
     retain(new_buckets);
 
     for (size_t i = 0; i < ht->ht_capacity; ++i)
     {
         entry_t *current = ht->buckets[i].next;
 
-        if (current != NULL)
-        {
-            retain(current); 
-        }
-        
         while (current != NULL)
         {
-            retain(current->value.string); 
-
-            size_t new_index = ht->hash_fun(current->key) % new_ht_capacity;
-
-            entry_t *new_entry = entry_create(current->key, current->value, new_buckets[new_index].next);
-
             entry_t *old_next = current->next;
-            
-            if (old_next != NULL)
-            {
-                retain(old_next); 
-                
-            }
-            release(current);
+            size_t new_index = ht->hash_fun(current->key) % new_ht_capacity;
 
-            new_buckets[new_index].next = new_entry;
+            current->next = new_buckets[new_index].next;
+            new_buckets[new_index].next = current;
             current = old_next;
         }
+        ht->buckets[i].next = NULL;
     }
 
     release(ht->buckets);
@@ -183,15 +172,12 @@ void ioopm_hash_table_insert(ioopm_hash_table_t *ht, elem_t key, elem_t value)
     }
 }
 
-static void lookup_destructor(obj *obj_ptr) {}
-
-option_t *ioopm_hash_table_lookup(ioopm_hash_table_t *ht, elem_t key)
+static option_t *lookup(ioopm_hash_table_t *ht, elem_t key)
 {
     unsigned bucket_index = get_bucket_index(ht, ht->hash_fun, key);
 
     //option_t *lookup_result = allocate(sizeof(option_t), NULL);
-    option_t *lookup_result = allocate(sizeof(option_t), lookup_destructor);
-    retain(lookup_result);
+    option_t *lookup_result = allocate_atomic(sizeof(option_t));
     entry_t *prev = find_previous_entry_for_key(&ht->buckets[bucket_index], key, ht->eq_fun);
     entry_t *current = prev->next;
     //retain(current);
@@ -208,11 +194,23 @@ option_t *ioopm_hash_table_lookup(ioopm_hash_table_t *ht, elem_t key)
     return lookup_result;
 }
 
+option_t *ioopm_hash_table_lookup(ioopm_hash_table_t *ht, elem_t key)
+{
+    option_t *lookup_result = lookup(ht, key);
+    retain(lookup_result);
+    return lookup_result;
+}
+
+option_t *ioopm_hash_table_lookup_autoreleased(ioopm_hash_table_t *ht, elem_t key)
+{
+    return autorelease(lookup(ht, key));
+}
+
 elem_t ioopm_hash_table_remove(ioopm_hash_table_t *ht, elem_t key)
  {
     unsigned bucket_index = get_bucket_index(ht, ht->hash_fun, key);
 
-    option_t *lookup_result = ioopm_hash_table_lookup(ht, key);
+    option_t *lookup_result = ioopm_hash_table_lookup_autoreleased(ht, key);
     entry_t *prev = find_previous_entry_for_key(&ht->buckets[bucket_index], key, ht->eq_fun);
     entry_t *current = prev->next;
     elem_t removed_value;
@@ -233,6 +231,7 @@ elem_t ioopm_hash_table_remove(ioopm_hash_table_t *ht, elem_t key)
             retain(prev->next);
         }
         release(current);
+        ht->size--;
     }
     else
     {
@@ -240,8 +239,6 @@ elem_t ioopm_hash_table_remove(ioopm_hash_table_t *ht, elem_t key)
         removed_value.void_ptr = NULL;
     }
 
-    release(lookup_result);
-    ht->size--;
     return removed_value;
 }
 
@@ -315,18 +312,9 @@ ioopm_list_t *ioopm_hash_table_values(ioopm_hash_table_t *ht)
 
 bool ioopm_hash_table_has_key(ioopm_hash_table_t *ht, elem_t key)
 {
-    option_t *lookup_result = ioopm_hash_table_lookup(ht, key);
+    option_t *lookup_result = ioopm_hash_table_lookup_autoreleased(ht, key);
 
-    if (lookup_result->success)
-    {
-        release(lookup_result);
-        return true;
-    }
-    else
-    {
-        release(lookup_result);
-        return false;
-    }
+    return lookup_result->success;
 }
 
 bool ioopm_hash_table_has_value(ioopm_hash_table_t *ht, elem_t value)
@@ -72,6 +72,12 @@ void ioopm_hash_table_insert(ioopm_hash_table_t *ht, elem_t key, elem_t value);
 /// @return a heap allocated option with an truth-value and a value
 option_t *ioopm_hash_table_lookup(ioopm_hash_table_t *ht, elem_t key);
 
+/// @brief lookup value for key in hash table ht, without handing the option to the caller
+/// @param ht hash table operated upon
+/// @param key key to lookup
+/// @return an option held by the current autorelease pool, it is not to be released
+option_t *ioopm_hash_table_lookup_autoreleased(ioopm_hash_table_t *ht, elem_t key);
+
 /// @brief remove any mapping from key to a value
 /// @param ht hash table operated upon
 /// @param key key to remove
@@ -128,4 +134,4 @@ bool ioopm_hash_table_all(ioopm_hash_table_t *ht, ioopm_predicate pred, void *ar
 /// @param ht hash table operated upon
 /// @param apply_fun the function to be applied to all elements
 /// @param arg extra argument to apply_fun
-void ioopm_hash_table_apply_to_all(ioopm_hash_table_t *ht, ioopm_apply_function apply_fun, void *arg);
\ No newline at end of file
+void ioopm_hash_table_apply_to_all(ioopm_hash_table_t *ht, ioopm_apply_function apply_fun, void *arg);
\ No newline at end of file
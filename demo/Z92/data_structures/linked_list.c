@@ -16,6 +16,9 @@ struct link
     struct link *next;
 };
 
+// the value may be an integer, so it is only released if it holds an object
+REFMEM_DECLARE_TYPE(link_type, link_t, REFMEM_FIELD(link_t, next), REFMEM_FIELD(link_t, value));
+
 struct list
 {
     link_t *first;
@@ -59,7 +62,7 @@ void ioopm_linked_list_destroy(ioopm_list_t *list)
 
 static link_t *link_create(elem_t value, link_t *next)
 {
-    link_t *new_link = allocate(sizeof(link_t), NULL);
+    link_t *new_link = allocate_typed(&link_type);
     retain(new_link);
 
     new_link->value = value;
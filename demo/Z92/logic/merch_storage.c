@@ -6,6 +6,12 @@
 #include <string.h>
 #include <stdio.h>
 
+// the name is also released through the names array and the carts, so it and the description
+// are checked before they are released
+REFMEM_DECLARE_TYPE(merch_type, ioopm_merch_t, REFMEM_FIELD(ioopm_merch_t, stock),
+                    REFMEM_FIELD(ioopm_merch_t, name) | REFMEM_FIELD(ioopm_merch_t, description));
+REFMEM_DECLARE_TYPE(location_type, location_t, REFMEM_FIELD(location_t, shelf), 0);
+
 static void store_destructor(obj *obj_ptr)
 {
     ioopm_store_t *store = (ioopm_store_t *)obj_ptr;
@@ -35,7 +41,7 @@ ioopm_store_t *ioopm_store_create()
 
 ioopm_merch_t *ioopm_merch_create(char *name, char *description, int price, ioopm_list_t *stock, int stock_size)
 {
-    ioopm_merch_t *new_merch = allocate(sizeof(ioopm_merch_t), NULL);
+    ioopm_merch_t *new_merch = allocate_typed(&merch_type);
 
     new_merch->name = duplicate_string(name);
     release(name);
@@ -140,15 +146,9 @@ void ioopm_store_add(ioopm_store_t *store, ioopm_merch_t *merch)
     store->merch_count++;
 }
 
-static void location_destructor(obj *obj_ptr)
-{
-    location_t *location = (location_t *)obj_ptr;
-    release(location->shelf);
-}
-
 static location_t *location_create(char *shelf, int amount)
 {
-    location_t *location = allocate(sizeof(location_t), location_destructor); 
+    location_t *location = allocate_typed(&location_type); 
     retain(location); 
 
     location->shelf = duplicate_string(shelf);
@@ -173,17 +173,14 @@ static char *shelf_get(location_t *location)
 
 ioopm_merch_t *ioopm_merch_get(ioopm_store_t *store, char *name)
 {
-  option_t *lookup_result = ioopm_hash_table_lookup(store->merch_details, str_elem(name));
+  option_t *lookup_result = ioopm_hash_table_lookup_autoreleased(store->merch_details, str_elem(name));
 
   if (lookup_result->success)
     {
-      ioopm_merch_t *merch_found = lookup_result->value.void_ptr;
-      release(lookup_result);
-      return merch_found;
+      return lookup_result->value.void_ptr;
     }
   else
     {
-      release(lookup_result);
       return NULL;
     }
 }
@@ -362,13 +359,11 @@ static void cart_apply_to_all(ioopm_hash_table_t *ht, ioopm_cart_apply_function
 
 static void search_carts(elem_t key, elem_t *value, void *old_name, void *new_name)
 {
-    option_t *lookup_result = ioopm_hash_table_lookup((ioopm_hash_table_t *) value->void_ptr, str_elem(old_name));
+    option_t *lookup_result = ioopm_hash_table_lookup_autoreleased((ioopm_hash_table_t *) value->void_ptr, str_elem(old_name));
 
     retain(new_name); 
     ioopm_hash_table_insert((ioopm_hash_table_t *) value->void_ptr, str_elem(new_name), lookup_result->value);
     ioopm_hash_table_remove((ioopm_hash_table_t *) value->void_ptr, str_elem(old_name));
-
-    release(lookup_result);
 }
 
 void ioopm_name_set(ioopm_store_t *store, ioopm_merch_t *old_merch, char *new_name, ioopm_hash_table_t *carts)
@@ -379,6 +374,8 @@ void ioopm_name_set(ioopm_store_t *store, ioopm_merch_t *old_merch, char *new_na
 
     ioopm_list_t *stock_copy = ioopm_linked_list_create(get_list_eq_fun(old_stock));
 
+    // ioopm_merch_create releases the description it is given, but old_merch still refers to it
+    retain(description);
     ioopm_merch_t *new_merch = ioopm_merch_create(new_name, description, price, stock_copy, old_merch->stock_size);
 
     for (int i = 0; i < ioopm_linked_list_size(old_stock); i++)
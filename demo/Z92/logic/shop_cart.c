@@ -31,9 +31,8 @@ void ioopm_cart_create(ioopm_carts_t *storage_carts)
 
 ioopm_hash_table_t *ioopm_items_in_cart_get(ioopm_carts_t *storage_carts, int id)
 {
-    option_t *lookup_cart = ioopm_hash_table_lookup(storage_carts->carts, int_elem(id)); 
+    option_t *lookup_cart = ioopm_hash_table_lookup_autoreleased(storage_carts->carts, int_elem(id)); 
     ioopm_hash_table_t *cart_items = lookup_cart->value.void_ptr; 
-    release(lookup_cart); 
 
     return cart_items;
 }
@@ -55,13 +54,12 @@ int ioopm_item_in_cart_amount(ioopm_carts_t *storage_carts, int id, char *merch_
 
     int current_amount = 0;
 
-    option_t *item_in_cart = ioopm_hash_table_lookup(cart_items, str_elem(merch_name));
+    option_t *item_in_cart = ioopm_hash_table_lookup_autoreleased(cart_items, str_elem(merch_name));
 
     if (item_in_cart->success)
     {
         current_amount = item_in_cart->value.integer;
     } 
-    release(item_in_cart); 
     
     return current_amount; 
 }
@@ -69,7 +67,7 @@ int ioopm_item_in_cart_amount(ioopm_carts_t *storage_carts, int id, char *merch_
 void ioopm_cart_add(ioopm_carts_t *storage_carts, int id, char *merch_name, int amount)
 {
     ioopm_hash_table_t *cart_items = ioopm_items_in_cart_get(storage_carts, id);
-    option_t *item_in_cart = ioopm_hash_table_lookup(cart_items, str_elem(merch_name));
+    option_t *item_in_cart = ioopm_hash_table_lookup_autoreleased(cart_items, str_elem(merch_name));
 
     if (item_in_cart->success)
     {
@@ -82,12 +80,11 @@ void ioopm_cart_add(ioopm_carts_t *storage_carts, int id, char *merch_name, int
         retain(merch_name); 
         ioopm_hash_table_insert(cart_items, str_elem(merch_name), int_elem(amount)); 
     }
-    release(item_in_cart); 
 }
 
 void ioopm_cart_remove(ioopm_hash_table_t *cart_items, char *merch_name, int amount)
 {
-    option_t *item_in_cart = ioopm_hash_table_lookup(cart_items, str_elem(merch_name));
+    option_t *item_in_cart = ioopm_hash_table_lookup_autoreleased(cart_items, str_elem(merch_name));
 
     if (item_in_cart->success)
     {
@@ -102,7 +99,6 @@ void ioopm_cart_remove(ioopm_hash_table_t *cart_items, char *merch_name, int amo
             ioopm_hash_table_remove(cart_items, str_elem(merch_name));  
         }
     }
-    release(item_in_cart); 
 }
 
 int ioopm_cost_calculate(ioopm_store_t *store, ioopm_carts_t *storage_carts, int id)
@@ -114,13 +110,14 @@ int ioopm_cost_calculate(ioopm_store_t *store, ioopm_carts_t *storage_carts, int
     for (int i = 0; i < ioopm_linked_list_size(keys); ++i)
     {
         elem_t key = ioopm_linked_list_get(keys, i);
-        option_t *value = ioopm_hash_table_lookup(cart_items, key);
+        // the list releases its elements, but the names are still keys of the cart
+        retain(key.string);
+        option_t *value = ioopm_hash_table_lookup_autoreleased(cart_items, key);
 
         if (value->success)
         {
 	        total_cost += value->value.integer * ioopm_price_get(ioopm_merch_get(store, key.string));
         }  
-        release(value);
     }
     release(keys);
     
@@ -159,15 +156,12 @@ void ioopm_cart_checkout(ioopm_store_t *store, ioopm_carts_t *storage_carts, int
   ioopm_hash_table_t *cart = ioopm_items_in_cart_get(storage_carts, id);
   ioopm_hash_table_apply_to_all(cart, stock_update, store);
 
-  ioopm_hash_table_destroy(cart);
+  // the entry holds the only reference to the cart, it is released with the entry
   ioopm_hash_table_remove(storage_carts->carts, int_elem(id));
 }
 
 void ioopm_cart_destroy(ioopm_carts_t *storage_carts, int id)
 {
-    ioopm_hash_table_t *cart_items = ioopm_items_in_cart_get(storage_carts, id);
-
-    ioopm_hash_table_destroy(cart_items);
     ioopm_hash_table_remove(storage_carts->carts, int_elem(id));
 }
 
@@ -4,6 +4,8 @@
 #include "../data_structures/common.h"
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include "../../../src/refmem.h"
 
 int init_suite(void)
@@ -393,7 +395,7 @@ static void add_version_value(elem_t key_ignored, elem_t *value, void *arg)
     char *original_value = value->string;
 
     // allocate memory for the new value, since new value has more characters than the original
-    char *new_value = allocate_array(strlen(version) + 1, strlen(original_value) * 8, NULL); // +1 for null-terminator
+    char *new_value = allocate_array_atomic(strlen(version) + strlen(original_value) + 1, sizeof(char)); // +1 for null-terminator
 
     strcpy(new_value, version);
     strcat(new_value, original_value);
@@ -470,6 +472,73 @@ void boundary_test()
     shutdown();
 }
 
+static unsigned hash_fun_key_string(elem_t key)
+{
+    unsigned hash = 0;
+    for (char *c = key.string; *c != '\0'; c++)
+    {
+        hash = hash * 31 + *c;
+    }
+    return hash;
+}
+
+static bool string_eq_fun(elem_t a, elem_t b)
+{
+    return strcmp(a.string, b.string) == 0;
+}
+
+void resize_keeps_references_test()
+{
+    ioopm_hash_table_t *ht = ioopm_hash_table_create(hash_fun_key_string, string_eq_fun);
+    char *keys[1000];
+    char buffer[16];
+
+    // object keys and integer values, through several resizes
+    for (int i = 0; i < 1000; i++)
+    {
+        sprintf(buffer, "key%d", i);
+        keys[i] = duplicate_string(buffer);
+        retain(keys[i]);
+        ioopm_hash_table_insert(ht, str_elem(keys[i]), int_elem(i));
+    }
+
+    for (int i = 0; i < 1000; i++)
+    {
+        CU_ASSERT_EQUAL(rc(keys[i]), 2);
+        option_t *result = ioopm_hash_table_lookup_autoreleased(ht, str_elem(keys[i]));
+        CU_ASSERT_TRUE(result->success && result->value.integer == i);
+    }
+
+    release(ht);
+    cleanup();
+    for (int i = 0; i < 1000; i++)
+    {
+        CU_ASSERT_EQUAL(rc(keys[i]), 1);
+        release(keys[i]);
+    }
+    shutdown();
+}
+
+void remove_missing_key_test()
+{
+    ioopm_hash_table_t *ht = ioopm_hash_table_create(hash_fun_key_int, bool_eq_fun);
+    ioopm_hash_table_insert(ht, int_elem(1), int_elem(1));
+    size_t capacity = ioopm_get_ht_capacity(ht);
+
+    for (int i = 2; i < 100; i++)
+    {
+        ioopm_hash_table_remove(ht, int_elem(i));
+    }
+    ioopm_hash_table_insert(ht, int_elem(2), int_elem(2));
+
+    // the keys that were never there do not count, so the table does not grow
+    CU_ASSERT_EQUAL(ioopm_get_ht_capacity(ht), capacity);
+    CU_ASSERT_EQUAL(ioopm_hash_table_size(ht), 2);
+
+    release(ht);
+    shutdown();
+}
+
 int main()
 {
     if (CU_initialize_registry() != CUE_SUCCESS)
@@ -497,7 +566,9 @@ int main()
          CU_add_test(my_test_suite, "Predicate function that satisfies any antry", test_ht_has_any) == NULL ||
          CU_add_test(my_test_suite, "Predicate function that satisfies all entries", test_ht_has_all) == NULL ||
          CU_add_test(my_test_suite, "Apply function on all entries", test_ht_apply_to_all) == NULL ||
-         CU_add_test(my_test_suite, "Boundary test", boundary_test) == NULL
+         CU_add_test(my_test_suite, "Boundary test", boundary_test) == NULL ||
+         CU_add_test(my_test_suite, "Resizing keeps the references of the entries", resize_keeps_references_test) == NULL ||
+         CU_add_test(my_test_suite, "Removing a key that is not there", remove_missing_key_test) == NULL
         )
        )
     {
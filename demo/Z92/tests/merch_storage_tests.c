@@ -279,6 +279,42 @@ void set_name_test()
     shutdown();
 }
 
+void set_name_keeps_description_test()
+{
+    ioopm_store_t *store = store_with_inputs();
+    ioopm_merch_t *apple = ioopm_merch_get(store, "Apple");
+    ioopm_name_set(store, apple, duplicate_string("Pear"), NULL);
+    // the old merch is freed here, and must leave the description alone
+    cleanup();
+
+    char *others[NO_ITEMS];
+    for (int i = 0; i < NO_ITEMS; i++)
+    {
+        others[i] = duplicate_string("Tan");
+    }
+
+    ioopm_merch_t *pear = ioopm_merch_get(store, "Pear");
+    CU_ASSERT_STRING_EQUAL(pear->description, "Red");
+    CU_ASSERT_EQUAL(rc(pear->description), 1);
+
+    char *shelf[] = {"A4", "B36", "R62"};
+    for (int i = 0; i < 3; i++)
+    {
+        location_t *location = ioopm_linked_list_get(pear->stock, i).void_ptr;
+        CU_ASSERT_STRING_EQUAL(location->shelf, shelf[i]);
+        CU_ASSERT_EQUAL(rc(location->shelf), 1);
+    }
+
+    for (int i = 0; i < NO_ITEMS; i++)
+    {
+        CU_ASSERT_STRING_EQUAL(others[i], "Tan");
+        release(others[i]);
+    }
+
+    release(store);
+    shutdown();
+}
+
 void set_description_test()
 {
     ioopm_store_t *store = ioopm_store_create();
@@ -448,6 +484,7 @@ int main()
             CU_add_test(my_test_suite, "test for the store size", store_size_test) == NULL ||
             CU_add_test(my_test_suite, "getting merch from store", get_merch_test) == NULL ||
             CU_add_test(my_test_suite, "test for editing name of merch", set_name_test) == NULL ||
+            CU_add_test(my_test_suite, "renaming merch keeps its description", set_name_keeps_description_test) == NULL ||
             CU_add_test(my_test_suite, "test for editing description of merch", set_description_test) == NULL ||
             CU_add_test(my_test_suite, "test for editing price of merch", set_price_test) == NULL ||
             CU_add_test(my_test_suite, "test if store is empty", store_is_empty_test) == NULL ||
@@ -212,6 +212,41 @@ void checkout_cart_test()
     shutdown();
 }
 
+void repeated_cost_and_checkout_test()
+{
+    ioopm_carts_t *storage_carts = ioopm_cart_storage_create();
+    ioopm_store_t *store = store_with_inputs();
+    char *merch_name = ioopm_merch_get(store, "Apple")->name;
+    unsigned short references = rc(merch_name);
+
+    for (int id = 0; id < 3; id++)
+    {
+        ioopm_cart_create(storage_carts);
+        storage_carts->total_carts++;
+        ioopm_cart_add(storage_carts, id, merch_name, 1);
+
+        for (int i = 0; i < 3; i++)
+        {
+            CU_ASSERT_EQUAL(ioopm_cost_calculate(store, storage_carts, id), 10);
+        }
+
+        ioopm_cart_checkout(store, storage_carts, id);
+        cleanup();
+        CU_ASSERT_EQUAL(rc(merch_name), references);
+    }
+
+    // a cart created after the checkouts does not share anything with the freed ones
+    ioopm_cart_create(storage_carts);
+    storage_carts->total_carts++;
+    ioopm_cart_add(storage_carts, 3, merch_name, 1);
+    CU_ASSERT_EQUAL(ioopm_cost_calculate(store, storage_carts, 3), 10);
+    CU_ASSERT_EQUAL(ioopm_merch_get(store, merch_name)->stock_size, 2);
+
+    release(storage_carts); 
+    release(store); 
+    shutdown();
+}
+
 int main()
 {
     if (CU_initialize_registry() != CUE_SUCCESS)
@@ -232,7 +267,8 @@ int main()
          CU_add_test(my_test_suite, "Has merch in cart test", has_merch_in_cart_test) == NULL ||
          CU_add_test(my_test_suite, "Calculate total in cart", cost_calculate_test) == NULL ||
          CU_add_test(my_test_suite, "Checkout cart test", checkout_cart_test) == NULL ||
-         CU_add_test(my_test_suite, "Test for removing a cart with items", remove_cart_test) == NULL
+         CU_add_test(my_test_suite, "Test for removing a cart with items", remove_cart_test) == NULL ||
+         CU_add_test(my_test_suite, "Repeated cost calculations and checkouts", repeated_cost_and_checkout_test) == NULL
         )
     )
 
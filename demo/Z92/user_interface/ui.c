@@ -260,6 +260,11 @@ void merch_edit(ioopm_store_t *store, ioopm_carts_t *storage_carts)
 
     puts("\nNew name: ");
     char *new_name = merch_does_exist_check(store, false);
+    if (new_name == NULL)
+    {
+        release(input_name);
+        return;
+    }
     char *new_description = ioopm_ask_question_string("\nWrite the new decription: ");
     int new_price = ioopm_ask_question_int("\nWrite the new price: ");
 
@@ -467,8 +472,12 @@ void event_loop(ioopm_store_t *store, ioopm_carts_t *storage_carts)
 
     do
     {
+        // the answers to the menu are scratch data, freed together when the command is done
+        refmem_arena_t *command_arena = arena_create();
+        // and the lookups of the command are autoreleased into a pool of its own
+        refmem_pool_push();
         print_menu();
-        char *menu_choice = ioopm_ask_question_string(" ");
+        char *menu_choice = ioopm_ask_question_string_arena(" ", command_arena);
         if (strlen(menu_choice) == 1) {
             switch (toupper(*menu_choice))
             {
@@ -509,7 +518,7 @@ void event_loop(ioopm_store_t *store, ioopm_carts_t *storage_carts)
 	                cart_checkout(store, storage_carts);
                     break;
                 case 'Q':
-                    quit_confirmation = ioopm_ask_question_string("Press 'Y' if you really want to quit");
+                    quit_confirmation = ioopm_ask_question_string_arena("Press 'Y' if you really want to quit", command_arena);
 
                     if (toupper(*quit_confirmation) == 'Y' && strlen(quit_confirmation) == 1)
                     {
@@ -528,13 +537,50 @@ void event_loop(ioopm_store_t *store, ioopm_carts_t *storage_carts)
             puts("\nTry again with a valid input");
         }
         release(menu_choice); 
+        refmem_pool_pop();
+        arena_destroy(command_arena);
     } while (running); 
 }
 
-int main() {
-    ioopm_store_t *store = ioopm_store_create();
-    ioopm_carts_t *storage_carts = ioopm_cart_storage_create();
+// the root of a heap file, see refmem_heap_open
+typedef struct
+{
+    ioopm_store_t *store;
+    ioopm_carts_t *storage_carts;
+} saved_webstore_t;
+
+int main(int argc, char *argv[]) {
+    ioopm_store_t *store;
+    ioopm_carts_t *storage_carts;
+
+    // given a file, the store and the carts are kept in it, and are back at once the next time
+    if (argc > 1)
+    {
+        if (!refmem_heap_open(argv[1], 0))
+        {
+            return 1;
+        }
+        saved_webstore_t *saved = refmem_heap_root();
+        if (saved == NULL)
+        {
+            saved = allocate(sizeof(saved_webstore_t), NULL);
+            saved->store = ioopm_store_create();
+            saved->storage_carts = ioopm_cart_storage_create();
+            refmem_heap_set_root(saved);
+        }
+        store = saved->store;
+        storage_carts = saved->storage_carts;
+    }
+    else
+    {
+        store = ioopm_store_create();
+        storage_carts = ioopm_cart_storage_create();
+    }
+    // they live as long as the program, so passing them around never touches their counts
+    refmem_make_immortal(store);
+    refmem_make_immortal(storage_carts);
     event_loop(store, storage_carts);
-    shutdown(); 
+    // the store and the carts are freed whole with everything else
+    refmem_teardown(0);
     return 0;
 }
@@ -57,9 +57,10 @@ static int read_string(char *buf, int buf_size)
     return strlen(buf);
 }
 
-static answer_t ask_question(char *question, check_func check, convert_func convert)
+// the answer is allocated from the arena if one is given
+static answer_t ask_question(char *question, check_func check, convert_func convert, refmem_arena_t *arena)
 {
-    char *answer = allocate(BUF_SIZE, NULL);
+    char *answer = arena ? arena_allocate_atomic(arena, BUF_SIZE) : allocate_atomic(BUF_SIZE);
   
     puts(question);
     read_string(answer, BUF_SIZE);
@@ -84,14 +85,19 @@ static answer_t ask_question(char *question, check_func check, convert_func conv
 
 char *ioopm_ask_question_string(char *question)
 {
-    return ask_question(question, not_empty, NULL).string_value;
+    return ask_question(question, not_empty, NULL, NULL).string_value;
+}
+
+char *ioopm_ask_question_string_arena(char *question, refmem_arena_t *arena)
+{
+    return ask_question(question, not_empty, NULL, arena).string_value;
 }
 
 int ioopm_ask_question_int(char *question)
 {
-    return ask_question(question, is_number, (convert_func)atoi).int_value;
+    return ask_question(question, is_number, (convert_func)atoi, NULL).int_value;
 }
 
 char *ioopm_ask_question_shelf(char *question) {
-    return ask_question(question, check_shelf, NULL).string_value;
+    return ask_question(question, check_shelf, NULL, NULL).string_value;
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include <stdbool.h>
+#include "../../../src/refmem.h"
 
 #define BUF_SIZE 255
 
@@ -37,6 +38,12 @@ int ioopm_ask_question_int(char *question);
 /// @return a string answer of the question
 char *ioopm_ask_question_string(char *question);
 
+/// @brief asks a question and reads the user answer from input line into an object of an arena
+/// @param question question to print for user to answer, the answer being a string
+/// @param arena the arena the answer is allocated from, it is freed with the arena
+/// @return a string answer of the question
+char *ioopm_ask_question_string_arena(char *question, refmem_arena_t *arena);
+
 /// @brief asks a question and reads the user answer from input line
 /// @param question question to print for user to answer, the answer being a string on format ex. "A54"
 /// @return a shelf answer of the question
@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "page_map.h"
+
+#define ADDRESS_BITS 48
+#define LEAF_BITS 16
+#define ROOT_BITS (ADDRESS_BITS - PAGE_MAP_PAGE_BITS - LEAF_BITS)
+
+// entries are atomic so that any thread may look up pages while another marks its own
+typedef _Atomic uint8_t page_entry_t;
+
+static _Atomic(page_entry_t *) root[(size_t)1 << ROOT_BITS];
+
+static size_t root_index(uintptr_t address)
+{
+    return address >> (PAGE_MAP_PAGE_BITS + LEAF_BITS);
+}
+
+static size_t leaf_index(uintptr_t address)
+{
+    return (address >> PAGE_MAP_PAGE_BITS) & (((size_t)1 << LEAF_BITS) - 1);
+}
+
+void page_map_set(void *ptr, bool owned)
+{
+    uintptr_t address = (uintptr_t)ptr;
+    page_entry_t *leaf = atomic_load_explicit(&root[root_index(address)], memory_order_acquire);
+
+    if (leaf == NULL)
+    {
+        if (!owned)
+        {
+            return;
+        }
+
+        page_entry_t *new_leaf = calloc((size_t)1 << LEAF_BITS, sizeof(page_entry_t));
+        if (atomic_compare_exchange_strong_explicit(&root[root_index(address)], &leaf, new_leaf,
+                                                    memory_order_acq_rel, memory_order_acquire))
+        {
+            leaf = new_leaf;
+        }
+        else
+        {
+            // another thread installed the leaf first
+            free(new_leaf);
+        }
+    }
+
+    atomic_store_explicit(&leaf[leaf_index(address)], owned, memory_order_release);
+}
+
+bool page_map_get(void *ptr)
+{
+    uintptr_t address = (uintptr_t)ptr;
+
+    if (address >> ADDRESS_BITS != 0)
+    {
+        return false;
+    }
+
+    page_entry_t *leaf = atomic_load_explicit(&root[root_index(address)], memory_order_acquire);
+    return leaf != NULL && atomic_load_explicit(&leaf[leaf_index(address)], memory_order_acquire);
+}
+
+void page_map_clear()
+{
+    for (size_t i = 0; i < ((size_t)1 << ROOT_BITS); i++)
+    {
+        free(atomic_exchange_explicit(&root[i], NULL, memory_order_acq_rel));
+    }
+}
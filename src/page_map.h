@@ -0,0 +1,29 @@
+#pragma once
+#include <stdlib.h>
+#include <stdbool.h>
+
+/**
+ * @file page_map.h
+ * @brief A two-level radix map from PAGE_MAP_PAGE_SIZE aligned pages to whether refmem owns them.
+ *
+ * The lower 48 bits of an address are split into a root index, a leaf index and an
+ * offset inside the page. Leaves are allocated the first time a page in their range
+ * is marked, so a lookup costs at most two loads and never allocates. Lookups and
+ * marks may run concurrently from several threads, page_map_clear may not.
+*/
+
+#define PAGE_MAP_PAGE_BITS 16
+#define PAGE_MAP_PAGE_SIZE ((size_t)1 << PAGE_MAP_PAGE_BITS)
+
+/// @brief Marks or unmarks the page containing an address
+/// @param ptr an address inside the page
+/// @param owned true to mark the page as owned, false to unmark it
+void page_map_set(void *ptr, bool owned);
+
+/// @brief Tests whether the page containing an address is marked
+/// @param ptr any address
+/// @return true if the page containing ptr is marked, else false
+bool page_map_get(void *ptr);
+
+/// @brief Returns all memory used by the page map, unmarking every page
+void page_map_clear();
@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "pointer_set.h"
+
+#define INITIAL_CAPACITY_BITS 6
+#define MIGRATION_STEP 16
+
+typedef struct
+{
+    void **slots;
+    size_t size;
+    size_t mask;
+    unsigned bits;
+} table_t;
+
+struct pointer_set
+{
+    table_t current;
+    table_t old; // the table being migrated from, slots are NULL when no migration is in progress
+    size_t migration_index;
+};
+
+// Fibonacci hashing, the low bits of a pointer are mostly zero due to alignment
+static size_t home_index(table_t *table, void *ptr)
+{
+    uint64_t hash = ((uint64_t)(uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ull;
+    return (size_t)(hash >> (64 - table->bits));
+}
+
+static void table_init(table_t *table, unsigned bits)
+{
+    table->slots = calloc((size_t)1 << bits, sizeof(void *));
+    table->size = 0;
+    table->mask = ((size_t)1 << bits) - 1;
+    table->bits = bits;
+}
+
+static size_t table_capacity(table_t *table)
+{
+    return table->mask + 1;
+}
+
+static void table_insert(table_t *table, void *ptr)
+{
+    size_t index = home_index(table, ptr);
+
+    while (table->slots[index] != NULL)
+    {
+        index = (index + 1) & table->mask;
+    }
+
+    table->slots[index] = ptr;
+    table->size++;
+}
+
+static bool table_find(table_t *table, void *ptr, size_t *found_index)
+{
+    size_t index = home_index(table, ptr);
+
+    while (table->slots[index] != NULL)
+    {
+        if (table->slots[index] == ptr)
+        {
+            *found_index = index;
+            return true;
+        }
+        index = (index + 1) & table->mask;
+    }
+
+    return false;
+}
+
+// Backward shift deletion: every entry after the hole in the same probe run that
+// may legally live in the hole is moved into it, until an empty slot is reached.
+static void table_remove_at(table_t *table, size_t index)
+{
+    size_t hole = index;
+    size_t current = index;
+
+    while (true)
+    {
+        current = (current + 1) & table->mask;
+        void *ptr = table->slots[current];
+
+        if (ptr == NULL)
+        {
+            break;
+        }
+
+        size_t home = home_index(table, ptr);
+        if (((current - home) & table->mask) >= ((current - hole) & table->mask))
+        {
+            table->slots[hole] = ptr;
+            hole = current;
+        }
+    }
+
+    table->slots[hole] = NULL;
+    table->size--;
+}
+
+static void migration_finish(pointer_set_t *set)
+{
+    free(set->old.slots);
+    set->old.slots = NULL;
+    set->old.size = 0;
+}
+
+// Moves at least MIGRATION_STEP slots of the old table into the current one. A step
+// always ends on an empty slot so that the old table never holds a half-moved probe
+// run, which keeps lookups and backward shifts in the old table correct between steps.
+static void migration_step(pointer_set_t *set, size_t min_slots)
+{
+    table_t *old = &set->old;
+    size_t visited = 0;
+
+    while (old->slots != NULL)
+    {
+        void *ptr = old->slots[set->migration_index];
+
+        if (ptr != NULL)
+        {
+            table_insert(&set->current, ptr);
+            old->slots[set->migration_index] = NULL;
+            old->size--;
+        }
+
+        set->migration_index = (set->migration_index + 1) & old->mask;
+        visited++;
+
+        if (old->size == 0)
+        {
+            migration_finish(set);
+        }
+        else if (visited >= min_slots && ptr == NULL)
+        {
+            break;
+        }
+    }
+}
+
+static void grow(pointer_set_t *set)
+{
+    if (set->old.slots != NULL)
+    {
+        migration_step(set, SIZE_MAX);
+    }
+
+    set->old = set->current;
+    table_init(&set->current, set->old.bits + 1);
+
+    // start right after an empty slot, so the first step begins at a probe run boundary
+    size_t start = 0;
+    while (set->old.slots[start] != NULL)
+    {
+        start++;
+    }
+    set->migration_index = (start + 1) & set->old.mask;
+}
+
+pointer_set_t *pointer_set_create()
+{
+    pointer_set_t *set = calloc(1, sizeof(pointer_set_t));
+    table_init(&set->current, INITIAL_CAPACITY_BITS);
+    return set;
+}
+
+void pointer_set_destroy(pointer_set_t *set)
+{
+    if (set != NULL)
+    {
+        free(set->current.slots);
+        free(set->old.slots);
+    }
+    free(set);
+}
+
+void pointer_set_insert(pointer_set_t *set, void *ptr)
+{
+    // keep the load factor of the current table at or below 1/2
+    if ((set->current.size + set->old.size + 1) * 2 > table_capacity(&set->current))
+    {
+        grow(set);
+    }
+
+    table_insert(&set->current, ptr);
+    migration_step(set, MIGRATION_STEP);
+}
+
+bool pointer_set_remove(pointer_set_t *set, void *ptr)
+{
+    size_t index;
+    bool removed = false;
+
+    if (table_find(&set->current, ptr, &index))
+    {
+        table_remove_at(&set->current, index);
+        removed = true;
+    }
+    else if (set->old.slots != NULL && table_find(&set->old, ptr, &index))
+    {
+        table_remove_at(&set->old, index);
+        removed = true;
+    }
+
+    migration_step(set, MIGRATION_STEP);
+    return removed;
+}
+
+bool pointer_set_contains(pointer_set_t *set, void *ptr)
+{
+    size_t index;
+
+    if (table_find(&set->current, ptr, &index))
+    {
+        return true;
+    }
+
+    return set->old.slots != NULL && table_find(&set->old, ptr, &index);
+}
+
+size_t pointer_set_size(pointer_set_t *set)
+{
+    return set->current.size + set->old.size;
+}
+
+static size_t table_copy_to(table_t *table, void **array)
+{
+    size_t copied = 0;
+
+    for (size_t i = 0; table->slots != NULL && i < table_capacity(table); i++)
+    {
+        if (table->slots[i] != NULL)
+        {
+            array[copied++] = table->slots[i];
+        }
+    }
+
+    return copied;
+}
+
+size_t pointer_set_copy_to(pointer_set_t *set, void **array)
+{
+    size_t copied = table_copy_to(&set->current, array);
+    return copied + table_copy_to(&set->old, array + copied);
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdlib.h>
+#include <stdbool.h>
+
+/**
+ * @file pointer_set.h
+ * @brief A hash set of pointers used by refmem to keep track of its allocated objects.
+ *
+ * The set uses open addressing with linear probing. Removal shifts the following
+ * entries of the probe run backwards instead of leaving tombstones, so lookups never
+ * have to skip dead slots. When the set grows, the entries of the old table are moved
+ * over to the new one a few slots at a time by the following operations, so no single
+ * insert has to rehash the whole set.
+ *
+ * NULL can not be stored in the set since it marks an empty slot.
+*/
+
+typedef struct pointer_set pointer_set_t;
+
+/// @brief Creates a new empty pointer set
+/// @return an empty pointer set
+pointer_set_t *pointer_set_create();
+
+/// @brief Tears down the pointer set and returns its memory (but not the memory of the pointers)
+/// @param set the set to be destroyed
+void pointer_set_destroy(pointer_set_t *set);
+
+/// @brief Inserts a pointer into the set in amortized O(1) time
+/// @param set the pointer set
+/// @param ptr the pointer to insert, expected to be non-NULL and not already in the set
+void pointer_set_insert(pointer_set_t *set, void *ptr);
+
+/// @brief Removes a pointer from the set in amortized O(1) time
+/// @param set the pointer set
+/// @param ptr the pointer to remove
+/// @return true if the pointer was in the set, else false
+bool pointer_set_remove(pointer_set_t *set, void *ptr);
+
+/// @brief Tests if a pointer is in the set in O(1) time
+/// @param set the pointer set
+/// @param ptr the pointer sought
+/// @return true if ptr is in the set, else false
+bool pointer_set_contains(pointer_set_t *set, void *ptr);
+
+/// @brief Returns the number of pointers in the set
+/// @param set the pointer set
+/// @return the number of pointers in the set
+size_t pointer_set_size(pointer_set_t *set);
+
+/// @brief Copies every pointer in the set into an array, in no particular order
+/// @param set the pointer set
+/// @param array an array with room for at least pointer_set_size(set) pointers
+/// @return the number of pointers copied
+size_t pointer_set_copy_to(pointer_set_t *set, void **array);
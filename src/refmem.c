@@ -1,11 +1,21 @@
 #include "refmem.h"
-#include "queue.h"
-#include "list.h"
+#include "pointer_set.h"
+#include "slab.h"
+#include "sync.h"
+#include "trace.h"
 #include <stdint.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <assert.h>
 #include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <execinfo.h>
 
 #define COUNTERSIZE sizeof(unsigned short)
 #define DESTRUCTOR_PTR_SIZE sizeof(function1_t*)
@@ -13,216 +23,2980 @@
 
 #define MAX_ALLOCATED_OBJECTS 1000
 
-static size_t cascade_limit = 5;
-static queue *to_be_freed = NULL;
-list_t *allocated_pointers = NULL;
+// objects up to this size are served from slabs, larger ones from calloc or mmap,
+// defining it as 0 turns the slabs off. By default it is the largest slot minus the header.
+#ifndef SMALL_OBJECT_THRESHOLD
+#define SMALL_OBJECT_THRESHOLD (SLAB_MAX_SLOT - sizeof(meta_data_t))
+#endif
+
+// objects of at least this size get a mapping of their own, 0 maps none
+#ifndef LARGE_OBJECT_THRESHOLD
+#define LARGE_OBJECT_THRESHOLD ((size_t)64 << 10)
+#endif
+
+// mapped objects of at least this size ask for transparent huge pages, 0 asks for none
+#ifndef HUGE_PAGE_THRESHOLD
+#define HUGE_PAGE_THRESHOLD ((size_t)4 << 20)
+#endif
+
+#define FLAG_SLAB 0x1
+#define FLAG_BUFFERED 0x2 // in the set of possible cycle roots
+#define FLAG_TYPED 0x10   // from allocate_typed, the header holds a type descriptor instead of a destructor
+#define FLAG_ATOMIC 0x20  // from allocate_atomic, holds no references so it is never scanned
+#define FLAG_MAPPED 0x40  // in a mapping of its own, see map_object
+#define FLAG_ARENA 0x80   // bump allocated in the chunk of an arena, see arena_allocate
+#define FLAG_AUTORELEASED 0x100 // an autorelease pool holds a reference, see autorelease
+#define FLAG_WEAK 0x200   // weakly referenced, the header holds an index in weak_table instead of a destructor
+#define FLAG_SAMPLED 0x400 // picked by the heap profiler, see refmem_profile_start
+#define FLAG_PERSISTENT 0x800 // in the heap opened by refmem_heap_open
+#define FLAG_IMMORTAL 0x1000 // never freed, retain and release leave it alone, see refmem_make_immortal
+
+// colours of the cycle collector, see collect_cycles
+#define COLOR_MASK 0xc
+#define COLOR_BLACK 0x0  // in use, or not looked at
+#define COLOR_GRAY 0x4   // possibly part of a garbage cycle
+#define COLOR_WHITE 0x8  // part of a garbage cycle
+#define COLOR_PURPLE 0xc // possible root of a garbage cycle
+
+#define DEFAULT_CYCLE_THRESHOLD 10000
+
+// objects whose count has reached zero, in a ring. Headers have no room for a link, so the ring
+// is grown by allocation to a slot for every live object of the thread, and release never allocates.
+typedef struct
+{
+    obj **objects;
+    size_t capacity; // a power of two
+    size_t front;
+    size_t size;
+    size_t bytes; // headers included
+} free_queue_t;
+
+// with the adaptive cascade, every allocation frees an extra 1/CASCADE_BACKLOG_RATIO of the backlog
+#define CASCADE_BACKLOG_RATIO 16
+#define DEFAULT_HIGH_WATER_OBJECTS ((size_t)1 << 16)
+#define DEFAULT_HIGH_WATER_BYTES ((size_t)16 << 20)
+#define FREE_QUEUE_INITIAL_CAPACITY 64
+
+// every thread has its own free queue and cascade limit when built with REFMEM_THREAD_SAFE
+static THREAD_LOCAL size_t cascade_limit = 5;
+static THREAD_LOCAL size_t cascade_time_budget = 0;
+static THREAD_LOCAL size_t cascade_byte_budget = 0;
+static THREAD_LOCAL bool cascade_adaptive = true;
+static THREAD_LOCAL size_t high_water_objects = DEFAULT_HIGH_WATER_OBJECTS;
+static THREAD_LOCAL size_t high_water_bytes = DEFAULT_HIGH_WATER_BYTES;
+static THREAD_LOCAL refmem_pause_stats_t pause_stats;
+static THREAD_LOCAL refmem_backlog_t backlog;
+static THREAD_LOCAL refmem_stats_t heap_stats;
+// the heap profiler samples the allocation that makes this reach zero, see profile_allocation
+static THREAD_LOCAL size_t bytes_until_sample = 0;
+static THREAD_LOCAL free_queue_t to_be_freed = {NULL, 0, 0, 0, 0};
+static THREAD_LOCAL bool freeing = false; // keeps releases inside destructors from draining the queue again
+
+// objects that have been released to a non-zero count, the cycle collector starts from them
+static pointer_set_t *cycle_roots = NULL;
+static size_t cycle_threshold = DEFAULT_CYCLE_THRESHOLD;
+static bool collecting = false;
+static THREAD_LOCAL bool thread_registered = false;
+
+pointer_set_t *allocated_pointers = NULL; // objects that are not served from slabs
+static sync_lock_t allocated_pointers_lock = SYNC_LOCK_INITIALIZER;
+
+// bounds of every object handed out so far, lets the scanner reject most non-pointers at once
+static _Atomic uintptr_t lowest_object = UINTPTR_MAX;
+static _Atomic uintptr_t highest_object = 0;
 
 typedef struct
 {
     unsigned short counter;
-    unsigned short size;
-    function1_t destructor;
+    unsigned short size;       // the size of a slab object, other objects keep theirs in a large_record_t
+    unsigned short flags;
+    unsigned short destructor; // index in destructor_table, of the type descriptor with FLAG_TYPED, in weak_table with FLAG_WEAK
+#ifdef REFMEM_THREAD_SAFE
+    // biased reference counting: counter is only touched by the owner thread, without atomics,
+    // while other threads count in shared_counter, see retain and release
+    unsigned short owner;
+    _Atomic int shared_counter;
+    obj *next; // link in the owner's list of objects waiting to be merged
+#endif
 } meta_data_t; //__attribute__((packed)) meta_data_t;
 
+_Static_assert(SYNC_THREAD_SAFE || sizeof(meta_data_t) == 8, "the header of an object takes one word");
+_Static_assert(SMALL_OBJECT_THRESHOLD + sizeof(meta_data_t) <= SLAB_MAX_SLOT, "small objects and their header must fit in a slab slot");
+_Static_assert(SLAB_MAX_SLOT <= USHRT_MAX, "the size of every slab object must fit in its header");
+
+// objects that are not served from slabs are preceded by their full size
+typedef struct
+{
+    size_t size;
+} large_record_t;
+
+// the heap opened by refmem_heap_open, NULL while none is open
+typedef struct heap_header heap_header_t;
+static heap_header_t *persistent_heap = NULL;
+
+// destructors and type descriptors are stored once in this table, headers only hold their
+// index. Index 0 stands for no destructor. Entries are never removed, so they are read
+// without locking.
+#define DESTRUCTOR_TABLE_BITS 12
+#define DESTRUCTOR_TABLE_SIZE ((size_t)1 << DESTRUCTOR_TABLE_BITS)
+#define DESTRUCTOR_HASH 0x9e3779b97f4a7c15ull
+
+static _Atomic uintptr_t destructor_table[DESTRUCTOR_TABLE_SIZE];
+static sync_lock_t destructor_table_lock = SYNC_LOCK_INITIALIZER;
+
+static void heap_remember_destructor(size_t slot, uintptr_t destructor);
+
+// finds the index of a destructor or a type descriptor, adding it on first use
+static unsigned short destructor_index(uintptr_t destructor)
+{
+    if (destructor == 0)
+    {
+        return 0;
+    }
+
+    size_t slot = ((uint64_t)destructor * DESTRUCTOR_HASH) >> (64 - DESTRUCTOR_TABLE_BITS);
+    for (size_t probes = 0; probes < DESTRUCTOR_TABLE_SIZE; probes++, slot = (slot + 1) % DESTRUCTOR_TABLE_SIZE)
+    {
+        if (slot == 0)
+        {
+            continue;
+        }
+
+        uintptr_t entry = atomic_load_explicit(&destructor_table[slot], memory_order_acquire);
+        if (entry == 0)
+        {
+            sync_lock(&destructor_table_lock);
+            entry = atomic_load_explicit(&destructor_table[slot], memory_order_relaxed);
+            if (entry == 0)
+            {
+                atomic_store_explicit(&destructor_table[slot], destructor, memory_order_release);
+                heap_remember_destructor(slot, destructor);
+                entry = destructor;
+            }
+            sync_unlock(&destructor_table_lock);
+        }
+        if (entry == destructor)
+        {
+            return slot;
+        }
+    }
+
+    fprintf(stderr, "refmem: more than %zu destructors and types\n", DESTRUCTOR_TABLE_SIZE - 1);
+    abort();
+}
+
+// objects that are weakly referenced lend the destructor field of their header to the index
+// of a slot here, which holds their weak reference and their destructor index. Slots are
+// recycled through a free list, so the table only grows with the objects weakly referenced at once.
+#define WEAK_TABLE_SIZE ((size_t)USHRT_MAX + 1)
+
+struct weak_ref
+{
+    obj *target; // NULL once the target is freed
+};
+
+typedef struct
+{
+    weak_ref_t *ref;
+    unsigned short destructor; // the destructor index the header would hold
+    unsigned short next_free;
+} weak_slot_t;
+
+static weak_slot_t weak_table[WEAK_TABLE_SIZE];
+static size_t weak_table_used = 0;   // slots handed out at least once
+static size_t weak_free_slots = 0;   // slots on the free list
+static unsigned short weak_free = 0; // the first slot on the free list
+static sync_lock_t weak_table_lock = SYNC_LOCK_INITIALIZER;
+
+// the index in destructor_table of an object, wherever its header keeps it
+static unsigned short destructor_slot(meta_data_t *meta_data)
+{
+    return meta_data->flags & FLAG_WEAK ? weak_table[meta_data->destructor].destructor : meta_data->destructor;
+}
+
 meta_data_t *get_meta_data(obj *obj_ptr)
 {
     return ((meta_data_t *)obj_ptr - 1);
 }
 
-function1_t get_destructor(obj *obj_ptr)
+static large_record_t *get_large_record(meta_data_t *meta_data)
+{
+    return ((large_record_t *)meta_data - 1);
+}
+
+static size_t page_size()
+{
+    return sysconf(_SC_PAGESIZE);
+}
+
+static size_t mapping_length(size_t bytes)
+{
+    size_t page = page_size();
+    return page + (bytes + page - 1) / page * page;
+}
+
+// large objects start on a page boundary, with their record and header at the end of the page
+// before, so every page of the object goes back to the system when it is freed
+static large_record_t *map_object(size_t bytes)
+{
+    size_t length = mapping_length(bytes);
+    char *mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mapping == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (HUGE_PAGE_THRESHOLD > 0 && bytes >= HUGE_PAGE_THRESHOLD)
+    {
+        madvise(mapping + page_size(), length - page_size(), MADV_HUGEPAGE);
+    }
+#endif
+
+    return (large_record_t *)(mapping + page_size() - sizeof(meta_data_t)) - 1;
+}
+
+static void unmap_object(obj *obj_ptr, size_t bytes)
+{
+    munmap((char *)obj_ptr - page_size(), mapping_length(bytes));
+}
+
+static const refmem_type_t *get_type(meta_data_t *meta_data)
+{
+    return (const refmem_type_t *)atomic_load_explicit(&destructor_table[destructor_slot(meta_data)], memory_order_relaxed);
+}
+
+function1_t get_destructor(obj *obj_ptr)
+{
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+    if (meta_data->flags & FLAG_TYPED)
+    {
+        return NULL;
+    }
+    return (function1_t)atomic_load_explicit(&destructor_table[destructor_slot(meta_data)], memory_order_relaxed);
+}
+
+size_t get_size(obj *obj_ptr)
+{
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+    return meta_data->flags & (FLAG_SLAB | FLAG_ARENA) ? meta_data->size : get_large_record(meta_data)->size;
+}
+
+unsigned short get_counter(obj *obj_ptr)
+{
+    return rc(obj_ptr);
+}
+
+void set_queue_to_null()
+{
+    to_be_freed = (free_queue_t){NULL, 0, 0, 0, 0};
+}
+
+void set_list_to_null()
+{
+    allocated_pointers = NULL;
+}
+
+#ifdef REFMEM_THREAD_SAFE
+// the shared counter holds the count in steps of SHARED_ONE, with the flags in the low bits
+#define SHARED_ONE 4
+#define SHARED_MERGED 0x1 // the owner has added its counter, everyone counts in shared_counter
+#define SHARED_QUEUED 0x2 // waiting in the owner's merge list, only the owner may free it
+#define MAX_THREADS (1 << 16)
+
+typedef struct thread_record thread_record_t;
+
+struct thread_record
+{
+    unsigned short id;
+    _Atomic(obj *) merge_list; // objects whose shared count dropped to zero or below
+    thread_record_t *next_unused;
+};
+
+// records are indexed by the owner field of the objects, and are taken over by new threads
+// once their thread exits, together with the objects it owns
+static thread_record_t *thread_records[MAX_THREADS];
+static size_t thread_record_count = 0;
+static thread_record_t *unused_thread_records = NULL;
+static sync_lock_t thread_records_lock = SYNC_LOCK_INITIALIZER;
+static THREAD_LOCAL thread_record_t *thread_record = NULL;
+
+static pthread_key_t thread_exit_key;
+static pthread_once_t thread_exit_key_once = PTHREAD_ONCE_INIT;
+
+static void merge_queued_objects();
+static void free_queue_destroy();
+static void arena_trim();
+static void pools_destroy();
+
+// frees what the exiting thread still has queued and leaves its slabs and objects to other threads
+static void thread_exit(void *unused)
+{
+    merge_queued_objects();
+    pools_destroy();
+    cleanup();
+    free_queue_destroy();
+    arena_trim();
+    refmem_trace_flush();
+    slab_thread_exit();
+
+    sync_lock(&thread_records_lock);
+    thread_record->next_unused = unused_thread_records;
+    unused_thread_records = thread_record;
+    sync_unlock(&thread_records_lock);
+    thread_record = NULL;
+    thread_registered = false;
+}
+
+static void create_thread_exit_key()
+{
+    pthread_key_create(&thread_exit_key, thread_exit);
+}
+
+static void register_thread()
+{
+    pthread_once(&thread_exit_key_once, create_thread_exit_key);
+    pthread_setspecific(thread_exit_key, &thread_registered);
+
+    sync_lock(&thread_records_lock);
+    if (unused_thread_records != NULL)
+    {
+        thread_record = unused_thread_records;
+        unused_thread_records = thread_record->next_unused;
+    }
+    else
+    {
+        // id 0 is never used, so objects are not owned by a thread that is not registered
+        assert(thread_record_count + 1 < MAX_THREADS);
+        thread_record = calloc(1, sizeof(thread_record_t));
+        thread_record->id = ++thread_record_count;
+        thread_records[thread_record->id] = thread_record;
+    }
+    sync_unlock(&thread_records_lock);
+
+    thread_registered = true;
+}
+
+static unsigned short current_thread_id()
+{
+    if (!thread_registered)
+    {
+        register_thread();
+    }
+    return thread_record->id;
+}
+
+static int shared_count(int shared)
+{
+    return (shared - (shared & (SHARED_ONE - 1))) / SHARED_ONE;
+}
+
+// only true in the owner thread, which is also the only thread that sets SHARED_MERGED
+static bool is_biased_to_this_thread(meta_data_t *meta_data)
+{
+    return meta_data->owner == current_thread_id() &&
+           !(atomic_load_explicit(&meta_data->shared_counter, memory_order_relaxed) & SHARED_MERGED);
+}
+
+// called by the owner, moves the biased count into the shared counter for good
+static int merge_counters(meta_data_t *meta_data)
+{
+    int merged = meta_data->counter * SHARED_ONE + SHARED_MERGED;
+    meta_data->counter = 0;
+    return atomic_fetch_add_explicit(&meta_data->shared_counter, merged, memory_order_acq_rel);
+}
+
+static void push_merge_list(meta_data_t *meta_data)
+{
+    thread_record_t *owner = thread_records[meta_data->owner];
+    obj *head = atomic_load_explicit(&owner->merge_list, memory_order_relaxed);
+
+    do
+    {
+        meta_data->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&owner->merge_list, &head, &meta_data[1],
+                                                    memory_order_release, memory_order_relaxed));
+}
+#else
+static void register_thread()
+{
+    thread_registered = true;
+}
+#endif
+
+static void widen_object_bounds(uintptr_t address)
+{
+    uintptr_t lowest = atomic_load_explicit(&lowest_object, memory_order_relaxed);
+    while (address < lowest &&
+           !atomic_compare_exchange_weak_explicit(&lowest_object, &lowest, address, memory_order_relaxed, memory_order_relaxed));
+
+    uintptr_t highest = atomic_load_explicit(&highest_object, memory_order_relaxed);
+    while (address > highest &&
+           !atomic_compare_exchange_weak_explicit(&highest_object, &highest, address, memory_order_relaxed, memory_order_relaxed));
+}
+
+static size_t object_bytes(obj *obj_ptr)
+{
+    size_t record = get_meta_data(obj_ptr)->flags & (FLAG_SLAB | FLAG_ARENA) ? 0 : sizeof(large_record_t);
+    return record + sizeof(meta_data_t) + get_size(obj_ptr);
+}
+
+static size_t size_class(size_t bytes)
+{
+    size_t class = bytes == 0 ? 0 : 63 - __builtin_clzll(bytes);
+    return class < REFMEM_SIZE_CLASSES ? class : REFMEM_SIZE_CLASSES - 1;
+}
+
+static void count_live_bytes(refmem_stats_t *stats, size_t size, size_t header_bytes, int sign)
+{
+    stats->live_objects += sign;
+    stats->live_bytes += sign * (int64_t)size;
+    stats->header_bytes += sign * (int64_t)header_bytes;
+    stats->size_classes[size_class(size)] += sign;
+    if (stats->live_bytes > stats->peak_live_bytes)
+    {
+        stats->peak_live_bytes = stats->live_bytes;
+    }
+}
+
+static void heap_count_live_object(size_t size, size_t header_bytes, int sign);
+
+// keeps the live figures of refmem_stats up to date, sign is 1 for a new object and -1 for a freed one
+static void count_live_object(obj *obj_ptr, int sign)
+{
+    size_t size = get_size(obj_ptr);
+
+    count_live_bytes(&heap_stats, size, object_bytes(obj_ptr) - size, sign);
+    if (get_meta_data(obj_ptr)->flags & FLAG_PERSISTENT)
+    {
+        heap_count_live_object(size, object_bytes(obj_ptr) - size, sign);
+    }
+}
+
+static obj *take_from_free_queue()
+{
+    obj *obj_ptr = to_be_freed.objects[to_be_freed.front];
+
+    to_be_freed.front = (to_be_freed.front + 1) & (to_be_freed.capacity - 1);
+    to_be_freed.size--;
+    to_be_freed.bytes -= object_bytes(obj_ptr);
+    backlog.freed_objects++;
+
+    return obj_ptr;
+}
+
+static uint64_t now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+#ifdef REFMEM_TRACE
+#define TRACE(kind, obj_ptr) trace_event(kind, obj_ptr)
+#define TRACE_ALLOCATION(obj_ptr, bytes) trace_allocation(obj_ptr, bytes)
+#define TRACE_BUFFER_SIZE 4096
+
+static THREAD_LOCAL trace_event_t trace_buffer[TRACE_BUFFER_SIZE];
+static THREAD_LOCAL size_t trace_buffered = 0;
+static FILE *trace_file = NULL;
+static sync_lock_t trace_lock = SYNC_LOCK_INITIALIZER;
+
+static uint32_t trace_thread_id()
+{
+#ifdef REFMEM_THREAD_SAFE
+    return thread_registered ? thread_record->id : 0;
+#else
+    return 0;
+#endif
+}
+
+// appends the events of this thread to the trace file as one block
+static void trace_flush_buffer()
+{
+    if (trace_buffered == 0)
+    {
+        return;
+    }
+
+    trace_block_t block = {trace_thread_id(), trace_buffered};
+
+    sync_lock(&trace_lock);
+    if (trace_file == NULL)
+    {
+        char *path = getenv("REFMEM_TRACE_FILE");
+        trace_file = fopen(path != NULL ? path : "refmem.trace", "wb");
+        if (trace_file != NULL)
+        {
+            fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_SIZE, trace_file);
+        }
+    }
+    if (trace_file != NULL)
+    {
+        fwrite(&block, sizeof(block), 1, trace_file);
+        fwrite(trace_buffer, sizeof(trace_event_t), trace_buffered, trace_file);
+        fflush(trace_file);
+    }
+    sync_unlock(&trace_lock);
+
+    trace_buffered = 0;
+}
+
+static void trace_event(trace_kind_t kind, obj *obj_ptr)
+{
+    trace_buffer[trace_buffered++] = (trace_event_t){now_ns(), (uintptr_t)obj_ptr | kind};
+    if (trace_buffered == TRACE_BUFFER_SIZE)
+    {
+        trace_flush_buffer();
+    }
+}
+
+// the allocate event and the size record that describes it, always in the same block
+static void trace_allocation(obj *obj_ptr, size_t bytes)
+{
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+    uint64_t attributes = (meta_data->flags & FLAG_ATOMIC ? TRACE_ATTRIBUTE_ATOMIC : 0) |
+                          (meta_data->flags & FLAG_TYPED ? TRACE_ATTRIBUTE_TYPED : 0) |
+                          (meta_data->flags & FLAG_ARENA ? TRACE_ATTRIBUTE_ARENA : 0);
+
+    if (trace_buffered + 2 > TRACE_BUFFER_SIZE)
+    {
+        trace_flush_buffer();
+    }
+    trace_buffer[trace_buffered++] = (trace_event_t){now_ns(), (uintptr_t)obj_ptr | TRACE_ALLOCATE};
+    trace_event_t size = {bytes, (uint64_t)destructor_slot(meta_data) << TRACE_DESTRUCTOR_SHIFT | attributes << TRACE_ATTRIBUTE_SHIFT | TRACE_SIZE};
+    trace_buffer[trace_buffered++] = size;
+    if (trace_buffered == TRACE_BUFFER_SIZE)
+    {
+        trace_flush_buffer();
+    }
+}
+#else
+#define TRACE(kind, obj_ptr) ((void)0)
+#define TRACE_ALLOCATION(obj_ptr, bytes) ((void)0)
+#endif
+
+void refmem_trace_flush()
+{
+#ifdef REFMEM_TRACE
+    trace_flush_buffer();
+#endif
+}
+
+static void record_pause(uint64_t pause_ns)
+{
+    size_t bucket = 0;
+    while (bucket + 1 < REFMEM_PAUSE_BUCKETS && pause_ns >> (bucket + 1) != 0)
+    {
+        bucket++;
+    }
+
+    pause_stats.pauses++;
+    pause_stats.total_ns += pause_ns;
+    pause_stats.max_ns = pause_ns > pause_stats.max_ns ? pause_ns : pause_stats.max_ns;
+    pause_stats.histogram[bucket]++;
+}
+
+static void free_from_queue()
+{
+    bool count_limited = cascade_time_budget == 0 && cascade_byte_budget == 0;
+    if (to_be_freed.size == 0 || freeing || (count_limited && cascade_limit == 0))
+    {
+        return;
+    }
+
+    // the limits grow with the backlog, so a large released structure is freed in a bounded
+    // number of allocations even when allocations are rare. The time budget is a latency
+    // bound and is not stretched.
+    size_t object_limit = cascade_limit;
+    size_t byte_limit = cascade_byte_budget;
+    if (cascade_adaptive)
+    {
+        object_limit += to_be_freed.size / CASCADE_BACKLOG_RATIO;
+        byte_limit += to_be_freed.bytes / CASCADE_BACKLOG_RATIO;
+    }
+
+    uint64_t start = now_ns();
+    size_t freed = 0;
+    size_t bytes_freed = 0;
+    bool within_budget = true;
+
+    freeing = true;
+    do
+    {
+        obj *to_free_ptr = take_from_free_queue();
+        bytes_freed += object_bytes(to_free_ptr);
+        deallocate(to_free_ptr);
+        freed++;
+
+        if (cascade_time_budget > 0)
+        {
+            within_budget = now_ns() - start < cascade_time_budget;
+        }
+        else if (cascade_byte_budget > 0)
+        {
+            within_budget = bytes_freed < byte_limit;
+        }
+        else
+        {
+            within_budget = freed < object_limit;
+        }
+    } while (to_be_freed.size > 0 && within_budget);
+    freeing = false;
+
+    record_pause(now_ns() - start);
+}
+
+// frees down to half of the high-water marks once one of them is crossed
+static void drain_backlog()
+{
+    if (freeing ||
+        ((high_water_objects == 0 || to_be_freed.size <= high_water_objects) &&
+         (high_water_bytes == 0 || to_be_freed.bytes <= high_water_bytes)))
+    {
+        return;
+    }
+
+    uint64_t start = now_ns();
+
+    freeing = true;
+    while (to_be_freed.size > 0 &&
+           ((high_water_objects > 0 && to_be_freed.size > high_water_objects / 2) ||
+            (high_water_bytes > 0 && to_be_freed.bytes > high_water_bytes / 2)))
+    {
+        deallocate(take_from_free_queue());
+    }
+    freeing = false;
+
+    backlog.high_water_drains++;
+    record_pause(now_ns() - start);
+}
+
+// sets up everything in a header but the size
+// the destructor is a function1_t, or the refmem_type_t of a typed object
+static void init_meta_data(meta_data_t *meta_data, unsigned short flags, uintptr_t destructor)
+{
+    meta_data->counter = 0;
+    meta_data->flags = flags;
+    meta_data->destructor = destructor_index(destructor);
+#ifdef REFMEM_THREAD_SAFE
+    meta_data->owner = current_thread_id();
+    atomic_init(&meta_data->shared_counter, 0);
+    meta_data->next = NULL;
+#endif
+}
+
+static void profile_allocation(obj *obj_ptr, size_t bytes);
+static large_record_t *heap_allocate(size_t bytes);
+static void reserve_free_queue_slot();
+
+// the body of allocate, allocate_atomic and allocate_array_typed, so that the object has its
+// final flags before it is traced, and the profiler skips the same frames for all of them
+static inline __attribute__((always_inline)) obj *allocate_object(size_t bytes, uintptr_t destructor, unsigned short flags)
+{
+    if (!thread_registered)
+    {
+        register_thread();
+    }
+
+    void *allocation;
+
+    if (cycle_threshold > 0 && cycle_roots != NULL && pointer_set_size(cycle_roots) >= cycle_threshold && !freeing)
+    {
+        collect_cycles();
+    }
+
+    meta_data_t *meta_data;
+
+    if (persistent_heap == NULL && SMALL_OBJECT_THRESHOLD > 0 && bytes <= SMALL_OBJECT_THRESHOLD)
+    {
+        allocation = slab_allocate(sizeof(meta_data_t) + bytes);
+        flags |= FLAG_SLAB;
+        meta_data = allocation;
+        meta_data->size = bytes;
+    }
+    else
+    {
+        if (persistent_heap != NULL)
+        {
+            allocation = heap_allocate(bytes);
+            flags |= FLAG_PERSISTENT;
+        }
+        else if (LARGE_OBJECT_THRESHOLD > 0 && bytes >= LARGE_OBJECT_THRESHOLD)
+        {
+            allocation = map_object(bytes);
+            flags |= FLAG_MAPPED;
+        }
+        else
+        {
+            allocation = calloc(1, sizeof(large_record_t) + sizeof(meta_data_t) + bytes);
+        }
+        ((large_record_t *)allocation)->size = bytes;
+        meta_data = (meta_data_t *)((large_record_t *)allocation + 1);
+        meta_data->size = 0;
+    }
+
+    init_meta_data(meta_data, flags, destructor);
+
+    // objects of the heap are found through its own bitmap, see heap_object_is_live
+    if (!(flags & (FLAG_SLAB | FLAG_PERSISTENT)))
+    {
+        sync_lock(&allocated_pointers_lock);
+        if (allocated_pointers == NULL)
+        {
+            allocated_pointers = pointer_set_create();
+        }
+        pointer_set_insert(allocated_pointers, &meta_data[1]);
+        sync_unlock(&allocated_pointers_lock);
+    }
+
+    widen_object_bounds((uintptr_t)&meta_data[1]);
+    heap_stats.allocate_calls++;
+    count_live_object(&meta_data[1], 1);
+    reserve_free_queue_slot();
+    TRACE_ALLOCATION(&meta_data[1], bytes);
+
+    if (bytes >= bytes_until_sample)
+    {
+        profile_allocation(&meta_data[1], bytes);
+    }
+    else
+    {
+        bytes_until_sample -= bytes;
+    }
+
+#ifdef REFMEM_THREAD_SAFE
+    merge_queued_objects();
+#endif
+    free_from_queue();
+
+    return (obj *)(&meta_data[1]);
+}
+
+obj *allocate(size_t bytes, function1_t destructor)
+{
+    return allocate_object(bytes, (uintptr_t)destructor, 0);
+}
+
+#define ARENA_CHUNK_SIZE ((size_t)1 << 16)
+#define ARENA_MAX_OBJECT (ARENA_CHUNK_SIZE / 4) // larger objects are allocated on their own
+#define ARENA_WORDS (ARENA_CHUNK_SIZE / sizeof(void *))
+
+typedef struct arena_chunk arena_chunk_t;
+
+// chunks are aligned to their size, so the chunk of an arena object is found by masking its address
+struct arena_chunk
+{
+    _Atomic(refmem_arena_t *) arena; // NULL once the arena is destroyed, only escaped objects are left
+    arena_chunk_t *next;             // the other chunks of the arena
+    size_t used;                     // bytes handed out, this record included
+    _Atomic size_t escaped;          // objects still referenced when the arena was destroyed
+    uint64_t starts[ARENA_WORDS / 64]; // bit i is set if a live object starts at word i
+};
+
+// chunks of all arenas, guarded by allocated_pointers_lock
+static pointer_set_t *arena_chunks = NULL;
+// the chunk of the last destroyed arena is kept for the next one
+static THREAD_LOCAL arena_chunk_t *spare_chunk = NULL;
+
+static arena_chunk_t *arena_chunk_of(void *ptr)
+{
+    return (arena_chunk_t *)((uintptr_t)ptr & ~(uintptr_t)(ARENA_CHUNK_SIZE - 1));
+}
+
+static size_t arena_word(obj *obj_ptr)
+{
+    return ((char *)obj_ptr - (char *)arena_chunk_of(obj_ptr)) / sizeof(void *);
+}
+
+static bool arena_object_is_live(obj *obj_ptr)
+{
+    size_t word = arena_word(obj_ptr);
+    return (arena_chunk_of(obj_ptr)->starts[word / 64] >> (word % 64)) & 1;
+}
+
+static void arena_object_set_live(obj *obj_ptr, bool live)
+{
+    size_t word = arena_word(obj_ptr);
+    uint64_t bit = (uint64_t)1 << (word % 64);
+    uint64_t *starts = &arena_chunk_of(obj_ptr)->starts[word / 64];
+
+    *starts = live ? *starts | bit : *starts & ~bit;
+}
+
+static bool heap_contains(void *ptr);
+static bool heap_object_is_live(obj *obj_ptr);
+
+static bool is_allocated_pointer(obj *obj_ptr)
+{
+    uintptr_t address = (uintptr_t)obj_ptr;
+
+    if (address < atomic_load_explicit(&lowest_object, memory_order_relaxed) ||
+        address > atomic_load_explicit(&highest_object, memory_order_relaxed))
+    {
+        return false;
+    }
+
+    if (heap_contains(obj_ptr))
+    {
+        return heap_object_is_live(obj_ptr);
+    }
+
+    // slab objects are found through the page map and the slab's slot bitmap
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+    if (slab_contains(meta_data))
+    {
+        return slab_slot_in_use(meta_data);
+    }
+
+    sync_lock(&allocated_pointers_lock);
+    bool allocated = allocated_pointers != NULL && pointer_set_contains(allocated_pointers, obj_ptr);
+    bool in_arena = !allocated && arena_chunks != NULL && pointer_set_contains(arena_chunks, arena_chunk_of(obj_ptr));
+    sync_unlock(&allocated_pointers_lock);
+
+    if (in_arena)
+    {
+        return (uintptr_t)obj_ptr % sizeof(void *) == 0 && arena_object_is_live(obj_ptr);
+    }
+    return allocated;
+}
+
+static void object_scanner(obj *obj_ptr, size_t obj_size)
+{
+    for (size_t i = 0; i + sizeof(void*) <= obj_size; i += sizeof(void*))
+    {
+        void **possible_pointer = (void **)((char *)obj_ptr + i);
+        if (is_allocated_pointer(*possible_pointer))
+        {
+            release(*possible_pointer);
+        }
+    }
+}
+
+typedef struct
+{
+    obj **objects;
+    size_t size;
+    size_t capacity;
+} object_stack_t;
+
+static void stack_push(object_stack_t *stack, obj *obj_ptr)
+{
+    if (stack->size == stack->capacity)
+    {
+        stack->capacity = stack->capacity == 0 ? 64 : stack->capacity * 2;
+        stack->objects = realloc(stack->objects, stack->capacity * sizeof(obj *));
+    }
+    stack->objects[stack->size++] = obj_ptr;
+}
+
+static obj *stack_pop(object_stack_t *stack)
+{
+    return stack->size == 0 ? NULL : stack->objects[--stack->size];
+}
+
+typedef void (*child_visitor_t)(obj *child, object_stack_t *stack);
+
+// visits what the descriptor of an object from allocate_typed marks as references, in every
+// element: the pointer words that are not NULL, and the maybe pointer words that hold an object
+static void for_each_typed_child(obj *obj_ptr, child_visitor_t visit, object_stack_t *stack)
+{
+    const refmem_type_t *type = get_type(get_meta_data(obj_ptr));
+    char *end = (char *)obj_ptr + get_size(obj_ptr);
+
+    if (type->size == 0)
+    {
+        return;
+    }
+
+    for (char *element = obj_ptr; element + type->size <= end; element += type->size)
+    {
+        void **words = (void **)element;
+        uint64_t pointers = type->pointers;
+        uint64_t maybe_pointers = type->maybe_pointers & ~pointers;
+
+        for (size_t i = 0; (pointers | maybe_pointers) != 0; i++, pointers >>= 1, maybe_pointers >>= 1)
+        {
+            if ((((pointers & 1) && words[i] != NULL) || ((maybe_pointers & 1) && is_allocated_pointer(words[i])))
+                && !(get_meta_data(words[i])->flags & FLAG_IMMORTAL))
+            {
+                visit(words[i], stack);
+            }
+        }
+    }
+}
+
+static void release_child(obj *child, object_stack_t *stack)
+{
+    release(child);
+}
+
+static void default_destructor(obj *obj_ptr)
+{
+    size_t obj_size = get_size(obj_ptr);
+    object_scanner(obj_ptr, obj_size);
+}
+
+
+static void run_destructor(obj *obj_ptr)
+{
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+
+    if (meta_data->flags & FLAG_ATOMIC)
+    {
+        return;
+    }
+
+    if (meta_data->flags & FLAG_TYPED)
+    {
+        for_each_typed_child(obj_ptr, release_child, NULL);
+    }
+    else if (destructor_slot(meta_data) == 0)
+    {
+       default_destructor(obj_ptr);
+    }
+    else
+    {
+        get_destructor(obj_ptr)(obj_ptr);
+    }
+}
+
+static void arena_release_memory(obj *obj_ptr);
+static void weak_clear(obj *obj_ptr);
+static void profile_free(obj *obj_ptr);
+static void heap_free(obj *obj_ptr);
+
+static void release_memory(obj *obj_ptr)
+{
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+    count_live_object(obj_ptr, -1);
+    TRACE(TRACE_DEALLOCATE, obj_ptr);
+
+    if (meta_data->flags & FLAG_WEAK)
+    {
+        weak_clear(obj_ptr);
+    }
+    if (meta_data->flags & FLAG_SAMPLED)
+    {
+        profile_free(obj_ptr);
+    }
+
+    if ((meta_data->flags & FLAG_BUFFERED) && cycle_roots != NULL)
+    {
+        pointer_set_remove(cycle_roots, obj_ptr);
+    }
+
+    if (meta_data->flags & FLAG_ARENA)
+    {
+        arena_release_memory(obj_ptr);
+    }
+    else if (meta_data->flags & FLAG_SLAB)
+    {
+        slab_free(meta_data);
+    }
+    else if (meta_data->flags & FLAG_PERSISTENT)
+    {
+        heap_free(obj_ptr);
+    }
+    else
+    {
+        sync_lock(&allocated_pointers_lock);
+        pointer_set_remove(allocated_pointers, obj_ptr);
+        sync_unlock(&allocated_pointers_lock);
+
+        if (meta_data->flags & FLAG_MAPPED)
+        {
+            unmap_object(obj_ptr, get_size(obj_ptr));
+        }
+        else
+        {
+            free(get_large_record(meta_data));
+        }
+    }
+}
+
+void deallocate(obj *obj_ptr)
+{
+    if (get_meta_data(obj_ptr)->flags & FLAG_IMMORTAL)
+    {
+        return;
+    }
+    heap_stats.deallocate_calls++;
+    run_destructor(obj_ptr);
+    release_memory(obj_ptr);
+}
+
+static unsigned short color(meta_data_t *meta_data)
+{
+    return meta_data->flags & COLOR_MASK;
+}
+
+static void set_color(meta_data_t *meta_data, unsigned short color)
+{
+    meta_data->flags = (meta_data->flags & ~COLOR_MASK) | color;
+}
+
+// visits the references the collector knows an object holds: the words its default destructor
+// or its type descriptor would release. Objects with a destructor of their own are opaque, so
+// whatever they point to looks referenced from outside and cycles through them are never collected.
+static void for_each_child(obj *obj_ptr, child_visitor_t visit, object_stack_t *stack)
+{
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+
+    if (meta_data->flags & FLAG_TYPED)
+    {
+        for_each_typed_child(obj_ptr, visit, stack);
+        return;
+    }
+
+    if (destructor_slot(meta_data) != 0 || (meta_data->flags & FLAG_ATOMIC))
+    {
+        return;
+    }
+
+    size_t size = get_size(obj_ptr);
+    for (size_t i = 0; i + sizeof(void*) <= size; i += sizeof(void*))
+    {
+        void *possible_pointer = *(void **)((char *)obj_ptr + i);
+        if (is_allocated_pointer(possible_pointer) && !(get_meta_data(possible_pointer)->flags & FLAG_IMMORTAL))
+        {
+            visit(possible_pointer, stack);
+        }
+    }
+}
+
+// counters are unsigned, a child that is not retained wraps around on the trial decrement
+// and so looks referenced from outside, which keeps it and its cycle alive
+static void mark_gray_child(obj *child, object_stack_t *stack)
+{
+    meta_data_t *meta_data = get_meta_data(child);
+
+    meta_data->counter--;
+    if (color(meta_data) != COLOR_GRAY)
+    {
+        set_color(meta_data, COLOR_GRAY);
+        stack_push(stack, child);
+    }
+}
+
+static void scan_black_child(obj *child, object_stack_t *stack)
+{
+    meta_data_t *meta_data = get_meta_data(child);
+
+    meta_data->counter++;
+    if (color(meta_data) != COLOR_BLACK)
+    {
+        set_color(meta_data, COLOR_BLACK);
+        stack_push(stack, child);
+    }
+}
+
+static void push_child(obj *child, object_stack_t *stack)
+{
+    stack_push(stack, child);
+}
+
+static void restore_child(obj *child, object_stack_t *stack)
+{
+    get_meta_data(child)->counter++;
+}
+
+// removes the references inside the subgraph reachable from a root from its counters
+static void mark_gray(obj *root, object_stack_t *stack)
+{
+    if (color(get_meta_data(root)) == COLOR_GRAY)
+    {
+        return;
+    }
+
+    set_color(get_meta_data(root), COLOR_GRAY);
+    stack_push(stack, root);
+
+    obj *obj_ptr;
+    while ((obj_ptr = stack_pop(stack)) != NULL)
+    {
+        for_each_child(obj_ptr, mark_gray_child, stack);
+    }
+}
+
+// gives back the references of everything reachable from an object that is referenced from outside
+static void scan_black(obj *live, object_stack_t *stack)
+{
+    set_color(get_meta_data(live), COLOR_BLACK);
+    stack_push(stack, live);
+
+    obj *obj_ptr;
+    while ((obj_ptr = stack_pop(stack)) != NULL)
+    {
+        for_each_child(obj_ptr, scan_black_child, stack);
+    }
+}
+
+static void scan(obj *root, object_stack_t *stack, object_stack_t *black_stack)
+{
+    stack_push(stack, root);
+
+    obj *obj_ptr;
+    while ((obj_ptr = stack_pop(stack)) != NULL)
+    {
+        meta_data_t *meta_data = get_meta_data(obj_ptr);
+
+        if (color(meta_data) != COLOR_GRAY)
+        {
+            continue;
+        }
+
+        // the reference of an autorelease pool is one from outside
+        if (meta_data->counter > 0 || (meta_data->flags & FLAG_AUTORELEASED))
+        {
+            scan_black(obj_ptr, black_stack);
+        }
+        else
+        {
+            set_color(meta_data, COLOR_WHITE);
+            for_each_child(obj_ptr, push_child, stack);
+        }
+    }
+}
+
+static void collect_white(obj *root, object_stack_t *stack, object_stack_t *garbage)
+{
+    stack_push(stack, root);
+
+    obj *obj_ptr;
+    while ((obj_ptr = stack_pop(stack)) != NULL)
+    {
+        meta_data_t *meta_data = get_meta_data(obj_ptr);
+
+        if (color(meta_data) == COLOR_WHITE)
+        {
+            set_color(meta_data, COLOR_BLACK);
+            stack_push(garbage, obj_ptr);
+            for_each_child(obj_ptr, push_child, stack);
+        }
+    }
+}
+
+// only the single threaded release buffers roots, the collector does not run alongside other threads
+#ifndef REFMEM_THREAD_SAFE
+static void possible_root(obj *obj_ptr)
+{
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+
+    // objects the collector can not look into, or without room for a pointer, can not close a cycle
+    if (get_size(obj_ptr) < sizeof(void *) || (meta_data->flags & (FLAG_ATOMIC | FLAG_ARENA)))
+    {
+        return;
+    }
+    if (meta_data->flags & FLAG_TYPED ?
+        (get_type(meta_data)->pointers | get_type(meta_data)->maybe_pointers) == 0 : destructor_slot(meta_data) != 0)
+    {
+        return;
+    }
+
+    set_color(meta_data, COLOR_PURPLE);
+    if (!(meta_data->flags & FLAG_BUFFERED))
+    {
+        meta_data->flags |= FLAG_BUFFERED;
+        if (cycle_roots == NULL)
+        {
+            cycle_roots = pointer_set_create();
+        }
+        pointer_set_insert(cycle_roots, obj_ptr);
+    }
+}
+#endif
+
+size_t collect_cycles()
+{
+    if (SYNC_THREAD_SAFE || collecting || cycle_roots == NULL)
+    {
+        return 0;
+    }
+
+    collecting = true;
+
+    size_t root_count = pointer_set_size(cycle_roots);
+    obj **roots = calloc(root_count, sizeof(obj *));
+    pointer_set_copy_to(cycle_roots, roots);
+    pointer_set_destroy(cycle_roots);
+    cycle_roots = NULL;
+
+    object_stack_t stack = {NULL, 0, 0};
+    object_stack_t black_stack = {NULL, 0, 0};
+    object_stack_t garbage = {NULL, 0, 0};
+
+    // roots whose count has reached zero are already waiting in the free queue, and roots
+    // that an earlier root has turned gray are scanned from that root
+    size_t kept = 0;
+    for (size_t i = 0; i < root_count; i++)
+    {
+        meta_data_t *meta_data = get_meta_data(roots[i]);
+        meta_data->flags &= ~FLAG_BUFFERED;
+
+        if (color(meta_data) == COLOR_PURPLE && meta_data->counter > 0)
+        {
+            mark_gray(roots[i], &stack);
+            roots[kept++] = roots[i];
+        }
+        else if (color(meta_data) == COLOR_PURPLE)
+        {
+            set_color(meta_data, COLOR_BLACK);
+        }
+    }
+
+    for (size_t i = 0; i < kept; i++)
+    {
+        scan(roots[i], &stack, &black_stack);
+    }
+    for (size_t i = 0; i < kept; i++)
+    {
+        collect_white(roots[i], &stack, &garbage);
+    }
+
+    // the garbage is freed the way reference counting would free it: the references between
+    // garbage objects are counted again, an extra reference keeps every garbage object alive
+    // while the destructors release what they hold, then the memory is returned. Each object
+    // counts as a deallocation, as in deallocate, which frees them one at a time.
+    for (size_t i = 0; i < garbage.size; i++)
+    {
+        for_each_child(garbage.objects[i], restore_child, NULL);
+    }
+    for (size_t i = 0; i < garbage.size; i++)
+    {
+        get_meta_data(garbage.objects[i])->counter++;
+    }
+    for (size_t i = 0; i < garbage.size; i++)
+    {
+        run_destructor(garbage.objects[i]);
+    }
+    for (size_t i = 0; i < garbage.size; i++)
+    {
+        heap_stats.deallocate_calls++;
+        release_memory(garbage.objects[i]);
+    }
+
+    size_t collected = garbage.size;
+    free(roots);
+    free(stack.objects);
+    free(black_stack.objects);
+    free(garbage.objects);
+    collecting = false;
+
+    return collected;
+}
+
+void set_cycle_threshold(size_t roots)
+{
+    cycle_threshold = roots;
+}
+
+size_t get_cycle_threshold()
+{
+    return cycle_threshold;
+}
+
+void refmem_make_immortal(obj *obj_ptr)
+{
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+
+    // the collector never looks at it again
+    if ((meta_data->flags & FLAG_BUFFERED) && cycle_roots != NULL)
+    {
+        pointer_set_remove(cycle_roots, obj_ptr);
+    }
+    meta_data->flags = (meta_data->flags & ~(FLAG_BUFFERED | COLOR_MASK)) | COLOR_BLACK | FLAG_IMMORTAL;
+}
+
+void retain(obj *obj_ptr)
+{
+   meta_data_t *meta_data = get_meta_data(obj_ptr);
+   // immortal objects are shared without writing to them
+   if (meta_data->flags & FLAG_IMMORTAL)
+   {
+       return;
+   }
+   heap_stats.retain_calls++;
+   TRACE(TRACE_RETAIN, obj_ptr);
+
+#ifdef REFMEM_THREAD_SAFE
+    if (!is_biased_to_this_thread(meta_data))
+    {
+        atomic_fetch_add_explicit(&meta_data->shared_counter, SHARED_ONE, memory_order_relaxed);
+        return;
+    }
+#endif
+
+    // a count that would wrap around could later reach zero while the object is still referenced
+    if (meta_data->counter == USHRT_MAX)
+    {
+        refmem_make_immortal(obj_ptr);
+    }
+    else
+    {
+        meta_data->counter++;
+    }
+}
+
+// makes room for at least the given number of objects, false if there is no memory for it
+static bool grow_free_queue(size_t needed)
+{
+    size_t capacity = to_be_freed.capacity == 0 ? FREE_QUEUE_INITIAL_CAPACITY : to_be_freed.capacity;
+    while (capacity < needed)
+    {
+        capacity *= 2;
+    }
+    obj **objects = malloc(capacity * sizeof(obj *));
+    if (objects == NULL)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < to_be_freed.size; i++)
+    {
+        objects[i] = to_be_freed.objects[(to_be_freed.front + i) & (to_be_freed.capacity - 1)];
+    }
+    free(to_be_freed.objects);
+
+    to_be_freed.objects = objects;
+    to_be_freed.capacity = capacity;
+    to_be_freed.front = 0;
+    return true;
+}
+
+// every live object of the thread may be queued at the same time, called once an object is counted
+static void reserve_free_queue_slot()
+{
+    if (heap_stats.live_objects > 0 && (size_t)heap_stats.live_objects > to_be_freed.capacity)
+    {
+        grow_free_queue(heap_stats.live_objects);
+    }
+}
+
+static void free_queue_destroy()
+{
+    assert(to_be_freed.size == 0);
+    free(to_be_freed.objects);
+    set_queue_to_null();
+}
+
+static bool arena_keeps(obj *obj_ptr);
+
+static void add_to_free_queue(obj *obj_to_free)
+{
+    if ((get_meta_data(obj_to_free)->flags & FLAG_ARENA) && arena_keeps(obj_to_free))
+    {
+        return;
+    }
+    // the pool frees it when it is popped
+    if (get_meta_data(obj_to_free)->flags & FLAG_AUTORELEASED)
+    {
+        return;
+    }
+    // only objects of other threads, or a ring that could not grow, leave no slot free
+    if (to_be_freed.size == to_be_freed.capacity && !grow_free_queue(to_be_freed.size + 1))
+    {
+        deallocate(obj_to_free);
+        return;
+    }
+    TRACE(TRACE_ENQUEUE, obj_to_free);
+
+    to_be_freed.objects[(to_be_freed.front + to_be_freed.size) & (to_be_freed.capacity - 1)] = obj_to_free;
+    to_be_freed.size++;
+    to_be_freed.bytes += object_bytes(obj_to_free);
+
+    backlog.peak_objects = to_be_freed.size > backlog.peak_objects ? to_be_freed.size : backlog.peak_objects;
+    backlog.peak_bytes = to_be_freed.bytes > backlog.peak_bytes ? to_be_freed.bytes : backlog.peak_bytes;
+
+    drain_backlog();
+}
+
+#ifdef REFMEM_THREAD_SAFE
+static void shared_release(obj *obj_ptr)
+{
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+    int shared = atomic_load_explicit(&meta_data->shared_counter, memory_order_relaxed);
+    int released;
+
+    // the count and the queued flag change together, so only the release that takes the
+    // count to zero with the flag clear hands the object on, and only once
+    do
+    {
+        if ((shared & SHARED_MERGED) && shared_count(shared) <= 0)
+        {
+            printf("Warning! More releases than retains\n");
+            return;
+        }
+        released = shared - SHARED_ONE;
+        // the owner may still hold references, so only the owner can tell whether the object is dead
+        if (!(shared & SHARED_MERGED) && shared_count(released) <= 0)
+        {
+            released |= SHARED_QUEUED;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&meta_data->shared_counter, &shared, released,
+                                                    memory_order_acq_rel, memory_order_relaxed));
+
+    if (shared & SHARED_QUEUED)
+    {
+        // already in the owner's merge list, the owner frees it from there
+        return;
+    }
+    if (released & SHARED_QUEUED)
+    {
+        push_merge_list(meta_data);
+    }
+    else if (shared_count(released) == 0)
+    {
+        add_to_free_queue(obj_ptr);
+    }
+}
+
+// frees the objects that other threads have handed back to this thread, if they are dead
+static void merge_queued_objects()
+{
+    if (thread_record == NULL ||
+        atomic_load_explicit(&thread_record->merge_list, memory_order_relaxed) == NULL)
+    {
+        return;
+    }
+
+    obj *obj_ptr = atomic_exchange_explicit(&thread_record->merge_list, NULL, memory_order_acquire);
+
+    while (obj_ptr != NULL)
+    {
+        meta_data_t *meta_data = get_meta_data(obj_ptr);
+        obj *next = meta_data->next;
+
+        if (!(atomic_load_explicit(&meta_data->shared_counter, memory_order_relaxed) & SHARED_MERGED))
+        {
+            merge_counters(meta_data);
+        }
+
+        // once the flag is cleared other threads may free the object themselves
+        int shared = atomic_fetch_and_explicit(&meta_data->shared_counter, ~SHARED_QUEUED, memory_order_acq_rel);
+        if (shared_count(shared) == 0)
+        {
+            add_to_free_queue(obj_ptr);
+        }
+        else if (shared_count(shared) < 0)
+        {
+            printf("Warning! More releases than retains\n");
+        }
+
+        obj_ptr = next;
+    }
+}
+#endif
+
+void release(obj *obj_ptr)
+{
+    if (obj_ptr != NULL)
+    {
+        meta_data_t *meta_data = get_meta_data(obj_ptr);
+        if (meta_data->flags & FLAG_IMMORTAL)
+        {
+            return;
+        }
+        heap_stats.release_calls++;
+        TRACE(TRACE_RELEASE, obj_ptr);
+
+#ifdef REFMEM_THREAD_SAFE
+        if (!is_biased_to_this_thread(meta_data))
+        {
+            shared_release(obj_ptr);
+            return;
+        }
+        if (meta_data->counter == 0)
+        {
+            // no biased references are left, the release must be taken from the shared count
+            merge_counters(meta_data);
+            shared_release(obj_ptr);
+            return;
+        }
+#endif
+
+        if (meta_data->counter <= 0)
+        {
+            printf("Warning! More releases than retains\n");
+            assert(meta_data->counter == 0);
+        }
+        else
+        {
+            meta_data->counter--;
+
+#ifdef REFMEM_THREAD_SAFE
+            if (meta_data->counter == 0)
+            {
+                // a queued object is merged and freed by merge_queued_objects, never here
+                if (atomic_load_explicit(&meta_data->shared_counter, memory_order_acquire) & SHARED_QUEUED)
+                {
+                    return;
+                }
+                // another thread can still queue it until the merge, which reads the flag again
+                int shared = merge_counters(meta_data);
+                if (shared_count(shared) == 0 && !(shared & SHARED_QUEUED))
+                {
+                    add_to_free_queue(obj_ptr);
+                }
+            }
+#else
+            if ((meta_data->counter) == 0)
+            {
+                add_to_free_queue(obj_ptr);
+            }
+            else
+            {
+                possible_root(obj_ptr);
+            }
+#endif
+        }
+    }
+}
+
+unsigned short rc(obj *obj_ptr)
+{
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+    if (meta_data->flags & FLAG_IMMORTAL)
+    {
+        return USHRT_MAX;
+    }
+#ifdef REFMEM_THREAD_SAFE
+    return meta_data->counter + shared_count(atomic_load_explicit(&meta_data->shared_counter, memory_order_relaxed));
+#else
+    return meta_data->counter;
+#endif
+}
+
+obj *allocate_array(size_t elements, size_t elem_size, function1_t destructor)
+{
+    return allocate(elements * elem_size, destructor);
+}
+
+obj *allocate_typed(const refmem_type_t *type)
+{
+    return allocate_array_typed(1, type);
+}
+
+obj *allocate_array_typed(size_t elements, const refmem_type_t *type)
+{
+    return allocate_object(elements * type->size, (uintptr_t)type, FLAG_TYPED);
+}
+
+obj *allocate_atomic(size_t bytes)
+{
+    return allocate_object(bytes, 0, FLAG_ATOMIC);
+}
+
+obj *allocate_array_atomic(size_t elements, size_t elem_size)
+{
+    return allocate_atomic(elements * elem_size);
+}
+
+char *duplicate_string(char *str)
+{
+    char *duplicate = allocate_array_atomic(strlen(str) + 1, sizeof(char));
+    strcpy(duplicate, str);
+    retain(duplicate);
+    return duplicate;
+}
+
+// the objects of all pools of a thread, innermost pool last, and where each pool starts
+static THREAD_LOCAL object_stack_t autoreleased = {NULL, 0, 0};
+static THREAD_LOCAL size_t *pool_marks = NULL;
+static THREAD_LOCAL size_t pool_depth = 0;
+static THREAD_LOCAL size_t pool_capacity = 0;
+
+void refmem_pool_push()
+{
+    if (pool_depth == pool_capacity)
+    {
+        pool_capacity = pool_capacity == 0 ? 16 : pool_capacity * 2;
+        pool_marks = realloc(pool_marks, pool_capacity * sizeof(size_t));
+    }
+    pool_marks[pool_depth++] = autoreleased.size;
+}
+
+obj *autorelease(obj *obj_ptr)
+{
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+
+    if (!(meta_data->flags & FLAG_AUTORELEASED))
+    {
+        meta_data->flags |= FLAG_AUTORELEASED;
+        stack_push(&autoreleased, obj_ptr);
+    }
+    return obj_ptr;
+}
+
+// hands the objects autoreleased since a mark back to reference counting, in one pass
+static void pool_drain(size_t mark)
+{
+    while (autoreleased.size > mark)
+    {
+        obj *obj_ptr = autoreleased.objects[--autoreleased.size];
+        get_meta_data(obj_ptr)->flags &= ~FLAG_AUTORELEASED;
+        if (rc(obj_ptr) == 0)
+        {
+            add_to_free_queue(obj_ptr);
+        }
+    }
+}
+
+void refmem_pool_pop()
+{
+    assert(pool_depth > 0);
+    pool_drain(pool_marks[--pool_depth]);
+}
+
+// forgets the pools without releasing what they hold
+static void pools_free()
+{
+    free(autoreleased.objects);
+    autoreleased = (object_stack_t){NULL, 0, 0};
+    free(pool_marks);
+    pool_marks = NULL;
+    pool_depth = 0;
+    pool_capacity = 0;
+}
+
+static void pools_destroy()
+{
+    pool_drain(0);
+    pools_free();
+}
+
+struct refmem_arena
+{
+    arena_chunk_t *chunks;  // the chunk allocated from first
+    object_stack_t large;   // objects too large for a chunk, the arena holds a reference to each
+    object_stack_t dying;   // objects released to zero while the arena is destroyed
+    bool destroying;
+    refmem_arena_t *prev;   // neighbours in the list of arenas not destroyed yet
+    refmem_arena_t *next;
+};
+
+// arenas not destroyed yet, guarded by allocated_pointers_lock, so refmem_teardown can free them
+static refmem_arena_t *live_arenas = NULL;
+
+static arena_chunk_t *arena_chunk_create(refmem_arena_t *arena)
+{
+    arena_chunk_t *chunk = spare_chunk;
+
+    if (chunk != NULL)
+    {
+        spare_chunk = NULL;
+    }
+    else
+    {
+        chunk = aligned_alloc(ARENA_CHUNK_SIZE, ARENA_CHUNK_SIZE);
+        memset(chunk->starts, 0, sizeof(chunk->starts));
+
+        sync_lock(&allocated_pointers_lock);
+        if (arena_chunks == NULL)
+        {
+            arena_chunks = pointer_set_create();
+        }
+        pointer_set_insert(arena_chunks, chunk);
+        sync_unlock(&allocated_pointers_lock);
+
+        widen_object_bounds((uintptr_t)chunk);
+        widen_object_bounds((uintptr_t)chunk + ARENA_CHUNK_SIZE - 1);
+    }
+
+    atomic_store_explicit(&chunk->arena, arena, memory_order_relaxed);
+    atomic_store_explicit(&chunk->escaped, 0, memory_order_relaxed);
+    chunk->used = (sizeof(arena_chunk_t) + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    return chunk;
+}
+
+static void arena_chunk_free(arena_chunk_t *chunk)
+{
+    sync_lock(&allocated_pointers_lock);
+    pointer_set_remove(arena_chunks, chunk);
+    if (pointer_set_size(arena_chunks) == 0)
+    {
+        pointer_set_destroy(arena_chunks);
+        arena_chunks = NULL;
+    }
+    sync_unlock(&allocated_pointers_lock);
+
+    free(chunk);
+}
+
+// called once a chunk has no live objects left, its start bits are all clear
+static void arena_chunk_destroy(arena_chunk_t *chunk)
+{
+    if (spare_chunk == NULL)
+    {
+        spare_chunk = chunk;
+    }
+    else
+    {
+        arena_chunk_free(chunk);
+    }
+}
+
+static void arena_trim()
+{
+    if (spare_chunk != NULL)
+    {
+        arena_chunk_free(spare_chunk);
+        spare_chunk = NULL;
+    }
+}
+
+static size_t arena_object_bytes(size_t bytes)
+{
+    return (sizeof(meta_data_t) + bytes + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+}
+
+// an object of a living arena that reaches zero is left to arena_destroy
+static bool arena_keeps(obj *obj_ptr)
+{
+    refmem_arena_t *arena = atomic_load_explicit(&arena_chunk_of(obj_ptr)->arena, memory_order_relaxed);
+
+    if (arena == NULL)
+    {
+        return false;
+    }
+    if (arena->destroying)
+    {
+        stack_push(&arena->dying, obj_ptr);
+    }
+    return true;
+}
+
+static void arena_release_memory(obj *obj_ptr)
+{
+    arena_chunk_t *chunk = arena_chunk_of(obj_ptr);
+
+    arena_object_set_live(obj_ptr, false);
+    if (atomic_load_explicit(&chunk->arena, memory_order_relaxed) == NULL &&
+        atomic_fetch_sub_explicit(&chunk->escaped, 1, memory_order_acq_rel) == 1)
+    {
+        arena_chunk_destroy(chunk);
+    }
+}
+
+refmem_arena_t *arena_create()
+{
+    refmem_arena_t *arena = calloc(1, sizeof(refmem_arena_t));
+
+    sync_lock(&allocated_pointers_lock);
+    arena->next = live_arenas;
+    if (live_arenas != NULL)
+    {
+        live_arenas->prev = arena;
+    }
+    live_arenas = arena;
+    sync_unlock(&allocated_pointers_lock);
+
+    return arena;
+}
+
+static obj *arena_allocate_object(refmem_arena_t *arena, size_t bytes, uintptr_t destructor, unsigned short flags)
+{
+    if (bytes > ARENA_MAX_OBJECT)
+    {
+        obj *obj_ptr = allocate_object(bytes, destructor, flags);
+        retain(obj_ptr);
+        stack_push(&arena->large, obj_ptr);
+        return obj_ptr;
+    }
+
+    size_t needed = arena_object_bytes(bytes);
+    arena_chunk_t *chunk = arena->chunks;
+    if (chunk == NULL || chunk->used + needed > ARENA_CHUNK_SIZE)
+    {
+        chunk = arena_chunk_create(arena);
+    }
+
+    meta_data_t *meta_data = (meta_data_t *)((char *)chunk + chunk->used);
+    chunk->used += needed;
+    memset(meta_data, 0, needed);
+    meta_data->size = bytes;
+    init_meta_data(meta_data, FLAG_ARENA | flags, destructor);
+
+    arena_object_set_live(&meta_data[1], true);
+    heap_stats.allocate_calls++;
+    count_live_object(&meta_data[1], 1);
+    reserve_free_queue_slot();
+    TRACE_ALLOCATION(&meta_data[1], bytes);
+    return &meta_data[1];
+}
+
+obj *arena_allocate(refmem_arena_t *arena, size_t bytes, function1_t destructor)
+{
+    return arena_allocate_object(arena, bytes, (uintptr_t)destructor, 0);
+}
+
+obj *arena_allocate_atomic(refmem_arena_t *arena, size_t bytes)
+{
+    return arena_allocate_object(arena, bytes, 0, FLAG_ATOMIC);
+}
+
+void arena_destroy(refmem_arena_t *arena)
+{
+    obj *obj_ptr;
+    arena->destroying = true;
+
+    sync_lock(&allocated_pointers_lock);
+    if (arena->prev != NULL)
+    {
+        arena->prev->next = arena->next;
+    }
+    else
+    {
+        live_arenas = arena->next;
+    }
+    if (arena->next != NULL)
+    {
+        arena->next->prev = arena->prev;
+    }
+    sync_unlock(&allocated_pointers_lock);
+
+    // large objects are only held by the arena, they are freed like any other object
+    while ((obj_ptr = stack_pop(&arena->large)) != NULL)
+    {
+        release(obj_ptr);
+    }
+
+    // objects nobody refers to die with the arena, and their destructors may release more of them
+    for (arena_chunk_t *chunk = arena->chunks; chunk != NULL; chunk = chunk->next)
+    {
+        size_t offset = (sizeof(arena_chunk_t) + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+        while (offset < chunk->used)
+        {
+            meta_data_t *meta_data = (meta_data_t *)((char *)chunk + offset);
+            if (arena_object_is_live(&meta_data[1]) && rc(&meta_data[1]) == 0)
+            {
+                stack_push(&arena->dying, &meta_data[1]);
+            }
+            offset += arena_object_bytes(meta_data->size);
+        }
+    }
+
+    while ((obj_ptr = stack_pop(&arena->dying)) != NULL)
+    {
+        if (arena_object_is_live(obj_ptr) && rc(obj_ptr) == 0)
+        {
+            arena_object_set_live(obj_ptr, false);
+            count_live_object(obj_ptr, -1);
+            TRACE(TRACE_DEALLOCATE, obj_ptr);
+            run_destructor(obj_ptr);
+            if (get_meta_data(obj_ptr)->flags & FLAG_WEAK)
+            {
+                weak_clear(obj_ptr);
+            }
+        }
+    }
+
+    // what is still referenced escapes, and its chunk stays until the last such object is freed
+    arena_chunk_t *chunk = arena->chunks;
+    while (chunk != NULL)
+    {
+        arena_chunk_t *next = chunk->next;
+        size_t escaped = 0;
+
+        for (size_t i = 0; i < ARENA_WORDS / 64; i++)
+        {
+            for (uint64_t bits = chunk->starts[i]; bits != 0; bits &= bits - 1)
+            {
+                escaped++;
+            }
+        }
+
+        atomic_store_explicit(&chunk->escaped, escaped, memory_order_relaxed);
+        atomic_store_explicit(&chunk->arena, NULL, memory_order_release);
+        if (escaped == 0)
+        {
+            arena_chunk_destroy(chunk);
+        }
+        chunk = next;
+    }
+
+    free(arena->large.objects);
+    free(arena->dying.objects);
+    free(arena);
+}
+
+static void weak_slot_free(unsigned short slot)
+{
+    weak_table[slot].ref = NULL;
+    weak_table[slot].next_free = weak_free;
+    weak_free = slot;
+    weak_free_slots++;
+}
+
+// the target dies first: its weak reference forgets it
+static void weak_clear(obj *obj_ptr)
+{
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+
+    sync_lock(&weak_table_lock);
+    weak_slot_t *slot = &weak_table[meta_data->destructor];
+    slot->ref->target = NULL;
+    meta_data->destructor = slot->destructor;
+    meta_data->flags &= ~FLAG_WEAK;
+    weak_slot_free(slot - weak_table);
+    sync_unlock(&weak_table_lock);
+}
+
+// the weak reference dies first: its target gets its destructor back
+static void weak_ref_destructor(obj *obj_ptr)
+{
+    weak_ref_t *ref = obj_ptr;
+
+    sync_lock(&weak_table_lock);
+    if (ref->target != NULL)
+    {
+        meta_data_t *meta_data = get_meta_data(ref->target);
+        unsigned short slot = meta_data->destructor;
+        meta_data->destructor = weak_table[slot].destructor;
+        meta_data->flags &= ~FLAG_WEAK;
+        weak_slot_free(slot);
+    }
+    sync_unlock(&weak_table_lock);
+}
+
+weak_ref_t *weak_create(obj *obj_ptr)
+{
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+    weak_ref_t *ref = NULL;
+
+    sync_lock(&weak_table_lock);
+    if (meta_data->flags & FLAG_WEAK)
+    {
+        ref = weak_table[meta_data->destructor].ref;
+        retain(ref);
+    }
+    sync_unlock(&weak_table_lock);
+    if (ref != NULL)
+    {
+        return ref;
+    }
+
+    // allocated before the lock is taken, the objects it frees may clear weak references
+    ref = allocate(sizeof(weak_ref_t), weak_ref_destructor);
+    ref->target = obj_ptr;
+    retain(ref);
+
+    sync_lock(&weak_table_lock);
+    unsigned short slot;
+    if (weak_free_slots > 0)
+    {
+        slot = weak_free;
+        weak_free = weak_table[slot].next_free;
+        weak_free_slots--;
+    }
+    else if (weak_table_used < WEAK_TABLE_SIZE)
+    {
+        slot = weak_table_used++;
+    }
+    else
+    {
+        fprintf(stderr, "refmem: more than %zu weakly referenced objects\n", WEAK_TABLE_SIZE);
+        abort();
+    }
+    weak_table[slot].ref = ref;
+    weak_table[slot].destructor = meta_data->destructor;
+    meta_data->destructor = slot;
+    meta_data->flags |= FLAG_WEAK;
+    sync_unlock(&weak_table_lock);
+
+    return ref;
+}
+
+// retains an object unless it is dead, an object without references is waiting to be freed
+// and must not come back
+static bool try_retain(obj *obj_ptr)
+{
+#ifdef REFMEM_THREAD_SAFE
+    meta_data_t *meta_data = get_meta_data(obj_ptr);
+    if (meta_data->flags & FLAG_IMMORTAL)
+    {
+        return true;
+    }
+
+    bool biased = is_biased_to_this_thread(meta_data);
+    if (biased && meta_data->counter > 0)
+    {
+        retain(obj_ptr);
+        return true;
+    }
+
+    // the count is whole once merged, or when the owner has no references of its own. Otherwise
+    // another thread may hold the rest, and a queued object may be dead, which only the owner knows.
+    // The check and the increment are one step, so a release to zero either comes before and is
+    // seen, or after and leaves the object alone.
+    int shared = atomic_load_explicit(&meta_data->shared_counter, memory_order_relaxed);
+    do
+    {
+        bool whole = biased || (shared & SHARED_MERGED);
+        if ((whole && shared_count(shared) <= 0) || (!whole && (shared & SHARED_QUEUED)))
+        {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&meta_data->shared_counter, &shared, shared + SHARED_ONE,
+                                                    memory_order_acq_rel, memory_order_relaxed));
+
+    heap_stats.retain_calls++;
+    TRACE(TRACE_RETAIN, obj_ptr);
+    return true;
+#else
+    if (rc(obj_ptr) == 0)
+    {
+        return false;
+    }
+    retain(obj_ptr);
+    return true;
+#endif
+}
+
+obj *weak_lock(weak_ref_t *ref)
+{
+    sync_lock(&weak_table_lock);
+    obj *target = ref->target;
+    if (target != NULL && !try_retain(target))
+    {
+        target = NULL;
+    }
+    sync_unlock(&weak_table_lock);
+
+    return target;
+}
+
+// the heap of refmem_heap_open is a file mapped at the address it was created at. It starts with
+// a heap_header, followed by a bitmap with a bit for every granule where a live object starts,
+// and the blocks of the objects. A block holds the record, header and payload of one object,
+// rounded up to a granule, or to a power of two for large blocks. Free blocks are kept in a list
+// per block size, linked through their first word, and the rest is handed out from the top.
+#define HEAP_MAGIC "RMHEAP01"
+#define HEAP_MAGIC_SIZE 8
+#define HEAP_BASE ((uintptr_t)0x200000000000) // far from where the system puts the program and its mappings
+#define HEAP_DEFAULT_CAPACITY ((size_t)1 << 30)
+#define HEAP_GRANULE 16
+#define HEAP_SMALL_BLOCK 4096 // the largest block rounded to a granule
+#define HEAP_CLASSES (HEAP_SMALL_BLOCK / HEAP_GRANULE + 64)
+
+#ifdef MAP_FIXED_NOREPLACE
+#define HEAP_MAP_FIXED MAP_FIXED_NOREPLACE
+#else
+#define HEAP_MAP_FIXED 0 // the address is only a hint, the mapping is checked instead
+#endif
+
+_Static_assert(SYNC_THREAD_SAFE || (sizeof(large_record_t) + sizeof(meta_data_t)) % HEAP_GRANULE == 0,
+               "the payload of a heap object must start on a granule");
+
+struct heap_header
+{
+    char magic[HEAP_MAGIC_SIZE];
+    uint64_t base;     // the address the heap is mapped at
+    uint64_t capacity; // the length of the file
+    uint64_t layout;   // tells builds of the program apart, see heap_layout
+    uint64_t blocks;   // the offset of the first block
+    uint64_t top;      // the offset of the first byte never handed out
+    obj *root;
+    void *free_blocks[HEAP_CLASSES];
+    refmem_stats_t stats; // the live figures of the objects in the heap
+    // the entries of destructor_table the objects use, relative to the table, 0 for an empty slot
+    int64_t destructors[DESTRUCTOR_TABLE_SIZE];
+};
+
+static uint64_t *heap_starts = NULL; // the bitmap after the header
+static int heap_file = -1;
+
+// destructors are stored relative to refmem's own data, which moves with the program
+static int64_t heap_offset(uintptr_t address)
+{
+    return (int64_t)(address - (uintptr_t)destructor_table);
+}
+
+// differs between builds of the program whose code or data moved
+static uint64_t heap_layout()
+{
+    return heap_offset((uintptr_t)refmem_heap_open) ^ (uint64_t)sizeof(struct heap_header) << 48;
+}
+
+static size_t heap_block_size(size_t bytes)
+{
+    size_t block = (sizeof(large_record_t) + sizeof(meta_data_t) + bytes + HEAP_GRANULE - 1) & ~(size_t)(HEAP_GRANULE - 1);
+    return block <= HEAP_SMALL_BLOCK ? block : (size_t)1 << (64 - __builtin_clzll(block - 1));
+}
+
+static size_t heap_class(size_t block)
+{
+    if (block <= HEAP_SMALL_BLOCK)
+    {
+        return block / HEAP_GRANULE - 1;
+    }
+    return HEAP_SMALL_BLOCK / HEAP_GRANULE + (63 - __builtin_clzll(block)) - __builtin_ctzll(HEAP_SMALL_BLOCK) - 1;
+}
+
+static bool heap_contains(void *ptr)
+{
+    return persistent_heap != NULL && (uintptr_t)ptr >= persistent_heap->base + persistent_heap->blocks &&
+           (uintptr_t)ptr < persistent_heap->base + persistent_heap->top;
+}
+
+static size_t heap_granule(obj *obj_ptr)
+{
+    return ((uintptr_t)obj_ptr - persistent_heap->base) / HEAP_GRANULE;
+}
+
+static bool heap_object_is_live(obj *obj_ptr)
+{
+    size_t granule = heap_granule(obj_ptr);
+    return (uintptr_t)obj_ptr % HEAP_GRANULE == 0 && (heap_starts[granule / 64] >> (granule % 64)) & 1;
+}
+
+static void heap_object_set_live(obj *obj_ptr, bool live)
+{
+    size_t granule = heap_granule(obj_ptr);
+    uint64_t bit = (uint64_t)1 << (granule % 64);
+
+    heap_starts[granule / 64] = live ? heap_starts[granule / 64] | bit : heap_starts[granule / 64] & ~bit;
+}
+
+static large_record_t *heap_allocate(size_t bytes)
+{
+    size_t block = heap_block_size(bytes);
+    size_t class = heap_class(block);
+    char *allocation = persistent_heap->free_blocks[class];
+
+    if (allocation != NULL)
+    {
+        persistent_heap->free_blocks[class] = *(void **)allocation;
+        memset(allocation, 0, block);
+    }
+    else
+    {
+        if (persistent_heap->top + block > persistent_heap->capacity)
+        {
+            fprintf(stderr, "refmem: the heap of %zu bytes is full\n", (size_t)persistent_heap->capacity);
+            abort();
+        }
+        allocation = (char *)persistent_heap + persistent_heap->top;
+        persistent_heap->top += block;
+    }
+
+    heap_object_set_live(allocation + sizeof(large_record_t) + sizeof(meta_data_t), true);
+    return (large_record_t *)allocation;
+}
+
+static void heap_free(obj *obj_ptr)
+{
+    void **block = (void **)get_large_record(get_meta_data(obj_ptr));
+    size_t class = heap_class(heap_block_size(get_size(obj_ptr)));
+
+    heap_object_set_live(obj_ptr, false);
+    *block = persistent_heap->free_blocks[class];
+    persistent_heap->free_blocks[class] = block;
+}
+
+static void heap_count_live_object(size_t size, size_t header_bytes, int sign)
+{
+    count_live_bytes(&persistent_heap->stats, size, header_bytes, sign);
+}
+
+// the objects of the heap count as live in this process while it is open
+static void heap_add_live_figures(int sign)
+{
+    refmem_stats_t *stats = &persistent_heap->stats;
+
+    heap_stats.live_objects += sign * stats->live_objects;
+    heap_stats.live_bytes += sign * stats->live_bytes;
+    heap_stats.header_bytes += sign * stats->header_bytes;
+    for (size_t i = 0; i < REFMEM_SIZE_CLASSES; i++)
+    {
+        heap_stats.size_classes[i] += sign * stats->size_classes[i];
+    }
+    if (heap_stats.live_bytes > heap_stats.peak_live_bytes)
+    {
+        heap_stats.peak_live_bytes = heap_stats.live_bytes;
+    }
+}
+
+// called with destructor_table_lock held, by destructor_index for every new entry
+static void heap_remember_destructor(size_t slot, uintptr_t destructor)
+{
+    if (persistent_heap != NULL)
+    {
+        persistent_heap->destructors[slot] = heap_offset(destructor);
+    }
+}
+
+// puts the destructors of the heap back in the slots its objects refer to, and records the
+// entries of this process in the heap. Fails if a slot is taken by something else.
+static bool heap_merge_destructors(heap_header_t *heap)
+{
+    bool merged = true;
+
+    sync_lock(&destructor_table_lock);
+    for (size_t slot = 1; slot < DESTRUCTOR_TABLE_SIZE && merged; slot++)
+    {
+        uintptr_t entry = atomic_load_explicit(&destructor_table[slot], memory_order_relaxed);
+
+        if (heap->destructors[slot] == 0)
+        {
+            heap->destructors[slot] = entry != 0 ? heap_offset(entry) : 0;
+        }
+        else if (entry == 0)
+        {
+            atomic_store_explicit(&destructor_table[slot], (uintptr_t)destructor_table + heap->destructors[slot], memory_order_release);
+        }
+        else
+        {
+            merged = heap_offset(entry) == heap->destructors[slot];
+        }
+    }
+    sync_unlock(&destructor_table_lock);
+
+    return merged;
+}
+
+// the bitmap has a bit for every granule of the file, the blocks start on the page after it
+static size_t heap_blocks_offset(size_t capacity)
+{
+    size_t bitmap_bytes = (capacity / HEAP_GRANULE + 63) / 64 * sizeof(uint64_t);
+    return (sizeof(heap_header_t) + bitmap_bytes + page_size() - 1) / page_size() * page_size();
+}
+
+bool refmem_heap_open(const char *path, size_t capacity)
+{
+    if (SYNC_THREAD_SAFE || persistent_heap != NULL)
+    {
+        return false;
+    }
+
+    int file = open(path, O_RDWR | O_CREAT, 0600);
+    struct stat file_stat;
+    if (file < 0 || fstat(file, &file_stat) != 0)
+    {
+        perror(path);
+        if (file >= 0)
+        {
+            close(file);
+        }
+        return false;
+    }
+
+    // a new heap gets its size, an existing one is checked before it is mapped where it wants
+    bool created = file_stat.st_size == 0;
+    void *base = (void *)HEAP_BASE;
+    if (created)
+    {
+        capacity = capacity == 0 ? HEAP_DEFAULT_CAPACITY : (capacity + page_size() - 1) / page_size() * page_size();
+        if (capacity <= heap_blocks_offset(capacity) || ftruncate(file, capacity) != 0)
+        {
+            close(file);
+            return false;
+        }
+    }
+    else
+    {
+        heap_header_t *header = (size_t)file_stat.st_size >= sizeof(heap_header_t) ?
+                 mmap(NULL, sizeof(heap_header_t), PROT_READ, MAP_SHARED, file, 0) : MAP_FAILED;
+        if (header == MAP_FAILED || memcmp(header->magic, HEAP_MAGIC, HEAP_MAGIC_SIZE) != 0 ||
+            header->layout != heap_layout() || header->capacity != (uint64_t)file_stat.st_size)
+        {
+            fprintf(stderr, "refmem: %s is not a heap of this build of the program\n", path);
+            if (header != MAP_FAILED)
+            {
+                munmap(header, sizeof(heap_header_t));
+            }
+            close(file);
+            return false;
+        }
+        base = (void *)(uintptr_t)header->base;
+        capacity = header->capacity;
+        munmap(header, sizeof(heap_header_t));
+    }
+
+    heap_header_t *heap = mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | HEAP_MAP_FIXED, file, 0);
+    if (heap != base)
+    {
+        fprintf(stderr, "refmem: the heap in %s can not be mapped at %p\n", path, base);
+        if (heap != MAP_FAILED)
+        {
+            munmap(heap, capacity);
+        }
+        close(file);
+        return false;
+    }
+
+    if (created)
+    {
+        memcpy(heap->magic, HEAP_MAGIC, HEAP_MAGIC_SIZE);
+        heap->base = (uintptr_t)base;
+        heap->capacity = capacity;
+        heap->layout = heap_layout();
+        heap->blocks = heap_blocks_offset(capacity);
+        heap->top = heap->blocks;
+    }
+    if (!heap_merge_destructors(heap))
+    {
+        fprintf(stderr, "refmem: the destructors of the heap in %s clash with those of the program\n", path);
+        munmap(heap, capacity);
+        close(file);
+        return false;
+    }
+
+    persistent_heap = heap;
+    heap_starts = (uint64_t *)(heap + 1);
+    heap_file = file;
+    widen_object_bounds(heap->base + heap->blocks);
+    widen_object_bounds(heap->base + heap->capacity - 1);
+    heap_add_live_figures(1);
+    reserve_free_queue_slot();
+    return true;
+}
+
+obj *refmem_heap_root()
+{
+    return persistent_heap != NULL ? persistent_heap->root : NULL;
+}
+
+void refmem_heap_set_root(obj *root)
+{
+    if (persistent_heap == NULL)
+    {
+        return;
+    }
+
+    obj *old_root = persistent_heap->root;
+    if (root != NULL)
+    {
+        retain(root);
+    }
+    persistent_heap->root = root;
+    if (old_root != NULL)
+    {
+        release(old_root);
+    }
+}
+
+// weak references live in weak_table, which does not outlive the process
+static void heap_clear_weak_refs()
 {
-    meta_data_t *meta_data = get_meta_data(obj_ptr);
-    return (meta_data->destructor); //Removed "&", gave warnings and does not seem to make a difference.
+    sync_lock(&weak_table_lock);
+    size_t used = weak_table_used;
+    sync_unlock(&weak_table_lock);
+
+    for (size_t slot = 0; slot < used; slot++)
+    {
+        weak_ref_t *ref = weak_table[slot].ref;
+        if (ref != NULL && (heap_contains(ref) || heap_contains(ref->target)))
+        {
+            weak_clear(ref->target);
+        }
+    }
 }
 
-unsigned short get_size(obj *obj_ptr)
+// the last cleanup of refmem_heap_close may buffer objects of the heap again, they are forgotten
+// before it is unmapped and left in the file as if they had never been buffered
+static void heap_forget_cycle_roots()
 {
-    meta_data_t *meta_data = get_meta_data(obj_ptr);
-    return meta_data->size;
+    size_t count = cycle_roots != NULL ? pointer_set_size(cycle_roots) : 0;
+    obj **roots = malloc(count * sizeof(obj *) + 1);
+
+    if (count > 0)
+    {
+        pointer_set_copy_to(cycle_roots, (void **)roots);
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (heap_contains(roots[i]))
+        {
+            meta_data_t *meta_data = get_meta_data(roots[i]);
+            meta_data->flags &= ~FLAG_BUFFERED;
+            set_color(meta_data, COLOR_BLACK);
+            pointer_set_remove(cycle_roots, roots[i]);
+        }
+    }
+    free(roots);
 }
 
-unsigned short get_counter(obj *obj_ptr)
+void refmem_heap_close()
 {
-    meta_data_t *meta_data = get_meta_data(obj_ptr);
-    return meta_data->counter;
+    if (persistent_heap == NULL)
+    {
+        return;
+    }
+
+    // nothing outside the heap may be left waiting to free an object in it
+    cleanup();
+    collect_cycles();
+    cleanup();
+    heap_forget_cycle_roots();
+    heap_clear_weak_refs();
+    heap_add_live_figures(-1);
+
+    msync(persistent_heap, persistent_heap->top, MS_SYNC);
+    munmap(persistent_heap, persistent_heap->capacity);
+    close(heap_file);
+    persistent_heap = NULL;
+    heap_starts = NULL;
+    heap_file = -1;
 }
 
-static bool compare_func(elem_t a, elem_t b)
+// the heap profiler picks an allocation every PROFILE_DEFAULT_INTERVAL bytes on average, and
+// counts it for its call stack as if it stood for all the bytes allocated since the last one
+#define PROFILE_DEFAULT_INTERVAL ((size_t)512 << 10)
+#define PROFILE_RECHECK ((size_t)1 << 20) // bytes between looking for a profile started by another thread
+#define PROFILE_MAX_FRAMES 16
+#define PROFILE_SKIPPED_FRAMES 2 // profile_allocation and the allocate function allocate_object is inlined into
+#define PROFILE_EMPTY ((obj *)0)
+#define PROFILE_REMOVED ((obj *)1)
+
+typedef struct
+{
+    void *frames[PROFILE_MAX_FRAMES];
+    int depth;
+    uint64_t allocated_objects;
+    uint64_t allocated_bytes;
+    uint64_t freed_objects;
+    uint64_t freed_bytes;
+} profile_site_t;
+
+// a sampled object that is still alive, and what it stands for
+typedef struct
+{
+    obj *object;
+    size_t site;
+    size_t objects;
+    size_t bytes;
+} profile_sample_t;
+
+static _Atomic size_t profile_interval = 0; // 0 while no profile is taken
+static THREAD_LOCAL size_t seen_profile_interval = 0;
+static THREAD_LOCAL uint64_t profile_random = 0x2545f4914f6cdd1dull;
+static sync_lock_t profile_lock = SYNC_LOCK_INITIALIZER;
+static _Atomic bool profile_environment_read = false; // set once the environment has been read, checked before profile_lock is taken
+static char *profile_path = NULL; // from REFMEM_PROFILE, written by shutdown
+
+static profile_site_t *profile_sites = NULL;
+static size_t profile_site_count = 0;
+static size_t *profile_site_index = NULL; // open addressing over the call stacks, SIZE_MAX is empty
+static size_t profile_site_capacity = 0;  // of the index, sites are at most half of it
+
+static profile_sample_t *profile_samples = NULL; // open addressing over the sampled objects
+static size_t profile_sample_capacity = 0;
+static size_t profile_sample_used = 0; // samples and removed slots
+
+static uint64_t profile_hash(void *const *words, int count)
 {
-    return a.void_ptr == b.void_ptr;
+    uint64_t hash = 0;
+    for (int i = 0; i < count; i++)
+    {
+        hash = (hash ^ (uintptr_t)words[i]) * DESTRUCTOR_HASH;
+    }
+    return hash ^ (hash >> 29);
 }
 
-void set_queue_to_null()
+// uniform between 1 and twice the interval, so the distance between samples averages the interval
+static size_t next_sample_distance(size_t interval)
 {
-    to_be_freed = NULL;
+    profile_random ^= profile_random << 13;
+    profile_random ^= profile_random >> 7;
+    profile_random ^= profile_random << 17;
+    return 1 + profile_random % (2 * interval);
 }
 
-void set_list_to_null()
+static size_t profile_site(void *const *frames, int depth)
 {
-    allocated_pointers = NULL;
+    if (2 * (profile_site_count + 1) > profile_site_capacity)
+    {
+        size_t capacity = profile_site_capacity == 0 ? 64 : profile_site_capacity * 2;
+        profile_site_index = realloc(profile_site_index, capacity * sizeof(size_t));
+        profile_sites = realloc(profile_sites, capacity / 2 * sizeof(profile_site_t));
+        profile_site_capacity = capacity;
+
+        memset(profile_site_index, 0xff, capacity * sizeof(size_t));
+        for (size_t site = 0; site < profile_site_count; site++)
+        {
+            size_t slot = profile_hash(profile_sites[site].frames, profile_sites[site].depth) & (capacity - 1);
+            while (profile_site_index[slot] != SIZE_MAX)
+            {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            profile_site_index[slot] = site;
+        }
+    }
+
+    size_t slot = profile_hash(frames, depth) & (profile_site_capacity - 1);
+    while (profile_site_index[slot] != SIZE_MAX)
+    {
+        profile_site_t *site = &profile_sites[profile_site_index[slot]];
+        if (site->depth == depth && memcmp(site->frames, frames, depth * sizeof(void *)) == 0)
+        {
+            return profile_site_index[slot];
+        }
+        slot = (slot + 1) & (profile_site_capacity - 1);
+    }
+
+    profile_site_t *site = &profile_sites[profile_site_count];
+    *site = (profile_site_t){.depth = depth};
+    memcpy(site->frames, frames, depth * sizeof(void *));
+    profile_site_index[slot] = profile_site_count;
+    return profile_site_count++;
 }
 
-static void free_from_queue()
+static profile_sample_t *find_sample(obj *obj_ptr)
 {
-    for (size_t i = 0; i < cascade_limit; i++)
+    if (profile_sample_capacity == 0)
+    {
+        return NULL;
+    }
+
+    size_t slot = profile_hash(&obj_ptr, 1) & (profile_sample_capacity - 1);
+    while (profile_samples[slot].object != PROFILE_EMPTY)
     {
-        if (to_be_freed == NULL)
+        if (profile_samples[slot].object == obj_ptr)
         {
-            break;
+            return &profile_samples[slot];
         }
-        else if (is_empty(to_be_freed))
+        slot = (slot + 1) & (profile_sample_capacity - 1);
+    }
+    return NULL;
+}
+
+static void insert_sample(profile_sample_t sample)
+{
+    if (2 * (profile_sample_used + 1) > profile_sample_capacity)
+    {
+        profile_sample_t *old = profile_samples;
+        size_t old_capacity = profile_sample_capacity;
+
+        profile_sample_capacity = old_capacity == 0 ? 64 : old_capacity * 2;
+        profile_samples = calloc(profile_sample_capacity, sizeof(profile_sample_t));
+        profile_sample_used = 0;
+        for (size_t i = 0; i < old_capacity; i++)
         {
-            break;
+            if (old[i].object != PROFILE_EMPTY && old[i].object != PROFILE_REMOVED)
+            {
+                insert_sample(old[i]);
+            }
         }
-        else
+        free(old);
+    }
+
+    size_t slot = profile_hash(&sample.object, 1) & (profile_sample_capacity - 1);
+    while (profile_samples[slot].object != PROFILE_EMPTY)
+    {
+        slot = (slot + 1) & (profile_sample_capacity - 1);
+    }
+    profile_samples[slot] = sample;
+    profile_sample_used++;
+}
+
+static void profile_clear()
+{
+    free(profile_sites);
+    free(profile_site_index);
+    free(profile_samples);
+    profile_sites = NULL;
+    profile_site_index = NULL;
+    profile_samples = NULL;
+    profile_site_count = profile_site_capacity = 0;
+    profile_sample_capacity = profile_sample_used = 0;
+}
+
+// REFMEM_PROFILE names a file to write a profile to at shutdown, REFMEM_PROFILE_INTERVAL the sampling interval
+static void read_profile_environment()
+{
+    char *path = getenv("REFMEM_PROFILE");
+    char *interval = getenv("REFMEM_PROFILE_INTERVAL");
+
+    if (path != NULL && *path != '\0')
+    {
+        profile_path = path;
+        atomic_store_explicit(&profile_interval, interval != NULL ? strtoull(interval, NULL, 10) : 0, memory_order_relaxed);
+        if (atomic_load_explicit(&profile_interval, memory_order_relaxed) == 0)
         {
-            obj *to_free_ptr = dequeue(to_be_freed);
-            deallocate(to_free_ptr);
+            atomic_store_explicit(&profile_interval, PROFILE_DEFAULT_INTERVAL, memory_order_relaxed);
         }
     }
 }
 
-obj *allocate(size_t bytes, function1_t destructor)
+// kept out of allocate, so the frames it skips are always itself and allocate
+__attribute__((noinline)) static void profile_allocation(obj *obj_ptr, size_t bytes)
 {
-    if (allocated_pointers == NULL)
+    // the acquire pairs with the release below, so profile_path is seen once the flag is
+    if (!atomic_load_explicit(&profile_environment_read, memory_order_acquire))
     {
-        allocated_pointers = linked_list_create(compare_func);
+        sync_lock(&profile_lock);
+        if (!atomic_load_explicit(&profile_environment_read, memory_order_relaxed))
+        {
+            read_profile_environment();
+            atomic_store_explicit(&profile_environment_read, true, memory_order_release);
+        }
+        sync_unlock(&profile_lock);
     }
 
-    void *allocation = calloc(1, (sizeof(meta_data_t) + bytes));
+    size_t interval = atomic_load_explicit(&profile_interval, memory_order_relaxed);
+    // a profile that has just started, or no profile at all, begins with a distance and no sample
+    if (interval == 0 || interval != seen_profile_interval)
+    {
+        seen_profile_interval = interval;
+        bytes_until_sample = interval == 0 ? PROFILE_RECHECK : next_sample_distance(interval);
+        return;
+    }
 
-    meta_data_t* meta_data = (meta_data_t*)allocation;
-    meta_data->counter = 0;
-    meta_data->size = bytes;
-    meta_data->destructor = destructor;
+    void *frames[PROFILE_MAX_FRAMES + PROFILE_SKIPPED_FRAMES];
+    int depth = backtrace(frames, PROFILE_MAX_FRAMES + PROFILE_SKIPPED_FRAMES) - PROFILE_SKIPPED_FRAMES;
+    size_t weight = bytes > interval ? bytes : interval;
+    profile_sample_t sample = {obj_ptr, 0, weight / (bytes > 0 ? bytes : 1), weight};
 
-    linked_list_append(allocated_pointers, void_elem((&meta_data[1])));
-    free_from_queue();
+    sync_lock(&profile_lock);
+    if (atomic_load_explicit(&profile_interval, memory_order_relaxed) != 0)
+    {
+        sample.site = profile_site(frames + PROFILE_SKIPPED_FRAMES, depth > 0 ? depth : 0);
+        profile_sites[sample.site].allocated_objects += sample.objects;
+        profile_sites[sample.site].allocated_bytes += sample.bytes;
+        insert_sample(sample);
+        get_meta_data(obj_ptr)->flags |= FLAG_SAMPLED;
+    }
+    sync_unlock(&profile_lock);
 
-    return (obj *)(&meta_data[1]);
+    bytes_until_sample = next_sample_distance(interval);
 }
 
-static bool is_allocated_pointer(obj *obj_ptr)
+static void profile_free(obj *obj_ptr)
 {
-    return linked_list_contains(allocated_pointers, void_elem(obj_ptr));
+    sync_lock(&profile_lock);
+    profile_sample_t *sample = find_sample(obj_ptr);
+    if (sample != NULL)
+    {
+        profile_sites[sample->site].freed_objects += sample->objects;
+        profile_sites[sample->site].freed_bytes += sample->bytes;
+        sample->object = PROFILE_REMOVED;
+    }
+    sync_unlock(&profile_lock);
 }
 
-static void object_scanner(obj *obj_ptr, size_t obj_size)
+void refmem_profile_start(size_t interval)
+{
+    sync_lock(&profile_lock);
+    profile_clear();
+    atomic_store_explicit(&profile_interval, interval > 0 ? interval : PROFILE_DEFAULT_INTERVAL, memory_order_relaxed);
+    sync_unlock(&profile_lock);
+    bytes_until_sample = 0;
+}
+
+void refmem_profile_stop()
+{
+    sync_lock(&profile_lock);
+    atomic_store_explicit(&profile_interval, 0, memory_order_relaxed);
+    profile_clear();
+    sync_unlock(&profile_lock);
+}
+
+bool refmem_profile_write(const char *path)
 {
-    for (size_t i = 0; i < obj_size; i += sizeof(void*))
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
     {
-        void **possible_pointer = (void **)((char *)obj_ptr + i);
-        if (is_allocated_pointer(*possible_pointer))
+        return false;
+    }
+
+    sync_lock(&profile_lock);
+    fprintf(file, "refmem heap profile\n");
+    fprintf(file, "interval %zu\n", atomic_load_explicit(&profile_interval, memory_order_relaxed));
+    for (size_t i = 0; i < profile_site_count; i++)
+    {
+        profile_site_t *site = &profile_sites[i];
+        char **symbols = backtrace_symbols(site->frames, site->depth);
+
+        fprintf(file, "site %llu %llu %llu %llu\n",
+                (unsigned long long)site->allocated_objects, (unsigned long long)site->allocated_bytes,
+                (unsigned long long)site->freed_objects, (unsigned long long)site->freed_bytes);
+        for (int frame = 0; frame < site->depth; frame++)
         {
-            release(*possible_pointer);
+            if (symbols != NULL)
+            {
+                fprintf(file, "  %s\n", symbols[frame]);
+            }
+            else
+            {
+                fprintf(file, "  [%p]\n", site->frames[frame]);
+            }
         }
+        free(symbols);
     }
+    sync_unlock(&profile_lock);
+
+    return fclose(file) == 0;
 }
 
-static void default_destructor(obj *obj_ptr)
+// objects still allocated with the same size class and destructor, see refmem_leak_report
+typedef struct
 {
-    size_t obj_size = get_size(obj_ptr);
-    object_scanner(obj_ptr, obj_size);
-}
+    size_t size_class;
+    unsigned short slot;
+    unsigned short kind; // FLAG_TYPED, FLAG_ATOMIC or 0
+    size_t objects;
+    size_t bytes;
+} leak_group_t;
 
+typedef struct
+{
+    leak_group_t *groups;
+    size_t count;
+    size_t capacity;
+    pointer_set_t *queued; // objects waiting to be freed, they are not leaked
+} leak_report_t;
 
-void deallocate(obj *obj_ptr)
+static void leak_report_add(leak_report_t *report, obj *obj_ptr)
 {
+    if (report->queued != NULL && pointer_set_contains(report->queued, obj_ptr))
+    {
+        return;
+    }
+
     meta_data_t *meta_data = get_meta_data(obj_ptr);
+    size_t size = get_size(obj_ptr);
+    unsigned short kind = meta_data->flags & (FLAG_TYPED | FLAG_ATOMIC);
+    leak_group_t key = {size_class(size), kind & FLAG_ATOMIC ? 0 : destructor_slot(meta_data), kind, 0, 0};
+    leak_group_t *group = NULL;
 
-    if (meta_data->destructor == NULL)
+    // there are few groups, one per size class and destructor
+    for (size_t i = 0; i < report->count && group == NULL; i++)
     {
-       default_destructor(obj_ptr);
+        leak_group_t *candidate = &report->groups[i];
+        if (candidate->size_class == key.size_class && candidate->slot == key.slot && candidate->kind == key.kind)
+        {
+            group = candidate;
+        }
     }
-    else
+    if (group == NULL)
     {
-        meta_data->destructor(obj_ptr);
+        if (report->count == report->capacity)
+        {
+            report->capacity = report->capacity == 0 ? 16 : report->capacity * 2;
+            report->groups = realloc(report->groups, report->capacity * sizeof(leak_group_t));
+        }
+        group = &report->groups[report->count++];
+        *group = key;
     }
 
-    void *elem = get_meta_data(obj_ptr);
+    group->objects++;
+    group->bytes += size;
+}
 
-    linked_list_remove_object(allocated_pointers, obj_ptr);
-    free(elem);
+static void leak_report_add_slot(void *slot, void *context)
+{
+    leak_report_add(context, (meta_data_t *)slot + 1);
 }
 
-void retain(obj *obj_ptr)
+static int compare_leak_groups(const void *first, const void *second)
 {
-   meta_data_t *meta_data = get_meta_data(obj_ptr);
+    size_t first_bytes = ((const leak_group_t *)first)->bytes;
+    size_t second_bytes = ((const leak_group_t *)second)->bytes;
+    return first_bytes < second_bytes ? 1 : first_bytes > second_bytes ? -1 : 0;
+}
+
+static void print_leak_group(FILE *out, leak_group_t *group)
+{
+    size_t smallest = group->size_class == 0 ? 0 : (size_t)1 << group->size_class;
+    uintptr_t destructor = atomic_load_explicit(&destructor_table[group->slot], memory_order_relaxed);
 
-    if (meta_data->counter == 65535)
+    fprintf(out, "%zu objects of %zu up to %zu bytes, %zu bytes in all, ",
+            group->objects, smallest, ((size_t)1 << (group->size_class + 1)) - 1, group->bytes);
+    if (group->kind & FLAG_ATOMIC)
+    {
+        fprintf(out, "atomic\n");
+    }
+    else if (group->kind & FLAG_TYPED)
+    {
+        fprintf(out, "type %s\n", ((const refmem_type_t *)destructor)->name);
+    }
+    else if (group->slot == 0)
     {
-        deallocate(obj_ptr);
+        fprintf(out, "default destructor\n");
     }
     else
     {
-        meta_data->counter++;
+        char **symbols = backtrace_symbols((void *const *)&destructor, 1);
+        if (symbols != NULL)
+        {
+            fprintf(out, "destructor %s\n", symbols[0]);
+        }
+        else
+        {
+            fprintf(out, "destructor [%p]\n", (void *)destructor);
+        }
+        free(symbols);
     }
 }
 
-static void add_to_free_queue(obj *obj_to_free)
+size_t refmem_leak_report(FILE *out)
 {
-    if (to_be_freed == NULL)
+    leak_report_t report = {NULL, 0, 0, NULL};
+
+    if (to_be_freed.size > 0)
     {
-        to_be_freed = create_queue();
+        report.queued = pointer_set_create();
+        for (size_t i = 0; i < to_be_freed.size; i++)
+        {
+            pointer_set_insert(report.queued, to_be_freed.objects[(to_be_freed.front + i) & (to_be_freed.capacity - 1)]);
+        }
     }
-    enqueue(to_be_freed, obj_to_free);
-}
 
-void release(obj *obj_ptr)
-{
-    if (obj_ptr != NULL)
+    slab_for_each_slot(leak_report_add_slot, &report);
+
+    sync_lock(&allocated_pointers_lock);
+    size_t large_count = allocated_pointers != NULL ? pointer_set_size(allocated_pointers) : 0;
+    size_t chunk_count = arena_chunks != NULL ? pointer_set_size(arena_chunks) : 0;
+    void **pointers = malloc((large_count + chunk_count) * sizeof(void *) + 1);
+    if (large_count > 0)
     {
-        meta_data_t *meta_data = get_meta_data(obj_ptr);
+        pointer_set_copy_to(allocated_pointers, pointers);
+    }
+    if (chunk_count > 0)
+    {
+        pointer_set_copy_to(arena_chunks, pointers + large_count);
+    }
+    sync_unlock(&allocated_pointers_lock);
 
-        if (meta_data->counter <= 0)
-        {
-            printf("Warning! More releases than retains\n");
-            assert(meta_data->counter == 0);
-        }
-        else
+    for (size_t i = 0; i < large_count; i++)
+    {
+        leak_report_add(&report, pointers[i]);
+    }
+    for (size_t i = 0; i < chunk_count; i++)
+    {
+        arena_chunk_t *chunk = pointers[large_count + i];
+        for (size_t word = 0; word < ARENA_WORDS / 64; word++)
         {
-            meta_data->counter--;
-
-            if ((meta_data->counter) == 0)
+            for (uint64_t bits = chunk->starts[word]; bits != 0; bits &= bits - 1)
             {
-                add_to_free_queue(obj_ptr);
+                leak_report_add(&report, (void **)chunk + word * 64 + __builtin_ctzll(bits));
             }
         }
     }
-}
+    free(pointers);
 
-unsigned short rc(obj *obj_ptr)
-{
-    meta_data_t *meta_data = get_meta_data(obj_ptr);
-    return meta_data->counter;
+    size_t objects = 0;
+    size_t bytes = 0;
+    for (size_t i = 0; i < report.count; i++)
+    {
+        objects += report.groups[i].objects;
+        bytes += report.groups[i].bytes;
+    }
+
+    qsort(report.groups, report.count, sizeof(leak_group_t), compare_leak_groups);
+    fprintf(out, "refmem: %zu objects still allocated, %zu bytes\n", objects, bytes);
+    for (size_t i = 0; i < report.count; i++)
+    {
+        fprintf(out, "  ");
+        print_leak_group(out, &report.groups[i]);
+    }
+
+    free(report.groups);
+    if (report.queued != NULL)
+    {
+        pointer_set_destroy(report.queued);
+    }
+    return objects;
 }
 
-obj *allocate_array(size_t elements, size_t elem_size, function1_t destructor)
+// frees the objects that are not served from slabs, the arena chunks and the arenas not destroyed
+// yet, without looking at the objects in them
+static void release_unlisted_memory()
 {
-    if (allocated_pointers == NULL)
+    sync_lock(&allocated_pointers_lock);
+    size_t count = allocated_pointers != NULL ? pointer_set_size(allocated_pointers) : 0;
+    obj **objects = malloc(count * sizeof(obj *) + 1);
+    if (count > 0)
     {
-        allocated_pointers = linked_list_create(compare_func);
+        pointer_set_copy_to(allocated_pointers, (void **)objects);
     }
+    pointer_set_destroy(allocated_pointers);
+    allocated_pointers = NULL;
 
-    void *allocation = calloc(1, (sizeof(meta_data_t) + (elements * elem_size)));
+    for (size_t i = 0; i < count; i++)
+    {
+        if (get_meta_data(objects[i])->flags & FLAG_MAPPED)
+        {
+            unmap_object(objects[i], get_size(objects[i]));
+        }
+        else
+        {
+            free(get_large_record(get_meta_data(objects[i])));
+        }
+    }
 
-    meta_data_t* meta_data = (meta_data_t*)allocation;
-    meta_data->counter = 0;
-    meta_data->size = elements * elem_size;
-    meta_data->destructor = destructor;
+    // the spare chunk is one of them
+    count = arena_chunks != NULL ? pointer_set_size(arena_chunks) : 0;
+    objects = realloc(objects, count * sizeof(obj *) + 1);
+    if (count > 0)
+    {
+        pointer_set_copy_to(arena_chunks, (void **)objects);
+    }
+    pointer_set_destroy(arena_chunks);
+    arena_chunks = NULL;
+    spare_chunk = NULL;
+    refmem_arena_t *arena = live_arenas;
+    live_arenas = NULL;
+    sync_unlock(&allocated_pointers_lock);
 
-    linked_list_append(allocated_pointers, void_elem((&meta_data[1])));
-    free_from_queue();
+    for (size_t i = 0; i < count; i++)
+    {
+        free(objects[i]);
+    }
+    free(objects);
 
-    return (obj *)(&meta_data[1]);
+    while (arena != NULL)
+    {
+        refmem_arena_t *next = arena->next;
+        free(arena->large.objects);
+        free(arena->dying.objects);
+        free(arena);
+        arena = next;
+    }
 }
 
-char *duplicate_string(char *str)
+void refmem_teardown(unsigned options)
 {
-    char *duplicate = allocate_array(strlen(str) + 1, sizeof(char) * 8, NULL);
-    strcpy(duplicate, str);
-    retain(duplicate);
-    return duplicate;
+    if (!(options & REFMEM_TEARDOWN_SKIP_DESTRUCTORS))
+    {
+        pools_destroy();
+        cleanup();
+    }
+    // the file must not be left with objects that are freed without it knowing
+    refmem_heap_close();
+    if (options & REFMEM_TEARDOWN_REPORT_LEAKS)
+    {
+        refmem_leak_report(stderr);
+    }
+    if (profile_path != NULL)
+    {
+        refmem_profile_write(profile_path);
+    }
+    refmem_profile_stop();
+    refmem_trace_flush();
+
+    pools_free();
+    free(to_be_freed.objects);
+    set_queue_to_null();
+    pointer_set_destroy(cycle_roots);
+    cycle_roots = NULL;
+    release_unlisted_memory();
+    slab_release_all();
+
+    sync_lock(&weak_table_lock);
+    weak_table_used = 0;
+    weak_free_slots = 0;
+    weak_free = 0;
+    sync_unlock(&weak_table_lock);
+
+    heap_stats.live_objects = 0;
+    heap_stats.live_bytes = 0;
+    heap_stats.header_bytes = 0;
+    memset(heap_stats.size_classes, 0, sizeof(heap_stats.size_classes));
 }
 
 void set_cascade_limit(size_t new)
@@ -235,27 +3009,103 @@ size_t get_cascade_limit()
     return cascade_limit;
 }
 
+void set_cascade_time_budget(size_t nanoseconds)
+{
+    cascade_time_budget = nanoseconds;
+}
+
+size_t get_cascade_time_budget()
+{
+    return cascade_time_budget;
+}
+
+void set_cascade_byte_budget(size_t bytes)
+{
+    cascade_byte_budget = bytes;
+}
+
+size_t get_cascade_byte_budget()
+{
+    return cascade_byte_budget;
+}
+
+void get_pause_stats(refmem_pause_stats_t *stats)
+{
+    *stats = pause_stats;
+}
+
+void reset_pause_stats()
+{
+    pause_stats = (refmem_pause_stats_t){0};
+}
+
+void set_cascade_adaptive(bool adaptive)
+{
+    cascade_adaptive = adaptive;
+}
+
+bool get_cascade_adaptive()
+{
+    return cascade_adaptive;
+}
+
+void set_free_high_water(size_t objects, size_t bytes)
+{
+    high_water_objects = objects;
+    high_water_bytes = bytes;
+}
+
+void refmem_stats(refmem_stats_t *stats)
+{
+    *stats = heap_stats;
+    stats->queued_objects = to_be_freed.size;
+    stats->queued_bytes = to_be_freed.bytes;
+}
+
+void get_backlog(refmem_backlog_t *stats)
+{
+    *stats = backlog;
+    stats->queued_objects = to_be_freed.size;
+    stats->queued_bytes = to_be_freed.bytes;
+}
+
 void cleanup()
 {
-    if (to_be_freed == NULL)
+#ifdef REFMEM_THREAD_SAFE
+    merge_queued_objects();
+#endif
+    // objects autoreleased outside of any pool
+    if (pool_depth == 0)
     {
-        return;
+        pool_drain(0);
     }
-    else
+    bool was_freeing = freeing;
+    freeing = true;
+    while (to_be_freed.size > 0)
     {
-        while (!is_empty(to_be_freed))
-        {
-            obj *to_free_ptr = dequeue(to_be_freed);
-            deallocate(to_free_ptr);
-        }
+        deallocate(take_from_free_queue());
     }
+    freeing = was_freeing;
+    slab_flush();
 }
 
 void shutdown()
 {
+    pools_destroy();
     cleanup();
-    destroy_queue(to_be_freed);
-    linked_list_destroy(allocated_pointers);
-    to_be_freed = NULL;
+    refmem_heap_close();
+    if (profile_path != NULL)
+    {
+        refmem_profile_write(profile_path);
+    }
+    refmem_trace_flush();
+    free_queue_destroy();
+    arena_trim();
+    pointer_set_destroy(cycle_roots);
+    cycle_roots = NULL;
+    sync_lock(&allocated_pointers_lock);
+    pointer_set_destroy(allocated_pointers);
     allocated_pointers = NULL;
+    sync_unlock(&allocated_pointers_lock);
+    slab_trim();
 }
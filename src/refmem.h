@@ -2,6 +2,9 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 /**
  * @file refmem.h
@@ -12,6 +15,79 @@
 typedef void obj;
 typedef void(*function1_t)(obj *);
 
+#define REFMEM_PAUSE_BUCKETS 32
+
+/// @brief The most words of one element a type descriptor can describe
+#define REFMEM_TYPE_MAX_WORDS 64
+
+/// @brief Describes which words of an object hold references to other objects, see allocate_typed.
+/// Word i of an element starts at byte i * sizeof(void *), an array repeats the element every size bytes.
+typedef struct
+{
+    const char *name;        ///< the name of the type
+    size_t size;             ///< the size of one element in bytes
+    uint64_t pointers;       ///< bit i is set if word i always holds an object or NULL
+    uint64_t maybe_pointers; ///< bit i is set if word i may hold an object, such as an elem_t, it is checked before it is released
+} refmem_type_t;
+
+/// @brief The bit of a pointer field in the bitmaps of a refmem_type_t
+#define REFMEM_FIELD(type, field) ((uint64_t)1 << (offsetof(type, field) / sizeof(void *)))
+
+/// @brief Declares a type descriptor for a struct at compile time, for example
+/// REFMEM_DECLARE_TYPE(link_type, link_t, REFMEM_FIELD(link_t, next), REFMEM_FIELD(link_t, value));
+#define REFMEM_DECLARE_TYPE(descriptor, type, pointer_bits, maybe_pointer_bits) \
+    _Static_assert(sizeof(type) <= REFMEM_TYPE_MAX_WORDS * sizeof(void *), #type " is too large for a type descriptor"); \
+    static const refmem_type_t descriptor = {#type, sizeof(type), (pointer_bits), (maybe_pointer_bits)}
+
+/// @brief A region that objects are bump allocated from and freed with all at once, see arena_create
+typedef struct refmem_arena refmem_arena_t;
+
+/// @brief A reference to an object that does not keep it alive, see weak_create
+typedef struct weak_ref weak_ref_t;
+
+/// @brief The pauses spent freeing queued objects inside allocate, or inside release when the
+/// queue is drained past its high-water mark, see get_pause_stats
+typedef struct
+{
+    uint64_t pauses;   ///< the number of calls that freed at least one object
+    uint64_t total_ns; ///< the time spent in all those pauses
+    uint64_t max_ns;   ///< the longest pause
+    uint64_t histogram[REFMEM_PAUSE_BUCKETS]; ///< histogram[i] counts pauses of 2^i up to 2^(i+1) ns
+} refmem_pause_stats_t;
+
+/// @brief The objects whose count has reached zero but that are not freed yet, see get_backlog
+typedef struct
+{
+    size_t queued_objects;      ///< objects waiting to be freed
+    size_t queued_bytes;        ///< their size, headers included
+    size_t peak_objects;        ///< the most objects that have been waiting at once
+    size_t peak_bytes;          ///< the most bytes that have been waiting at once
+    uint64_t high_water_drains; ///< the number of times a high-water mark was crossed
+    uint64_t freed_objects;     ///< objects freed from the queue so far
+} refmem_backlog_t;
+
+#define REFMEM_SIZE_CLASSES 32
+
+/// @brief What refmem is holding and how it has been called, see refmem_stats. Objects count as
+/// live from allocate until their memory is freed, so objects waiting to be freed are included.
+/// When built with REFMEM_THREAD_SAFE every thread counts what it does itself, so an object freed
+/// by another thread than the one that allocated it makes the live figures of that thread negative,
+/// and only the sum over all threads is the size of the heap.
+typedef struct
+{
+    int64_t live_objects;     ///< objects allocated and not freed yet
+    int64_t live_bytes;       ///< their payload, as requested from allocate
+    int64_t header_bytes;     ///< what their headers and size records take on top of that
+    int64_t peak_live_bytes;  ///< the highest live_bytes so far
+    size_t queued_objects;    ///< objects waiting in the free queue
+    size_t queued_bytes;      ///< their size, headers included
+    uint64_t allocate_calls;  ///< objects allocated, arena objects included
+    uint64_t retain_calls;
+    uint64_t release_calls;   ///< releases of objects, releases of NULL are not counted
+    uint64_t deallocate_calls; ///< objects freed through deallocate, from the free queue or directly, and by collect_cycles
+    int64_t size_classes[REFMEM_SIZE_CLASSES]; ///< size_classes[i] counts live objects of 2^i up to 2^(i+1) bytes, the first also empty ones and the last larger ones
+} refmem_stats_t;
+
 /// @brief Allocates a memory block of a given byte size to create an object
 /// @param bytes the number of bytes of the allocated memory block
 /// @param destructor a destructor function associated with the object
@@ -32,9 +108,16 @@ void release(obj *obj_ptr);
 
 /// @brief Returns the reference count of a given object
 /// @param obj_ptr the object
-/// @return the reference count of the object
+/// @return the reference count of the object, 65535 for an immortal object
 unsigned short rc(obj *obj_ptr);
 
+/// @brief Makes an object immortal, for objects that live as long as the program such as a store
+/// shared by everything. Retain and release return at once without writing to it, deallocate and
+/// the cycle collector leave it alone, and it is only freed by refmem_teardown. What it references
+/// stays referenced. An object retained 65535 times becomes immortal instead of wrapping its count.
+/// @param obj_ptr the object
+void refmem_make_immortal(obj *obj_ptr);
+
 /// @brief Allocates a given amount of memory blocks of a given byte size to create an object with (potentially) multiple elements
 /// @param elements the number of blocks allocated for the object
 /// @param elem_size the number of bytes per memory block
@@ -42,6 +125,111 @@ unsigned short rc(obj *obj_ptr);
 /// @return the object created
 obj *allocate_array(size_t elements, size_t elem_size, function1_t destructor);
 
+/// @brief Allocates an object whose references are described by a type descriptor. When it is
+/// destroyed exactly the described words are released, and the cycle collector can look into it.
+/// @param type the descriptor of the object, it must outlive the object
+/// @return the object created
+obj *allocate_typed(const refmem_type_t *type);
+
+/// @brief Allocates an array of objects that are described by the same type descriptor, see allocate_typed
+/// @param elements the number of elements
+/// @param type the descriptor of one element, it must outlive the object
+/// @return the object created
+obj *allocate_array_typed(size_t elements, const refmem_type_t *type);
+
+/// @brief Allocates an object that holds no references to other objects, such as a string or a
+/// number. It is never scanned, so destroying it takes constant time.
+/// @param bytes the number of bytes of the allocated memory block
+/// @return the object created
+obj *allocate_atomic(size_t bytes);
+
+/// @brief Allocates an array of elements that hold no references to other objects, see allocate_atomic
+/// @param elements the number of elements
+/// @param elem_size the number of bytes per element
+/// @return the object created
+obj *allocate_array_atomic(size_t elements, size_t elem_size);
+
+/// @brief Creates an arena for short-lived objects, such as the scratch data of one command
+/// @return the arena created
+refmem_arena_t *arena_create();
+
+/// @brief Allocates an object from an arena by bumping a pointer in one of its chunks. The object
+/// is counted like any other object, but it is not freed when its count reaches zero; all of them
+/// are freed by arena_destroy.
+/// @param arena the arena to allocate from
+/// @param bytes the number of bytes of the allocated memory block
+/// @param destructor the function run when the arena is destroyed, NULL for the default destructor
+/// @return the object created
+obj *arena_allocate(refmem_arena_t *arena, size_t bytes, function1_t destructor);
+
+/// @brief Allocates an object that holds no references to other objects from an arena, see
+/// allocate_atomic. It is not scanned when the arena is destroyed.
+/// @param arena the arena to allocate from
+/// @param bytes the number of bytes of the allocated memory block
+/// @return the object created
+obj *arena_allocate_atomic(refmem_arena_t *arena, size_t bytes);
+
+/// @brief Destroys an arena and every object in it that is not referenced. Objects that were
+/// retained by someone outside the arena escape it, and are freed when their count reaches zero.
+/// @param arena the arena to destroy
+void arena_destroy(refmem_arena_t *arena);
+
+/// @brief Starts an autorelease pool. Pools nest, and each thread has pools of its own.
+void refmem_pool_push();
+
+/// @brief Ends the innermost autorelease pool, and frees the objects autoreleased in it that
+/// nobody has retained since
+void refmem_pool_pop();
+
+/// @brief Lets the innermost autorelease pool hold an object until it is popped, so that a function
+/// can return a temporary without retaining it, and its callers never have to release it. While the
+/// pool holds it, its count may go to zero and back without it being freed. Objects autoreleased
+/// outside of any pool are held until the next cleanup.
+/// @param obj_ptr the object to hold, an object is only held by one pool
+/// @return the object
+obj *autorelease(obj *obj_ptr);
+
+/// @brief Creates a weak reference to an object, which does not count as a reference to it and
+/// learns when it is freed. All weak references to one object are the same weak_ref_t.
+/// @param obj_ptr the object to refer to
+/// @return the weak reference, retained for the caller, release it when it is no longer needed
+weak_ref_t *weak_create(obj *obj_ptr);
+
+/// @brief Turns a weak reference into a reference, if the object is still alive. Objects with a
+/// count of zero are waiting to be freed and count as dead. With REFMEM_THREAD_SAFE, an object that
+/// another thread has just handed back to its owner also counts as dead, until the owner has merged
+/// its counts.
+/// @param ref the weak reference
+/// @return the object retained for the caller, or NULL if it has been freed
+obj *weak_lock(weak_ref_t *ref);
+
+/// @brief Opens a heap kept in a file, creating the file if it is empty. Until it is closed every
+/// object from allocate and its variants is allocated in the heap, arena objects excepted. The
+/// file is mapped at the same address every time, so the objects in it can point to each other
+/// as usual, and opening it takes the same time however much it holds. Objects in the heap must
+/// only refer to objects in the heap, functions and constants of the program, and the program must
+/// be built without position independence (-no-pie) if they hold function pointers. Destructors
+/// and type descriptors must be part of the program, and the heap can only be opened by the build
+/// of the program that created it. Not available when built with REFMEM_THREAD_SAFE.
+/// @param path the file of the heap
+/// @param capacity the size of a new heap in bytes, 0 for 1 GiB; an existing heap keeps its size
+/// @return true if the heap was opened, false if it could not be mapped or was made by another build
+bool refmem_heap_open(const char *path, size_t capacity);
+
+/// @brief Returns the root object of the open heap, from which everything kept in it is reached
+/// @return the root set by refmem_heap_set_root, or NULL if there is none or no heap is open
+obj *refmem_heap_root();
+
+/// @brief Makes an object of the open heap its root. The heap retains it, and releases the root it had.
+/// @param root the new root, NULL to have none
+void refmem_heap_set_root(obj *root);
+
+/// @brief Frees what is waiting to be freed, collects cycles, and writes the open heap back to its
+/// file and unmaps it. Objects that are still referenced stay in the file. Weak references between
+/// the heap and the rest of the program are cleared. Must be called outside of autorelease pools,
+/// shutdown calls it.
+void refmem_heap_close();
+
 /// @brief makes a copy of a string
 /// @param str the string to be copied
 /// @return the copy of the given string
@@ -55,8 +243,115 @@ void set_cascade_limit(size_t limit);
 /// @param the object to destroy
 size_t get_cascade_limit();
 
+/// @brief Lets every allocation free queued objects for about a given time instead of a given
+/// number of objects. The budget is checked after every object, so at least one object is freed.
+/// @param nanoseconds the time budget per allocation, 0 to go back to the cascade limit
+void set_cascade_time_budget(size_t nanoseconds);
+
+/// @brief Returns the time budget per allocation set by set_cascade_time_budget
+/// @return the time budget in nanoseconds, 0 if it is not used
+size_t get_cascade_time_budget();
+
+/// @brief Lets every allocation free queued objects until a given number of bytes, headers
+/// included, have been freed instead of a given number of objects. Ignored while a time budget is set.
+/// @param bytes the byte budget per allocation, 0 to go back to the cascade limit
+void set_cascade_byte_budget(size_t bytes);
+
+/// @brief Returns the byte budget per allocation set by set_cascade_byte_budget
+/// @return the byte budget, 0 if it is not used
+size_t get_cascade_byte_budget();
+
+/// @brief Copies the pause times observed so far, per thread when built with REFMEM_THREAD_SAFE
+/// @param stats where the pause times are written
+void get_pause_stats(refmem_pause_stats_t *stats);
+
+/// @brief Forgets the pause times observed so far
+void reset_pause_stats();
+
+/// @brief Lets the number of objects, or bytes with a byte budget, freed per allocation grow with
+/// the number of objects waiting to be freed. On by default.
+/// @param adaptive true to scale the limit with the backlog, false to use it as it is
+void set_cascade_adaptive(bool adaptive);
+
+/// @brief Returns whether the cascade limit scales with the backlog, see set_cascade_adaptive
+/// @return true if the cascade limit is adaptive
+bool get_cascade_adaptive();
+
+/// @brief Sets the high-water marks of the free queue. When a release makes the queue cross one
+/// of them, the queue is drained right away down to half the mark.
+/// @param objects the most objects allowed to wait, 0 for no limit
+/// @param bytes the most bytes allowed to wait, headers included, 0 for no limit
+void set_free_high_water(size_t objects, size_t bytes);
+
+/// @brief Copies the current size and history of the free queue, per thread when built with REFMEM_THREAD_SAFE
+/// @param backlog where the backlog metrics are written
+void get_backlog(refmem_backlog_t *backlog);
+
+/// @brief Copies the heap statistics in constant time, per thread when built with REFMEM_THREAD_SAFE.
+/// The counters are kept up to date by allocate, retain, release and the frees, so this can be polled often.
+/// @param stats where the statistics are written
+void refmem_stats(refmem_stats_t *stats);
+
+/// @brief Starts a sampling heap profile, dropping the one taken before. Every interval bytes
+/// allocated on average, the allocation is sampled: its call stack is recorded, and it is counted as
+/// the interval bytes it stands for, or its own size if that is larger. Setting the environment
+/// variable REFMEM_PROFILE to a file name starts a profile at the first allocation, and writes it
+/// there on shutdown, REFMEM_PROFILE_INTERVAL sets its interval.
+/// @param interval the average number of bytes between samples, 0 for 512 KiB
+void refmem_profile_start(size_t interval);
+
+/// @brief Stops sampling and drops the profile
+void refmem_profile_stop();
+
+/// @brief Writes the allocated and freed totals of every call stack sampled so far to a file, see
+/// tools/heap_report.c. Link the program with -rdynamic to get the names of its functions.
+/// @param path the file to write
+/// @return true if the file was written
+bool refmem_profile_write(const char *path);
+
+/// @brief Writes the events this thread has logged so far to the trace file, see trace.h. Does
+/// nothing unless refmem is built with REFMEM_TRACE.
+void refmem_trace_flush();
+
+/// @brief Frees the reference cycles that can no longer be reached, using trial deletion.
+/// Objects released to a non-zero count are remembered as possible roots of a cycle; from them
+/// the references inside each subgraph are subtracted, and what is left with a count of zero
+/// is garbage. References are found like the default destructor finds them, or through the type
+/// descriptor of objects from allocate_typed, so only cycles made of objects without a destructor
+/// of their own are found. Does nothing when built with REFMEM_THREAD_SAFE.
+/// @return the number of objects freed
+size_t collect_cycles();
+
+/// @brief Sets how many possible roots of a cycle are remembered before allocate runs collect_cycles
+/// @param roots the number of possible roots, 0 to only collect cycles when collect_cycles is called
+void set_cycle_threshold(size_t roots);
+
+/// @brief Returns the number of possible roots that makes allocate run collect_cycles
+/// @return the threshold set by set_cycle_threshold, 10000 by default
+size_t get_cycle_threshold();
+
 /// @brief Deallocates all pointers left in the queue
 void cleanup();
 
 /// @brief Removes all allocated memory from the program
-void shutdown();
\ No newline at end of file
+void shutdown();
+
+#define REFMEM_TEARDOWN_SKIP_DESTRUCTORS 0x1 ///< objects waiting to be freed are dropped without running their destructors
+#define REFMEM_TEARDOWN_REPORT_LEAKS 0x2     ///< refmem_leak_report is written to stderr before anything is freed
+
+/// @brief Frees all memory of refmem at once for a process that is about to exit, including the
+/// objects that are still referenced. Slabs, arena chunks and large objects are returned whole,
+/// without looking up objects one by one or running their destructors, so it takes time in
+/// proportion to the number of slabs and large objects rather than to the number of objects.
+/// Arenas that are not destroyed are freed too, and a heap opened with refmem_heap_open is closed first. Nothing allocated before may be used
+/// afterwards, and no other thread may use refmem at the same time.
+/// @param options REFMEM_TEARDOWN_SKIP_DESTRUCTORS and REFMEM_TEARDOWN_REPORT_LEAKS, or 0 to run the
+/// destructors of the objects waiting to be freed first, like shutdown
+void refmem_teardown(unsigned options);
+
+/// @brief Writes the objects still allocated by this thread, or in large objects and arenas by any
+/// thread, grouped by size class and destructor with the largest groups first. Objects waiting to
+/// be freed are left out, and so are those in a heap opened with refmem_heap_open.
+/// @param out where to write the report
+/// @return the number of objects in the report
+size_t refmem_leak_report(FILE *out);
\ No newline at end of file
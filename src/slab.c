@@ -0,0 +1,488 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "slab.h"
+#include "page_map.h"
+#include "sync.h"
+
+#define SIZE_CLASSES (SLAB_MAX_SLOT / SLAB_GRANULE)
+#define MAX_SLOTS (SLAB_SIZE / SLAB_GRANULE)
+#define BITMAP_WORD_BITS (sizeof(uint64_t) * 8)
+#define REMOTE_BATCH_SIZE 64
+
+_Static_assert(SLAB_SIZE == PAGE_MAP_PAGE_SIZE, "every slab must be exactly one page of the page map");
+
+typedef struct slab slab_t;
+typedef struct slab_heap slab_heap_t;
+
+struct slab
+{
+    slab_t *prev;        // neighbours in the size class' list of slabs with free slots
+    slab_t *next;
+    slab_t *heap_prev;   // neighbours in the list of every slab of the heap, full ones included
+    slab_t *heap_next;
+    slab_heap_t *owner;  // the heap whose thread hands out and frees the slots
+    void *free_list;     // slots that have been freed, linked through their first word
+    char *unused;        // start of the slots that have never been handed out
+    size_t slot_size;
+    size_t used;
+    size_t capacity;
+    bool in_partial_list;
+    // one bit per slot that is handed out, only written by the owner but read by every thread
+    _Atomic uint64_t in_use[MAX_SLOTS / BITMAP_WORD_BITS];
+};
+
+typedef struct
+{
+    slab_t *partial; // slabs with at least one free slot
+    size_t slabs;
+} size_class_t;
+
+struct slab_heap
+{
+    size_class_t size_classes[SIZE_CLASSES];
+    slab_t *all; // every slab of the heap, so that they can be released without looking at their slots
+    size_t slabs;
+    _Atomic(void *) remote_frees; // slots freed by other threads, linked through their first word
+    slab_heap_t *next_abandoned;
+};
+
+// slots freed by this thread that belong to another thread's heap, handed over together
+typedef struct
+{
+    slab_heap_t *owner;
+    void *first;
+    void *last;
+    size_t count;
+} remote_batch_t;
+
+static THREAD_LOCAL slab_heap_t *heap = NULL;
+static THREAD_LOCAL remote_batch_t remote_batch;
+
+// heaps of threads that have exited, taken over by the next thread that needs a heap
+static slab_heap_t *abandoned_heaps = NULL;
+static sync_lock_t abandoned_lock = SYNC_LOCK_INITIALIZER;
+
+static slab_heap_t *current_heap()
+{
+    if (heap != NULL)
+    {
+        return heap;
+    }
+
+    sync_lock(&abandoned_lock);
+    if (abandoned_heaps != NULL)
+    {
+        heap = abandoned_heaps;
+        abandoned_heaps = heap->next_abandoned;
+        heap->next_abandoned = NULL;
+    }
+    sync_unlock(&abandoned_lock);
+
+    if (heap == NULL)
+    {
+        heap = calloc(1, sizeof(slab_heap_t));
+    }
+
+    return heap;
+}
+
+static size_t size_class_index(size_t bytes)
+{
+    return bytes == 0 ? 0 : (bytes - 1) / SLAB_GRANULE;
+}
+
+static slab_t *slab_of(void *slot)
+{
+    return (slab_t *)((uintptr_t)slot & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+static size_t slots_offset()
+{
+    return (sizeof(slab_t) + SLAB_GRANULE - 1) / SLAB_GRANULE * SLAB_GRANULE;
+}
+
+static size_t slot_index(slab_t *slab, void *slot)
+{
+    return ((char *)slot - ((char *)slab + slots_offset())) / slab->slot_size;
+}
+
+static void mark_in_use(slab_t *slab, size_t index, bool in_use)
+{
+    _Atomic uint64_t *word = &slab->in_use[index / BITMAP_WORD_BITS];
+    uint64_t bit = (uint64_t)1 << (index % BITMAP_WORD_BITS);
+    uint64_t bits = atomic_load_explicit(word, memory_order_relaxed);
+
+    // only the owner writes the bitmap, so a plain store is enough
+    atomic_store_explicit(word, in_use ? bits | bit : bits & ~bit, memory_order_relaxed);
+}
+
+static void partial_push(size_class_t *size_class, slab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = size_class->partial;
+    if (size_class->partial != NULL)
+    {
+        size_class->partial->prev = slab;
+    }
+    size_class->partial = slab;
+    slab->in_partial_list = true;
+}
+
+static void partial_unlink(size_class_t *size_class, slab_t *slab)
+{
+    if (slab->prev != NULL)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        size_class->partial = slab->next;
+    }
+    if (slab->next != NULL)
+    {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = slab->next = NULL;
+    slab->in_partial_list = false;
+}
+
+static slab_t *slab_create(slab_heap_t *heap, size_t slot_size)
+{
+    slab_t *slab = aligned_alloc(SLAB_SIZE, SLAB_SIZE);
+    if (slab == NULL)
+    {
+        return NULL;
+    }
+
+    slab->prev = slab->next = NULL;
+    slab->owner = heap;
+    slab->free_list = NULL;
+    slab->unused = (char *)slab + slots_offset();
+    slab->slot_size = slot_size;
+    slab->used = 0;
+    slab->capacity = (SLAB_SIZE - slots_offset()) / slot_size;
+    slab->in_partial_list = false;
+    for (size_t i = 0; i < MAX_SLOTS / BITMAP_WORD_BITS; i++)
+    {
+        atomic_init(&slab->in_use[i], 0);
+    }
+
+    slab->heap_prev = NULL;
+    slab->heap_next = heap->all;
+    if (heap->all != NULL)
+    {
+        heap->all->heap_prev = slab;
+    }
+    heap->all = slab;
+
+    page_map_set(slab, true);
+    heap->slabs++;
+
+    return slab;
+}
+
+static void slab_destroy(slab_heap_t *heap, size_class_t *size_class, slab_t *slab)
+{
+    partial_unlink(size_class, slab);
+    size_class->slabs--;
+    if (slab->heap_prev != NULL)
+    {
+        slab->heap_prev->heap_next = slab->heap_next;
+    }
+    else
+    {
+        heap->all = slab->heap_next;
+    }
+    if (slab->heap_next != NULL)
+    {
+        slab->heap_next->heap_prev = slab->heap_prev;
+    }
+    page_map_set(slab, false);
+    heap->slabs--;
+    free(slab);
+}
+
+static void local_free(slab_heap_t *heap, slab_t *slab, void *slot)
+{
+    size_class_t *size_class = &heap->size_classes[size_class_index(slab->slot_size)];
+
+    *(void **)slot = slab->free_list;
+    slab->free_list = slot;
+    slab->used--;
+    mark_in_use(slab, slot_index(slab, slot), false);
+
+    if (!slab->in_partial_list)
+    {
+        partial_push(size_class, slab);
+    }
+    // other threads may be classifying words that point into an empty slab, so with
+    // threads enabled empty slabs are only returned to the system by slab_trim
+    else if (slab->used == 0 && size_class->slabs > 1 && !SYNC_THREAD_SAFE)
+    {
+        slab_destroy(heap, size_class, slab);
+    }
+}
+
+static void remote_batch_flush()
+{
+    if (remote_batch.count == 0)
+    {
+        return;
+    }
+
+    slab_heap_t *owner = remote_batch.owner;
+    void *head = atomic_load_explicit(&owner->remote_frees, memory_order_relaxed);
+
+    do
+    {
+        *(void **)remote_batch.last = head;
+    } while (!atomic_compare_exchange_weak_explicit(&owner->remote_frees, &head, remote_batch.first,
+                                                    memory_order_release, memory_order_relaxed));
+
+    remote_batch = (remote_batch_t){0};
+}
+
+static void remote_free(slab_t *slab, void *slot)
+{
+    if (remote_batch.owner != slab->owner)
+    {
+        remote_batch_flush();
+        remote_batch.owner = slab->owner;
+    }
+
+    *(void **)slot = remote_batch.first;
+    if (remote_batch.first == NULL)
+    {
+        remote_batch.last = slot;
+    }
+    remote_batch.first = slot;
+    remote_batch.count++;
+
+    if (remote_batch.count == REMOTE_BATCH_SIZE)
+    {
+        remote_batch_flush();
+    }
+}
+
+static void drain_remote_frees(slab_heap_t *heap)
+{
+    if (atomic_load_explicit(&heap->remote_frees, memory_order_relaxed) == NULL)
+    {
+        return;
+    }
+
+    void *slot = atomic_exchange_explicit(&heap->remote_frees, NULL, memory_order_acquire);
+
+    while (slot != NULL)
+    {
+        void *next = *(void **)slot;
+        local_free(heap, slab_of(slot), slot);
+        slot = next;
+    }
+}
+
+void *slab_allocate(size_t bytes)
+{
+    slab_heap_t *heap = current_heap();
+    drain_remote_frees(heap);
+
+    size_class_t *size_class = &heap->size_classes[size_class_index(bytes)];
+    slab_t *slab = size_class->partial;
+
+    if (slab == NULL)
+    {
+        slab = slab_create(heap, (size_class_index(bytes) + 1) * SLAB_GRANULE);
+        if (slab == NULL)
+        {
+            return NULL;
+        }
+        size_class->slabs++;
+        partial_push(size_class, slab);
+    }
+
+    void *slot;
+    if (slab->free_list != NULL)
+    {
+        slot = slab->free_list;
+        slab->free_list = *(void **)slot;
+    }
+    else
+    {
+        // slabs are carved lazily so that untouched slots never become resident
+        slot = slab->unused;
+        slab->unused += slab->slot_size;
+    }
+
+    slab->used++;
+    mark_in_use(slab, slot_index(slab, slot), true);
+    if (slab->used == slab->capacity)
+    {
+        partial_unlink(size_class, slab);
+    }
+
+    memset(slot, 0, slab->slot_size);
+    return slot;
+}
+
+void slab_free(void *slot)
+{
+    slab_t *slab = slab_of(slot);
+    slab_heap_t *heap = current_heap();
+
+    if (slab->owner != heap)
+    {
+        remote_free(slab, slot);
+    }
+    else
+    {
+        local_free(heap, slab, slot);
+    }
+}
+
+size_t slab_slot_size(void *slot)
+{
+    return slab_of(slot)->slot_size;
+}
+
+void slab_flush()
+{
+    remote_batch_flush();
+    if (heap != NULL)
+    {
+        drain_remote_frees(heap);
+    }
+}
+
+void slab_trim()
+{
+    slab_flush();
+    if (heap == NULL)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < SIZE_CLASSES; i++)
+    {
+        size_class_t *size_class = &heap->size_classes[i];
+        slab_t *slab = size_class->partial;
+
+        while (slab != NULL)
+        {
+            slab_t *next = slab->next;
+            if (slab->used == 0)
+            {
+                slab_destroy(heap, size_class, slab);
+            }
+            slab = next;
+        }
+    }
+
+    // with threads enabled other heaps may still be using the page map
+    if (heap->slabs == 0 && !SYNC_THREAD_SAFE)
+    {
+        page_map_clear();
+        free(heap);
+        heap = NULL;
+    }
+}
+
+void slab_for_each_slot(void (*visit)(void *slot, void *context), void *context)
+{
+    slab_flush();
+    if (heap == NULL)
+    {
+        return;
+    }
+
+    for (slab_t *slab = heap->all; slab != NULL; slab = slab->heap_next)
+    {
+        char *slots = (char *)slab + slots_offset();
+
+        for (size_t i = 0; i < MAX_SLOTS / BITMAP_WORD_BITS; i++)
+        {
+            uint64_t bits = atomic_load_explicit(&slab->in_use[i], memory_order_relaxed);
+
+            while (bits != 0)
+            {
+                size_t index = i * BITMAP_WORD_BITS + __builtin_ctzll(bits);
+                bits &= bits - 1;
+                visit(slots + index * slab->slot_size, context);
+            }
+        }
+    }
+}
+
+void slab_release_all()
+{
+    remote_batch_flush();
+    if (heap == NULL)
+    {
+        return;
+    }
+
+    slab_t *slab = heap->all;
+    while (slab != NULL)
+    {
+        slab_t *next = slab->heap_next;
+        // with threads enabled other heaps keep their pages in the map
+        if (SYNC_THREAD_SAFE)
+        {
+            page_map_set(slab, false);
+        }
+        free(slab);
+        slab = next;
+    }
+
+    if (!SYNC_THREAD_SAFE)
+    {
+        page_map_clear();
+    }
+    free(heap);
+    heap = NULL;
+}
+
+void slab_thread_exit()
+{
+    slab_flush();
+    if (heap == NULL)
+    {
+        return;
+    }
+
+    sync_lock(&abandoned_lock);
+    heap->next_abandoned = abandoned_heaps;
+    abandoned_heaps = heap;
+    sync_unlock(&abandoned_lock);
+
+    heap = NULL;
+}
+
+bool slab_contains(void *ptr)
+{
+    return page_map_get(ptr);
+}
+
+bool slab_slot_in_use(void *ptr)
+{
+    slab_t *slab = slab_of(ptr);
+    char *slots = (char *)slab + slots_offset();
+
+    if ((char *)ptr < slots)
+    {
+        return false;
+    }
+
+    size_t offset = (char *)ptr - slots;
+    size_t index = offset / slab->slot_size;
+
+    if (offset % slab->slot_size != 0 || index >= slab->capacity)
+    {
+        return false;
+    }
+
+    uint64_t bits = atomic_load_explicit(&slab->in_use[index / BITMAP_WORD_BITS], memory_order_relaxed);
+    return (bits >> (index % BITMAP_WORD_BITS)) & 1;
+}
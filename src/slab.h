@@ -0,0 +1,75 @@
+#pragma once
+#include <stdlib.h>
+#include <stdbool.h>
+
+/**
+ * @file slab.h
+ * @brief A size-class slab allocator used by refmem for small objects.
+ *
+ * Memory is taken from the system in aligned slabs of SLAB_SIZE bytes. Every slab is
+ * cut into equally sized slots of one size class, and free slots are linked together
+ * through their own first word (an intrusive free list), so allocating and freeing a
+ * slot is O(1) and does not call malloc. A slab that becomes completely empty is
+ * returned to the system unless it is the last slab of its size class.
+ *
+ * Since slabs are aligned to their size, the slab owning a slot is found by masking
+ * the low bits of the slot address. Every slab is registered in the page map and keeps
+ * a bitmap of the slots in use, so an arbitrary word can be classified as a slot start
+ * with a page lookup, a division and a bit test.
+ *
+ * When refmem is built with REFMEM_THREAD_SAFE (see sync.h) every thread allocates
+ * from its own heap of slabs without locking. A slot freed by another thread than
+ * the one owning its slab is collected in a per-thread batch, and full batches are
+ * pushed onto a lock-free list of the owning heap, which takes them back the next
+ * time it allocates. The heap of a thread that exits is taken over by the next new
+ * thread. Empty slabs are only returned to the system by slab_trim in this mode.
+*/
+
+#define SLAB_SIZE ((size_t)1 << 16)
+#define SLAB_GRANULE 16
+#define SLAB_MAX_SLOT 272
+
+/// @brief Allocates a zero-filled slot of at least the given size
+/// @param bytes the number of bytes needed, at most SLAB_MAX_SLOT
+/// @return a zero-filled slot aligned to SLAB_GRANULE bytes
+void *slab_allocate(size_t bytes);
+
+/// @brief Returns a slot to its slab
+/// @param slot a slot returned by slab_allocate
+void slab_free(void *slot);
+
+/// @brief Returns the usable size of a slot, i.e. the size of its size class
+/// @param slot a slot returned by slab_allocate
+/// @return the size of the slot in bytes
+size_t slab_slot_size(void *slot);
+
+/// @brief Tests whether an address lies inside one of the slabs
+/// @param ptr any address
+/// @return true if ptr points into a slab, else false
+bool slab_contains(void *ptr);
+
+/// @brief Tests whether an address inside a slab is the start of a slot that is handed out
+/// @param ptr an address for which slab_contains is true
+/// @return true if ptr is the start of a slot in use, else false
+bool slab_slot_in_use(void *ptr);
+
+/// @brief Hands over the slots this thread has freed for other heaps, and takes back
+/// the slots other threads have freed for this thread's heap
+void slab_flush();
+
+/// @brief Returns all completely empty slabs of this thread's heap to the system,
+/// including the last slab of each size class
+void slab_trim();
+
+/// @brief Calls a function for every slot of this thread's heap that is handed out
+/// @param visit the function, given the slot and the context
+/// @param context passed on to visit
+void slab_for_each_slot(void (*visit)(void *slot, void *context), void *context);
+
+/// @brief Returns every slab of this thread's heap to the system at once, including the
+/// slots still in use, which must not be touched afterwards
+void slab_release_all();
+
+/// @brief Flushes this thread's frees and leaves its heap to be taken over by another thread,
+/// to be called when a thread that has used the allocator exits
+void slab_thread_exit();
@@ -0,0 +1,36 @@
+#pragma once
+
+/**
+ * @file sync.h
+ * @brief Helpers that make refmem thread safe when it is built with REFMEM_THREAD_SAFE.
+ *
+ * Without REFMEM_THREAD_SAFE all state is process global, the locks compile to
+ * nothing and refmem must only be used from one thread. With it, every thread gets
+ * its own copy of the THREAD_LOCAL state (its free queue and slab heap) and the
+ * state shared between threads is guarded by the locks below. Programs built this
+ * way must be compiled and linked with -pthread.
+*/
+
+#ifdef REFMEM_THREAD_SAFE
+
+#include <pthread.h>
+
+#define THREAD_LOCAL _Thread_local
+#define SYNC_THREAD_SAFE 1
+
+typedef pthread_mutex_t sync_lock_t;
+#define SYNC_LOCK_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define sync_lock(lock) pthread_mutex_lock(lock)
+#define sync_unlock(lock) pthread_mutex_unlock(lock)
+
+#else
+
+#define THREAD_LOCAL
+#define SYNC_THREAD_SAFE 0
+
+typedef int sync_lock_t;
+#define SYNC_LOCK_INITIALIZER 0
+#define sync_lock(lock) ((void)(lock))
+#define sync_unlock(lock) ((void)(lock))
+
+#endif
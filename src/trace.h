@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * @file trace.h
+ * @brief The binary event trace that refmem writes when it is built with REFMEM_TRACE.
+ *
+ * Every thread logs its events into a buffer of its own, without locking, and appends the
+ * buffer to the trace file as one block when it is full, on refmem_trace_flush, on shutdown
+ * and when the thread exits. The file starts with TRACE_MAGIC, followed by the blocks. Each
+ * block is a trace_block_t followed by its events. Blocks of different threads interleave, so
+ * a reader sorts the events by their time. The file is REFMEM_TRACE_FILE, or refmem.trace if
+ * that is not set. Without REFMEM_TRACE nothing is logged and the hooks compile to nothing.
+ *
+ * Every allocate event is followed in its block by a TRACE_SIZE record, which is not an event:
+ * its time_ns holds the bytes asked for, and its object field the destructor slot and the
+ * TRACE_ATTRIBUTE_ bits of the object. With them the trace is a recording of the program's
+ * use of the heap, which tools/trace_replay.c plays back against refmem or another allocator.
+ * See tools/trace_decode.c for a reader that reports on lifetimes.
+*/
+
+#define TRACE_MAGIC "RMTRACE2"
+#define TRACE_MAGIC_SIZE 8
+#define TRACE_KIND_MASK 0x7 // objects are aligned to 8 bytes, the kind goes in the low bits
+
+// the object field of a TRACE_SIZE record
+#define TRACE_ATTRIBUTE_SHIFT 3
+#define TRACE_DESTRUCTOR_SHIFT 32 // the slot in refmem's destructor table, 0 is the default destructor
+#define TRACE_ATTRIBUTES(record) ((record).object >> TRACE_ATTRIBUTE_SHIFT & 0xff)
+#define TRACE_DESTRUCTOR(record) ((uint32_t)((record).object >> TRACE_DESTRUCTOR_SHIFT))
+
+#define TRACE_ATTRIBUTE_ATOMIC 0x1 // allocate_atomic, the object holds no pointers
+#define TRACE_ATTRIBUTE_TYPED 0x2  // allocate_typed, the destructor slot holds its type
+#define TRACE_ATTRIBUTE_ARENA 0x4  // arena_allocate
+
+typedef enum
+{
+    TRACE_ALLOCATE,
+    TRACE_RETAIN,
+    TRACE_RELEASE,
+    TRACE_ENQUEUE,    // the count reached zero and the object was put in the free queue
+    TRACE_DEALLOCATE, // the memory of the object was freed
+    TRACE_SIZE,       // describes the allocate event before it
+    TRACE_KINDS
+} trace_kind_t;
+
+typedef struct
+{
+    uint64_t time_ns; // CLOCK_MONOTONIC
+    uint64_t object;  // the address of the object, or-ed with its trace_kind_t
+} trace_event_t;
+
+typedef struct
+{
+    uint32_t thread; // the id of the thread in the thread safe build, 0 otherwise
+    uint32_t events; // the number of trace_event_t that follow
+} trace_block_t;
@@ -0,0 +1,203 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/refmem.h"
+
+/**
+ * @file arena_test.c
+ * @brief Tests for objects allocated from an arena, and how they mix with the rest of the heap.
+*/
+
+#define MANY_OBJECTS 10000
+
+struct pair
+{
+    obj *first;
+    obj *second;
+};
+
+static int destroyed = 0;
+
+int init_suite(void)
+{
+    return 0;
+}
+
+int clean_suite(void)
+{
+    shutdown();
+    return 0;
+}
+
+static void count_destructor(obj *object)
+{
+    destroyed++;
+}
+
+void destroy_frees_unreferenced_objects_test()
+{
+    refmem_arena_t *arena = arena_create();
+    destroyed = 0;
+
+    for (int i = 0; i < MANY_OBJECTS; i++)
+    {
+        int *number = arena_allocate(arena, sizeof(int), count_destructor);
+        *number = i;
+        // released objects stay until the arena is destroyed
+        retain(number);
+        release(number);
+    }
+    CU_ASSERT_EQUAL(destroyed, 0);
+
+    arena_destroy(arena);
+    CU_ASSERT_EQUAL(destroyed, MANY_OBJECTS);
+}
+
+void objects_are_aligned_and_zeroed_test()
+{
+    refmem_arena_t *arena = arena_create();
+
+    for (size_t bytes = 1; bytes < 100; bytes++)
+    {
+        char *object = arena_allocate(arena, bytes, NULL);
+        CU_ASSERT_EQUAL((uintptr_t)object % sizeof(void *), 0);
+        bool zeroed = true;
+        for (size_t i = 0; i < bytes; i++)
+        {
+            zeroed = zeroed && object[i] == 0;
+        }
+        CU_ASSERT_TRUE(zeroed);
+        memset(object, 0xff, bytes);
+    }
+
+    arena_destroy(arena);
+}
+
+void default_destructor_releases_children_test()
+{
+    refmem_arena_t *arena = arena_create();
+    destroyed = 0;
+
+    // one child in the arena, one on the heap
+    struct pair *pair = arena_allocate(arena, sizeof(struct pair), NULL);
+    pair->first = arena_allocate(arena, sizeof(int), count_destructor);
+    retain(pair->first);
+    pair->second = allocate(sizeof(int), count_destructor);
+    retain(pair->second);
+
+    arena_destroy(arena);
+    cleanup();
+    CU_ASSERT_EQUAL(destroyed, 2);
+}
+
+void retained_object_escapes_test()
+{
+    refmem_arena_t *arena = arena_create();
+    destroyed = 0;
+
+    obj *kept = arena_allocate(arena, sizeof(int), count_destructor);
+    retain(kept);
+    for (int i = 0; i < MANY_OBJECTS; i++)
+    {
+        arena_allocate(arena, 64, count_destructor);
+    }
+
+    arena_destroy(arena);
+    CU_ASSERT_EQUAL(destroyed, MANY_OBJECTS);
+    CU_ASSERT_EQUAL(rc(kept), 1);
+
+    // once it has escaped it is freed like any other object
+    release(kept);
+    cleanup();
+    CU_ASSERT_EQUAL(destroyed, MANY_OBJECTS + 1);
+}
+
+void heap_object_holds_arena_object_test()
+{
+    refmem_arena_t *arena = arena_create();
+    destroyed = 0;
+
+    struct pair *pair = allocate(sizeof(struct pair), NULL);
+    retain(pair);
+    pair->first = arena_allocate(arena, sizeof(int), count_destructor);
+    retain(pair->first);
+
+    arena_destroy(arena);
+    CU_ASSERT_EQUAL(destroyed, 0);
+
+    release(pair);
+    cleanup();
+    CU_ASSERT_EQUAL(destroyed, 1);
+}
+
+void large_object_test()
+{
+    refmem_arena_t *arena = arena_create();
+    destroyed = 0;
+
+    char *large = arena_allocate(arena, 100000, count_destructor);
+    memset(large, 1, 100000);
+    char *small = arena_allocate(arena, 8, count_destructor);
+    memset(small, 1, 8);
+
+    arena_destroy(arena);
+    cleanup();
+    CU_ASSERT_EQUAL(destroyed, 2);
+}
+
+void atomic_objects_are_not_scanned_test()
+{
+    refmem_arena_t *arena = arena_create();
+    obj *object = allocate(sizeof(int), NULL);
+    retain(object);
+
+    // words that look like references are left alone, in chunks and in large objects alike
+    obj **small = arena_allocate_atomic(arena, sizeof(obj *));
+    obj **large = arena_allocate_atomic(arena, 100000);
+    small[0] = object;
+    large[0] = object;
+
+    arena_destroy(arena);
+    cleanup();
+    CU_ASSERT_EQUAL(rc(object), 1);
+    release(object);
+}
+
+int main()
+{
+    if (CU_initialize_registry() != CUE_SUCCESS)
+        return CU_get_error();
+
+    CU_pSuite my_test_suite = CU_add_suite("Tests for arenas in refmem.c", init_suite, clean_suite);
+    if (my_test_suite == NULL)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if (
+        (CU_add_test(my_test_suite, "destroy frees unreferenced objects", destroy_frees_unreferenced_objects_test) == NULL ||
+        CU_add_test(my_test_suite, "objects are aligned and zeroed", objects_are_aligned_and_zeroed_test) == NULL ||
+        CU_add_test(my_test_suite, "the default destructor releases children", default_destructor_releases_children_test) == NULL ||
+        CU_add_test(my_test_suite, "a retained object escapes the arena", retained_object_escapes_test) == NULL ||
+        CU_add_test(my_test_suite, "a heap object holds an arena object", heap_object_holds_arena_object_test) == NULL ||
+        CU_add_test(my_test_suite, "objects too large for a chunk", large_object_test) == NULL ||
+        CU_add_test(my_test_suite, "atomic objects are not scanned", atomic_objects_are_not_scanned_test) == NULL
+        )
+    )
+
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    CU_basic_run_tests();
+
+    CU_cleanup_registry();
+    return CU_get_error();
+}
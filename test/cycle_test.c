@@ -0,0 +1,297 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "../src/refmem.h"
+
+#define LONG_LIST 10000
+
+struct pair
+{
+    obj *first;
+    obj *second;
+};
+
+// a doubly linked node, as in a cart list with back pointers
+struct link
+{
+    struct link *next;
+    struct link *prev;
+};
+
+REFMEM_DECLARE_TYPE(link_type, struct link, REFMEM_FIELD(struct link, next) | REFMEM_FIELD(struct link, prev), 0);
+
+static int destroyed = 0;
+
+int init_suite(void)
+{
+    return 0;
+}
+
+int clean_suite(void)
+{
+    return 0;
+}
+
+static void count_destructor(obj *object)
+{
+    destroyed++;
+}
+
+static obj *counted_object()
+{
+    obj *object = allocate(sizeof(int), count_destructor);
+    retain(object);
+    return object;
+}
+
+// objects freed so far, the collector counts its garbage like deallocate does
+static uint64_t deallocated()
+{
+    refmem_stats_t stats;
+    refmem_stats(&stats);
+    return stats.deallocate_calls;
+}
+
+static struct pair *pair_create()
+{
+    struct pair *pair = allocate(sizeof(struct pair), NULL);
+    retain(pair);
+    return pair;
+}
+
+void two_object_cycle_test()
+{
+    destroyed = 0;
+    struct pair *a = pair_create();
+    struct pair *b = pair_create();
+
+    a->first = b;
+    retain(b);
+    b->first = a;
+    retain(a);
+    a->second = counted_object();
+
+    release(a);
+    release(b);
+    CU_ASSERT_EQUAL(rc(a), 1);
+    CU_ASSERT_EQUAL(rc(b), 1);
+
+    // the counted object is only referred to by the cycle, so it is garbage as well
+    uint64_t before = deallocated();
+    CU_ASSERT_EQUAL(collect_cycles(), 3);
+    CU_ASSERT_EQUAL(destroyed, 1);
+    CU_ASSERT_EQUAL(deallocated() - before, 3);
+
+    shutdown();
+}
+
+void self_cycle_test()
+{
+    struct pair *a = pair_create();
+    a->first = a;
+    retain(a);
+
+    release(a);
+    CU_ASSERT_EQUAL(collect_cycles(), 1);
+
+    shutdown();
+}
+
+void reachable_cycle_test()
+{
+    destroyed = 0;
+    struct pair *holder = pair_create();
+    struct pair *a = pair_create();
+    struct pair *b = pair_create();
+
+    a->first = b;
+    retain(b);
+    b->first = a;
+    retain(a);
+    holder->first = a;
+    retain(a);
+
+    release(a);
+    release(b);
+
+    // the holder still refers to the cycle, so nothing is freed and the counts are restored
+    uint64_t before = deallocated();
+    CU_ASSERT_EQUAL(collect_cycles(), 0);
+    CU_ASSERT_EQUAL(deallocated(), before);
+    CU_ASSERT_EQUAL(rc(a), 2);
+    CU_ASSERT_EQUAL(rc(b), 1);
+
+    // once the holder is gone the cycle is garbage
+    release(holder);
+    cleanup();
+    before = deallocated();
+    CU_ASSERT_EQUAL(collect_cycles(), 2);
+    CU_ASSERT_EQUAL(deallocated() - before, 2);
+
+    shutdown();
+}
+
+void shared_child_test()
+{
+    destroyed = 0;
+    struct pair *a = pair_create();
+    struct pair *b = pair_create();
+    obj *child = counted_object();
+
+    a->first = b;
+    retain(b);
+    b->first = a;
+    retain(a);
+    a->second = child;
+    retain(child);
+
+    release(a);
+    release(b);
+    CU_ASSERT_EQUAL(collect_cycles(), 2);
+    cleanup();
+
+    // the cycle released its reference, the one held here is left
+    CU_ASSERT_EQUAL(rc(child), 1);
+    CU_ASSERT_EQUAL(destroyed, 0);
+
+    release(child);
+    cleanup();
+    CU_ASSERT_EQUAL(destroyed, 1);
+
+    shutdown();
+}
+
+void opaque_cycle_test()
+{
+    destroyed = 0;
+    struct pair *a = pair_create();
+    struct pair *b = allocate(sizeof(struct pair), count_destructor);
+    retain(b);
+
+    a->first = b;
+    retain(b);
+    b->first = a;
+    retain(a);
+
+    release(a);
+    release(b);
+
+    // b has a destructor of its own, so its reference to a is assumed to be from outside
+    CU_ASSERT_EQUAL(collect_cycles(), 0);
+    CU_ASSERT_EQUAL(rc(a), 1);
+    CU_ASSERT_EQUAL(rc(b), 1);
+
+    shutdown();
+}
+
+void long_doubly_linked_list_test()
+{
+    destroyed = 0;
+    struct link *head = allocate(sizeof(struct link), NULL);
+    retain(head);
+    struct link *last = head;
+
+    for (int i = 1; i < LONG_LIST; i++)
+    {
+        struct link *link = allocate(sizeof(struct link), NULL);
+        last->next = link;
+        retain(link);
+        link->prev = last;
+        retain(last);
+        last = link;
+    }
+
+    release(head);
+    uint64_t before = deallocated();
+    CU_ASSERT_EQUAL(collect_cycles(), LONG_LIST);
+    CU_ASSERT_EQUAL(deallocated() - before, LONG_LIST);
+
+    shutdown();
+}
+
+void typed_cycle_test()
+{
+    struct link *a = allocate_typed(&link_type);
+    struct link *b = allocate_typed(&link_type);
+    retain(a);
+    retain(b);
+
+    a->next = b;
+    retain(b);
+    b->prev = a;
+    retain(a);
+
+    release(a);
+    release(b);
+
+    // the descriptor tells the collector where the references are
+    CU_ASSERT_EQUAL(collect_cycles(), 2);
+
+    shutdown();
+}
+
+void threshold_test()
+{
+    destroyed = 0;
+    set_cycle_threshold(10);
+    CU_ASSERT_EQUAL(get_cycle_threshold(), 10);
+
+    for (int i = 0; i < 100; i++)
+    {
+        struct pair *a = pair_create();
+        a->first = a;
+        retain(a);
+        a->second = counted_object();
+        release(a);
+    }
+
+    // allocations collected every ten cycles, the last few are still waiting
+    cleanup();
+    CU_ASSERT_TRUE(destroyed >= 90);
+
+    collect_cycles();
+    cleanup();
+    CU_ASSERT_EQUAL(destroyed, 100);
+
+    set_cycle_threshold(10000);
+    shutdown();
+}
+
+int main()
+{
+    if (CU_initialize_registry() != CUE_SUCCESS)
+        return CU_get_error();
+
+    CU_pSuite my_test_suite = CU_add_suite("Tests for the cycle collector in refmem.c", init_suite, clean_suite);
+    if (my_test_suite == NULL)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if (
+        (CU_add_test(my_test_suite, "a cycle of two objects", two_object_cycle_test) == NULL ||
+        CU_add_test(my_test_suite, "an object referring to itself", self_cycle_test) == NULL ||
+        CU_add_test(my_test_suite, "a cycle referred to from outside", reachable_cycle_test) == NULL ||
+        CU_add_test(my_test_suite, "a cycle sharing a child", shared_child_test) == NULL ||
+        CU_add_test(my_test_suite, "a cycle through an object with a destructor", opaque_cycle_test) == NULL ||
+        CU_add_test(my_test_suite, "a long doubly linked list", long_doubly_linked_list_test) == NULL ||
+        CU_add_test(my_test_suite, "a cycle of typed objects", typed_cycle_test) == NULL ||
+        CU_add_test(my_test_suite, "collection triggered by allocate", threshold_test) == NULL
+        )
+    )
+
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    CU_basic_run_tests();
+
+    CU_cleanup_registry();
+    return CU_get_error();
+}
@@ -43,6 +43,114 @@ void test_default_destructor(void)
     //CU_ASSERT_EQUAL(rc(test_obj->internal_obj), 0);
 }
 
+void test_default_destructor_releases_fields(void)
+{
+    struct large_struct {
+        int numbers[100];
+        obj *small_obj;
+        obj *large_obj;
+        obj *interior_ptr;
+    };
+
+    struct large_struct *test_obj = allocate(sizeof(struct large_struct), NULL);
+    test_obj->numbers[0] = 42;
+    test_obj->small_obj = allocate(sizeof(int), NULL);
+    test_obj->large_obj = allocate(1000, NULL);
+    test_obj->interior_ptr = (char *)test_obj->small_obj + sizeof(int);
+
+    retain(test_obj->small_obj);
+    retain(test_obj->small_obj);
+    retain(test_obj->large_obj);
+    retain(test_obj->large_obj);
+
+    obj *small_obj = test_obj->small_obj;
+    obj *large_obj = test_obj->large_obj;
+    deallocate(test_obj);
+
+    // both fields are released once, the pointer into the middle of an object is not
+    CU_ASSERT_EQUAL(rc(small_obj), 1);
+    CU_ASSERT_EQUAL(rc(large_obj), 1);
+
+    release(small_obj);
+    release(large_obj);
+    shutdown();
+}
+
+struct typed_node {
+    struct typed_node *next;
+    long number;
+    obj *maybe;
+};
+
+REFMEM_DECLARE_TYPE(typed_node_type, struct typed_node,
+                    REFMEM_FIELD(struct typed_node, next), REFMEM_FIELD(struct typed_node, maybe));
+
+void test_typed_destructor_releases_described_fields(void)
+{
+    struct typed_node *first = allocate_typed(&typed_node_type);
+    struct typed_node *second = allocate_typed(&typed_node_type);
+    obj *other = allocate(sizeof(int), NULL);
+
+    retain(second);
+    retain(second);
+    retain(other);
+    retain(other);
+    first->next = second;
+    first->maybe = other;
+    // looks like an object, but is not described as a pointer so it is left alone
+    first->number = (long)other;
+
+    deallocate(first);
+    CU_ASSERT_EQUAL(rc(second), 1);
+    CU_ASSERT_EQUAL(rc(other), 1);
+
+    // a word that may hold an object is only released if it does
+    second->maybe = (char *)other + 1;
+    release(second);
+    cleanup();
+    CU_ASSERT_EQUAL(rc(other), 1);
+
+    release(other);
+    shutdown();
+}
+
+void test_typed_array_destructor(void)
+{
+    struct typed_node *nodes = allocate_array_typed(3, &typed_node_type);
+    obj *other = allocate(sizeof(int), NULL);
+
+    retain(other);
+    for (int i = 0; i < 3; i++)
+    {
+        retain(other);
+        nodes[i].maybe = other;
+    }
+
+    deallocate(nodes);
+    CU_ASSERT_EQUAL(rc(other), 1);
+
+    release(other);
+    shutdown();
+}
+
+void test_atomic_object_is_not_scanned(void)
+{
+    obj **words = allocate_array_atomic(2, sizeof(obj *));
+    obj *other = allocate(sizeof(int), NULL);
+
+    retain(other);
+    retain(other);
+    words[0] = other;
+    words[1] = other;
+
+    deallocate(words);
+    CU_ASSERT_EQUAL(rc(other), 2);
+
+    release(other);
+    release(other);
+    shutdown();
+}
+
 void test_string_destructor() {
     char *my_string = allocate(sizeof(char) * 255, *string_destructor);
     *my_string = "testingtesting123";
@@ -74,6 +182,10 @@ int main()
 
     if (
         (CU_add_test(my_test_suite, "Test default destructor", test_default_destructor) == NULL ||
+        CU_add_test(my_test_suite, "Test default destructor releases small and large fields", test_default_destructor_releases_fields) == NULL ||
+        CU_add_test(my_test_suite, "Test typed destructor releases the described fields", test_typed_destructor_releases_described_fields) == NULL ||
+        CU_add_test(my_test_suite, "Test typed destructor on every element of an array", test_typed_array_destructor) == NULL ||
+        CU_add_test(my_test_suite, "Test atomic objects are not scanned", test_atomic_object_is_not_scanned) == NULL ||
         CU_add_test(my_test_suite, "Test for string destructor", test_string_destructor) == NULL ||
         CU_add_test(my_test_suite, "Test for int destructor", test_int_destructor) == NULL
         )
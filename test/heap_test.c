@@ -0,0 +1,311 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../src/refmem.h"
+
+/**
+ * @file heap_test.c
+ * @brief Tests for the heap kept in a file, see refmem_heap_open.
+*/
+
+#define HEAP_CAPACITY ((size_t)16 << 20)
+
+struct pair
+{
+    obj *first;
+    obj *second;
+};
+
+static char heap_path[] = "/tmp/refmem_heapXXXXXX";
+static int destroyed = 0;
+
+int init_suite(void)
+{
+    return 0;
+}
+
+int clean_suite(void)
+{
+    shutdown();
+    remove(heap_path);
+    return 0;
+}
+
+// every test starts from an empty file of its own
+static char *new_heap_path()
+{
+    remove(heap_path);
+    strcpy(heap_path, "/tmp/refmem_heapXXXXXX");
+    int descriptor = mkstemp(heap_path);
+    CU_ASSERT_TRUE(descriptor >= 0);
+    close(descriptor);
+    return heap_path;
+}
+
+static void count_destructor(obj *object)
+{
+    destroyed++;
+}
+
+// a pair of a string and an array of numbers, retained by the root only
+static void make_root()
+{
+    struct pair *root = allocate(sizeof(struct pair), NULL);
+    int *numbers = allocate_array_atomic(100, sizeof(int));
+
+    for (int i = 0; i < 100; i++)
+    {
+        numbers[i] = i * i;
+    }
+    root->first = duplicate_string("kept in a file");
+    root->second = numbers;
+    retain(root->second);
+    refmem_heap_set_root(root);
+}
+
+void objects_survive_reopening_test()
+{
+    CU_ASSERT_TRUE(refmem_heap_open(new_heap_path(), HEAP_CAPACITY));
+    CU_ASSERT_PTR_NULL(refmem_heap_root());
+    make_root();
+    refmem_heap_close();
+    CU_ASSERT_PTR_NULL(refmem_heap_root());
+
+    CU_ASSERT_TRUE(refmem_heap_open(heap_path, 0));
+    struct pair *root = refmem_heap_root();
+    CU_ASSERT_PTR_NOT_NULL(root);
+    if (root != NULL)
+    {
+        CU_ASSERT_EQUAL(rc(root), 1);
+        CU_ASSERT_STRING_EQUAL(root->first, "kept in a file");
+        CU_ASSERT_EQUAL(((int *)root->second)[99], 99 * 99);
+    }
+}
+
+void heap_written_by_another_process_test()
+{
+    new_heap_path();
+    pid_t child = fork();
+    if (child == 0)
+    {
+        bool opened = refmem_heap_open(heap_path, HEAP_CAPACITY);
+        if (opened)
+        {
+            make_root();
+        }
+        refmem_heap_close();
+        _exit(opened ? 0 : 1);
+    }
+
+    int status;
+    waitpid(child, &status, 0);
+    CU_ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    CU_ASSERT_TRUE(refmem_heap_open(heap_path, 0));
+    struct pair *root = refmem_heap_root();
+    CU_ASSERT_PTR_NOT_NULL(root);
+    if (root != NULL)
+    {
+        CU_ASSERT_STRING_EQUAL(root->first, "kept in a file");
+    }
+}
+
+void destructors_survive_reopening_test()
+{
+    CU_ASSERT_TRUE(refmem_heap_open(new_heap_path(), HEAP_CAPACITY));
+    refmem_heap_set_root(allocate(sizeof(int), count_destructor));
+    refmem_heap_close();
+
+    destroyed = 0;
+    CU_ASSERT_TRUE(refmem_heap_open(heap_path, 0));
+    refmem_heap_set_root(NULL);
+    cleanup();
+    CU_ASSERT_EQUAL(destroyed, 1);
+}
+
+void reopened_objects_are_counted_and_scanned_test()
+{
+    CU_ASSERT_TRUE(refmem_heap_open(new_heap_path(), HEAP_CAPACITY));
+    make_root();
+    refmem_heap_close();
+
+    refmem_stats_t before;
+    refmem_stats_t opened;
+    refmem_stats_t freed;
+    refmem_stats(&before);
+    CU_ASSERT_TRUE(refmem_heap_open(heap_path, 0));
+    refmem_stats(&opened);
+    CU_ASSERT_EQUAL(opened.live_objects - before.live_objects, 3);
+
+    // the default destructor of the root finds the string and the numbers in the heap
+    refmem_heap_set_root(NULL);
+    cleanup();
+    refmem_stats(&freed);
+    CU_ASSERT_EQUAL(freed.live_objects, before.live_objects);
+}
+
+void freed_blocks_are_reused_test()
+{
+    CU_ASSERT_TRUE(refmem_heap_open(new_heap_path(), HEAP_CAPACITY));
+
+    char *first = allocate(48, NULL);
+    memset(first, 0xff, 48);
+    retain(first);
+    release(first);
+    cleanup();
+
+    char *second = allocate(48, NULL);
+    CU_ASSERT_PTR_EQUAL(first, second);
+    CU_ASSERT_EQUAL(second[47], 0);
+    deallocate(second);
+
+    obj *large = allocate(100000, NULL);
+    deallocate(large);
+    CU_ASSERT_PTR_EQUAL(allocate(100000, NULL), large);
+}
+
+void cycles_are_collected_on_close_test()
+{
+    CU_ASSERT_TRUE(refmem_heap_open(new_heap_path(), HEAP_CAPACITY));
+    struct pair *first = allocate(sizeof(struct pair), NULL);
+    struct pair *second = allocate(sizeof(struct pair), NULL);
+    first->first = second;
+    second->first = first;
+    retain(first);
+    retain(second);
+    // an outside reference that is dropped makes the cycle garbage
+    retain(first);
+    release(first);
+    refmem_heap_close();
+
+    refmem_stats_t before;
+    refmem_stats_t opened;
+    refmem_stats(&before);
+    CU_ASSERT_TRUE(refmem_heap_open(heap_path, 0));
+    refmem_stats(&opened);
+    CU_ASSERT_EQUAL(opened.live_objects, before.live_objects);
+}
+
+void cycle_roots_do_not_outlive_the_heap_test()
+{
+    CU_ASSERT_TRUE(refmem_heap_open(new_heap_path(), HEAP_CAPACITY));
+    struct pair *shared = allocate(sizeof(struct pair), NULL);
+    refmem_heap_set_root(shared);
+
+    // a garbage cycle whose members also hold the object the root holds
+    struct pair *first = allocate(sizeof(struct pair), NULL);
+    struct pair *second = allocate(sizeof(struct pair), NULL);
+    first->first = second;
+    second->first = first;
+    first->second = shared;
+    second->second = shared;
+    retain(first);
+    retain(second);
+    retain(shared);
+    retain(shared);
+    retain(first);
+    release(first);
+
+    // freeing the cycle releases the shared object to a count above zero, which buffers it
+    refmem_heap_close();
+    CU_ASSERT_EQUAL(collect_cycles(), 0);
+
+    CU_ASSERT_TRUE(refmem_heap_open(heap_path, 0));
+    shared = refmem_heap_root();
+    CU_ASSERT_PTR_NOT_NULL(shared);
+    if (shared != NULL)
+    {
+        CU_ASSERT_EQUAL(rc(shared), 1);
+        // buffered again the next time it is released to a count above zero
+        retain(shared);
+        release(shared);
+        CU_ASSERT_EQUAL(collect_cycles(), 0);
+        CU_ASSERT_EQUAL(rc(shared), 1);
+    }
+}
+
+void weak_references_are_cleared_on_close_test()
+{
+    CU_ASSERT_TRUE(refmem_heap_open(new_heap_path(), HEAP_CAPACITY));
+    obj *target = allocate(sizeof(int), NULL);
+    refmem_heap_set_root(target);
+    weak_ref_t *ref = weak_create(target);
+    refmem_heap_close();
+
+    CU_ASSERT_TRUE(refmem_heap_open(heap_path, 0));
+    refmem_heap_set_root(NULL);
+    cleanup();
+    CU_ASSERT_PTR_NULL(weak_lock(ref));
+    release(ref);
+}
+
+void foreign_files_are_refused_test()
+{
+    FILE *file = fopen(new_heap_path(), "wb");
+    for (int i = 0; i < 100000; i++)
+    {
+        fputc(i, file);
+    }
+    fclose(file);
+
+    CU_ASSERT_FALSE(refmem_heap_open(heap_path, 0));
+    CU_ASSERT_PTR_NULL(refmem_heap_root());
+}
+
+void objects_outside_a_heap_are_not_kept_test()
+{
+    CU_ASSERT_TRUE(refmem_heap_open(new_heap_path(), HEAP_CAPACITY));
+    CU_ASSERT_FALSE(refmem_heap_open(heap_path, HEAP_CAPACITY));
+    refmem_heap_close();
+
+    // without a heap the root can not be set, and objects come from the usual places
+    obj *object = allocate(sizeof(int), NULL);
+    refmem_heap_set_root(object);
+    CU_ASSERT_PTR_NULL(refmem_heap_root());
+    CU_ASSERT_EQUAL(rc(object), 0);
+    deallocate(object);
+}
+
+int main()
+{
+    if (CU_initialize_registry() != CUE_SUCCESS)
+        return CU_get_error();
+
+    CU_pSuite my_test_suite = CU_add_suite("Tests for the heap kept in a file", init_suite, clean_suite);
+    if (my_test_suite == NULL)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if (
+        (CU_add_test(my_test_suite, "objects survive closing and opening the heap", objects_survive_reopening_test) == NULL ||
+        CU_add_test(my_test_suite, "a heap written by another process", heap_written_by_another_process_test) == NULL ||
+        CU_add_test(my_test_suite, "destructors survive closing and opening the heap", destructors_survive_reopening_test) == NULL ||
+        CU_add_test(my_test_suite, "reopened objects are counted and scanned", reopened_objects_are_counted_and_scanned_test) == NULL ||
+        CU_add_test(my_test_suite, "freed blocks are reused", freed_blocks_are_reused_test) == NULL ||
+        CU_add_test(my_test_suite, "cycles are collected on close", cycles_are_collected_on_close_test) == NULL ||
+        CU_add_test(my_test_suite, "cycle roots do not outlive the heap", cycle_roots_do_not_outlive_the_heap_test) == NULL ||
+        CU_add_test(my_test_suite, "weak references are cleared on close", weak_references_are_cleared_on_close_test) == NULL ||
+        CU_add_test(my_test_suite, "files that are not heaps are refused", foreign_files_are_refused_test) == NULL ||
+        CU_add_test(my_test_suite, "objects outside of a heap", objects_outside_a_heap_are_not_kept_test) == NULL
+        )
+    )
+
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    CU_basic_run_tests();
+
+    CU_cleanup_registry();
+    return CU_get_error();
+}
@@ -0,0 +1,87 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../src/page_map.h"
+
+int init_suite(void)
+{
+    return 0;
+}
+
+int clean_suite(void)
+{
+    page_map_clear();
+    return 0;
+}
+
+void set_get_test()
+{
+    void *page = (void *)(uintptr_t)(42 * PAGE_MAP_PAGE_SIZE);
+
+    CU_ASSERT_FALSE(page_map_get(page));
+    page_map_set(page, true);
+    CU_ASSERT_TRUE(page_map_get(page));
+
+    // every address inside the page is covered, the neighbouring pages are not
+    CU_ASSERT_TRUE(page_map_get((char *)page + PAGE_MAP_PAGE_SIZE - 1));
+    CU_ASSERT_FALSE(page_map_get((char *)page + PAGE_MAP_PAGE_SIZE));
+    CU_ASSERT_FALSE(page_map_get((char *)page - 1));
+
+    page_map_set(page, false);
+    CU_ASSERT_FALSE(page_map_get(page));
+}
+
+void unmapped_addresses_test()
+{
+    CU_ASSERT_FALSE(page_map_get(NULL));
+    CU_ASSERT_FALSE(page_map_get((void *)UINTPTR_MAX));
+    CU_ASSERT_FALSE(page_map_get((void *)(uintptr_t)0x7fffffff0000));
+}
+
+void clear_test()
+{
+    void *low = (void *)(uintptr_t)PAGE_MAP_PAGE_SIZE;
+    void *high = (void *)(uintptr_t)0x7f0000000000;
+
+    page_map_set(low, true);
+    page_map_set(high, true);
+    page_map_clear();
+
+    CU_ASSERT_FALSE(page_map_get(low));
+    CU_ASSERT_FALSE(page_map_get(high));
+}
+
+int main()
+{
+    if (CU_initialize_registry() != CUE_SUCCESS)
+        return CU_get_error();
+
+    CU_pSuite my_test_suite = CU_add_suite("Tests for page_map.c", init_suite, clean_suite);
+    if (my_test_suite == NULL)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if (
+        (CU_add_test(my_test_suite, "set and get", set_get_test) == NULL ||
+        CU_add_test(my_test_suite, "unmapped addresses", unmapped_addresses_test) == NULL ||
+        CU_add_test(my_test_suite, "clear", clear_test) == NULL
+        )
+    )
+
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    CU_basic_run_tests();
+
+    CU_cleanup_registry();
+    return CU_get_error();
+}
@@ -0,0 +1,179 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../src/pointer_set.h"
+
+#define MANY_POINTERS 100000
+
+int init_suite(void)
+{
+    return 0;
+}
+
+int clean_suite(void)
+{
+    return 0;
+}
+
+// fake pointers with the same alignment as real allocations
+static void *fake_pointer(size_t i)
+{
+    return (void *)(uintptr_t)((i + 1) * 16);
+}
+
+void create_destroy_test()
+{
+    pointer_set_t *set = pointer_set_create();
+    CU_ASSERT_PTR_NOT_NULL(set);
+    CU_ASSERT_EQUAL(pointer_set_size(set), 0);
+    pointer_set_destroy(set);
+}
+
+void insert_contains_test()
+{
+    pointer_set_t *set = pointer_set_create();
+    int a, b;
+
+    CU_ASSERT_FALSE(pointer_set_contains(set, &a));
+    pointer_set_insert(set, &a);
+    CU_ASSERT_TRUE(pointer_set_contains(set, &a));
+    CU_ASSERT_FALSE(pointer_set_contains(set, &b));
+    CU_ASSERT_FALSE(pointer_set_contains(set, NULL));
+    CU_ASSERT_EQUAL(pointer_set_size(set), 1);
+
+    pointer_set_destroy(set);
+}
+
+void remove_test()
+{
+    pointer_set_t *set = pointer_set_create();
+    int a, b;
+
+    pointer_set_insert(set, &a);
+    pointer_set_insert(set, &b);
+
+    CU_ASSERT_TRUE(pointer_set_remove(set, &a));
+    CU_ASSERT_FALSE(pointer_set_contains(set, &a));
+    CU_ASSERT_TRUE(pointer_set_contains(set, &b));
+    CU_ASSERT_FALSE(pointer_set_remove(set, &a));
+    CU_ASSERT_EQUAL(pointer_set_size(set), 1);
+
+    pointer_set_destroy(set);
+}
+
+void growth_test()
+{
+    pointer_set_t *set = pointer_set_create();
+
+    for (size_t i = 0; i < MANY_POINTERS; i++)
+    {
+        pointer_set_insert(set, fake_pointer(i));
+    }
+    CU_ASSERT_EQUAL(pointer_set_size(set), MANY_POINTERS);
+
+    bool all_found = true;
+    for (size_t i = 0; i < MANY_POINTERS; i++)
+    {
+        all_found = all_found && pointer_set_contains(set, fake_pointer(i));
+    }
+    CU_ASSERT_TRUE(all_found);
+    CU_ASSERT_FALSE(pointer_set_contains(set, fake_pointer(MANY_POINTERS)));
+
+    pointer_set_destroy(set);
+}
+
+void remove_during_growth_test()
+{
+    pointer_set_t *set = pointer_set_create();
+
+    // remove every other pointer while the tables are being migrated
+    for (size_t i = 0; i < MANY_POINTERS; i++)
+    {
+        pointer_set_insert(set, fake_pointer(i));
+        if (i % 2 == 1)
+        {
+            CU_ASSERT_TRUE(pointer_set_remove(set, fake_pointer(i - 1)));
+        }
+    }
+    CU_ASSERT_EQUAL(pointer_set_size(set), MANY_POINTERS / 2);
+
+    bool correct = true;
+    for (size_t i = 0; i < MANY_POINTERS; i++)
+    {
+        correct = correct && pointer_set_contains(set, fake_pointer(i)) == (i % 2 == 1);
+    }
+    CU_ASSERT_TRUE(correct);
+
+    for (size_t i = 1; i < MANY_POINTERS; i += 2)
+    {
+        pointer_set_remove(set, fake_pointer(i));
+    }
+    CU_ASSERT_EQUAL(pointer_set_size(set), 0);
+
+    pointer_set_destroy(set);
+}
+
+void copy_to_test()
+{
+    pointer_set_t *set = pointer_set_create();
+
+    // stop in the middle of a migration so that both tables hold pointers
+    size_t count = 100;
+    for (size_t i = 0; i < count; i++)
+    {
+        pointer_set_insert(set, fake_pointer(i));
+    }
+
+    void **array = calloc(count, sizeof(void *));
+    CU_ASSERT_EQUAL(pointer_set_copy_to(set, array), count);
+
+    bool all_found = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        all_found = all_found && pointer_set_contains(set, array[i]);
+        pointer_set_remove(set, array[i]);
+    }
+    CU_ASSERT_TRUE(all_found);
+    CU_ASSERT_EQUAL(pointer_set_size(set), 0);
+
+    free(array);
+    pointer_set_destroy(set);
+}
+
+int main()
+{
+    if (CU_initialize_registry() != CUE_SUCCESS)
+        return CU_get_error();
+
+    CU_pSuite my_test_suite = CU_add_suite("Tests for pointer_set.c", init_suite, clean_suite);
+    if (my_test_suite == NULL)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if (
+        (CU_add_test(my_test_suite, "a simple create destroy test", create_destroy_test) == NULL ||
+        CU_add_test(my_test_suite, "insert and contains", insert_contains_test) == NULL ||
+        CU_add_test(my_test_suite, "remove", remove_test) == NULL ||
+        CU_add_test(my_test_suite, "growth", growth_test) == NULL ||
+        CU_add_test(my_test_suite, "remove during growth", remove_during_growth_test) == NULL ||
+        CU_add_test(my_test_suite, "copy to an array", copy_to_test) == NULL
+        )
+    )
+
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    CU_basic_run_tests();
+
+    CU_cleanup_registry();
+    return CU_get_error();
+}
@@ -2,7 +2,10 @@
 #include <CUnit/CUnit.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <malloc.h>
+#include <unistd.h>
 #include "../src/refmem.h"
 #include "../src/queue.h"
 
@@ -171,7 +174,458 @@ void test_rc_overflow()
         CU_ASSERT_TRUE(rc(obj) == i);
         retain(obj);
     }
-    // Reference count overflow should lead to the object being destroyed
+    // the count saturates and the object becomes immortal instead of being destroyed
+    CU_ASSERT_EQUAL(rc(obj), 65535);
+    *(int *)obj = 7;
+    release(obj);
+    cleanup();
+    CU_ASSERT_EQUAL(rc(obj), 65535);
+    CU_ASSERT_EQUAL(*(int *)obj, 7);
+    refmem_teardown(0);
+}
+
+struct pair
+{
+    obj *first;
+    obj *second;
+};
+
+void test_immortal()
+{
+    refmem_stats_t before;
+    refmem_stats_t after;
+    struct pair *store = allocate(sizeof(struct pair), NULL);
+    store->first = duplicate_string("kept");
+    refmem_make_immortal(store);
+
+    refmem_stats(&before);
+    for (int i = 0; i < 100; i++)
+    {
+        retain(store);
+        release(store);
+    }
+    release(store);
+    deallocate(store);
+    cleanup();
+    refmem_stats(&after);
+    CU_ASSERT_EQUAL(rc(store), 65535);
+    CU_ASSERT_EQUAL(after.retain_calls, before.retain_calls);
+    CU_ASSERT_EQUAL(after.release_calls, before.release_calls);
+    CU_ASSERT_EQUAL(after.live_objects, before.live_objects);
+    CU_ASSERT_STRING_EQUAL(store->first, "kept");
+
+    // a cycle through an immortal object is never garbage, and its counts are left as they were
+    struct pair *other = allocate(sizeof(struct pair), NULL);
+    other->first = store;
+    store->second = other;
+    retain(other);
+    retain(other);
+    release(other);
+    collect_cycles();
+    CU_ASSERT_EQUAL(rc(other), 1);
+    CU_ASSERT_EQUAL(rc(store), 65535);
+
+    // an object pointing at it is freed without releasing it
+    release(other);
+    cleanup();
+    CU_ASSERT_EQUAL(rc(store), 65535);
+    CU_ASSERT_STRING_EQUAL(store->first, "kept");
+    store->second = NULL;
+    refmem_teardown(0);
+}
+
+static int freed_order[5];
+static int freed_count = 0;
+
+static void record_destructor(obj *object)
+{
+    freed_order[freed_count++] = *(int *)object;
+}
+
+void test_free_queue_order()
+{
+    size_t old_limit = get_cascade_limit();
+    set_cascade_limit(2);
+    freed_count = 0;
+
+    obj *objects[5];
+    for (int i = 0; i < 5; i++)
+    {
+        objects[i] = allocate(sizeof(int), record_destructor);
+        *(int *)objects[i] = i;
+        retain(objects[i]);
+    }
+    for (int i = 0; i < 5; i++)
+    {
+        release(objects[i]);
+    }
+    CU_ASSERT_EQUAL(freed_count, 0);
+
+    // every allocation frees at most cascade limit objects, oldest first
+    obj *trigger = allocate(sizeof(int), NULL);
+    CU_ASSERT_EQUAL(freed_count, 2);
+
+    cleanup();
+    CU_ASSERT_EQUAL(freed_count, 5);
+    for (int i = 0; i < 5; i++)
+    {
+        CU_ASSERT_EQUAL(freed_order[i], i);
+    }
+
+    deallocate(trigger);
+    set_cascade_limit(old_limit);
+    shutdown();
+}
+
+void test_byte_budget()
+{
+    freed_count = 0;
+    set_cascade_byte_budget(1);
+
+    obj *objects[3];
+    for (int i = 0; i < 3; i++)
+    {
+        objects[i] = allocate(sizeof(int), record_destructor);
+        *(int *)objects[i] = i;
+        retain(objects[i]);
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        release(objects[i]);
+    }
+
+    // the first object freed already uses up the budget
+    obj *trigger = allocate(sizeof(int), NULL);
+    CU_ASSERT_EQUAL(freed_count, 1);
+
+    // a budget larger than all queued objects frees all of them
+    set_cascade_byte_budget(1 << 20);
+    obj *second_trigger = allocate(sizeof(int), NULL);
+    CU_ASSERT_EQUAL(freed_count, 3);
+
+    set_cascade_byte_budget(0);
+    deallocate(trigger);
+    deallocate(second_trigger);
+    shutdown();
+}
+
+void test_time_budget_and_pauses()
+{
+    freed_count = 0;
+    reset_pause_stats();
+    set_cascade_time_budget(1000000000);
+    CU_ASSERT_EQUAL(get_cascade_time_budget(), 1000000000);
+
+    for (int i = 0; i < 5; i++)
+    {
+        obj *object = allocate(sizeof(int), record_destructor);
+        *(int *)object = i;
+        retain(object);
+        release(object);
+    }
+    // every allocation freed the object released before it, a second easily covers that
+    obj *trigger = allocate(sizeof(int), NULL);
+    CU_ASSERT_EQUAL(freed_count, 5);
+
+    refmem_pause_stats_t stats;
+    get_pause_stats(&stats);
+    CU_ASSERT_EQUAL(stats.pauses, 5);
+    CU_ASSERT_TRUE(stats.max_ns <= stats.total_ns);
+
+    uint64_t histogram_total = 0;
+    for (int i = 0; i < REFMEM_PAUSE_BUCKETS; i++)
+    {
+        histogram_total += stats.histogram[i];
+    }
+    CU_ASSERT_EQUAL(histogram_total, stats.pauses);
+
+    reset_pause_stats();
+    get_pause_stats(&stats);
+    CU_ASSERT_EQUAL(stats.pauses, 0);
+
+    set_cascade_time_budget(0);
+    deallocate(trigger);
+    shutdown();
+}
+
+void test_adaptive_cascade()
+{
+    size_t old_limit = get_cascade_limit();
+    set_cascade_limit(1);
+    CU_ASSERT_TRUE(get_cascade_adaptive());
+
+    obj *objects[64];
+    for (int i = 0; i < 64; i++)
+    {
+        objects[i] = allocate(sizeof(int), NULL);
+        retain(objects[i]);
+    }
+    for (int i = 0; i < 64; i++)
+    {
+        release(objects[i]);
+    }
+
+    refmem_backlog_t backlog;
+    get_backlog(&backlog);
+    CU_ASSERT_EQUAL(backlog.queued_objects, 64);
+    CU_ASSERT_TRUE(backlog.queued_bytes >= 64 * sizeof(int));
+
+    // one object plus a sixteenth of the backlog
+    obj *trigger = allocate(sizeof(int), NULL);
+    get_backlog(&backlog);
+    CU_ASSERT_EQUAL(backlog.queued_objects, 64 - 5);
+    CU_ASSERT_TRUE(backlog.peak_objects >= 64);
+
+    set_cascade_adaptive(false);
+    obj *second_trigger = allocate(sizeof(int), NULL);
+    get_backlog(&backlog);
+    CU_ASSERT_EQUAL(backlog.queued_objects, 64 - 6);
+
+    set_cascade_adaptive(true);
+    set_cascade_limit(old_limit);
+    deallocate(trigger);
+    deallocate(second_trigger);
+    shutdown();
+}
+
+void test_high_water_drain()
+{
+    refmem_backlog_t before;
+    get_backlog(&before);
+    set_free_high_water(8, 0);
+
+    obj *objects[9];
+    for (int i = 0; i < 9; i++)
+    {
+        objects[i] = allocate(sizeof(int), NULL);
+        retain(objects[i]);
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        release(objects[i]);
+    }
+
+    refmem_backlog_t backlog;
+    get_backlog(&backlog);
+    CU_ASSERT_EQUAL(backlog.queued_objects, 8);
+
+    // the ninth crosses the mark and the release drains the queue down to half of it
+    release(objects[8]);
+    get_backlog(&backlog);
+    CU_ASSERT_EQUAL(backlog.queued_objects, 4);
+    CU_ASSERT_EQUAL(backlog.high_water_drains, before.high_water_drains + 1);
+
+    set_free_high_water(1 << 16, 16 << 20);
+    shutdown();
+}
+
+void test_release_does_not_allocate()
+{
+    obj **objects = calloc(10000, sizeof(obj *));
+    for (int i = 0; i < 10000; i++)
+    {
+        objects[i] = allocate(sizeof(int), NULL);
+        retain(objects[i]);
+    }
+
+    // the free queue made room for every object when it was allocated
+    size_t in_use = mallinfo2().uordblks;
+    for (int i = 0; i < 10000; i++)
+    {
+        release(objects[i]);
+    }
+    CU_ASSERT_EQUAL(mallinfo2().uordblks, in_use);
+
+    refmem_backlog_t backlog;
+    get_backlog(&backlog);
+    CU_ASSERT_EQUAL(backlog.queued_objects, 10000);
+
+    free(objects);
+    shutdown();
+}
+
+void test_duplicate_string_size()
+{
+    char *copy = duplicate_string("refmem");
+    obj *empty = allocate_atomic(0);
+    retain(empty);
+    CU_ASSERT_STRING_EQUAL(copy, "refmem");
+
+    // the queued bytes of an empty object are just its header
+    refmem_backlog_t before;
+    refmem_backlog_t after;
+    get_backlog(&before);
+    release(empty);
+    get_backlog(&after);
+    size_t header = after.queued_bytes - before.queued_bytes;
+
+    release(copy);
+    get_backlog(&before);
+    CU_ASSERT_EQUAL(before.queued_bytes - after.queued_bytes, header + strlen("refmem") + 1);
+
+    shutdown();
+}
+
+void test_large_object()
+{
+    size_t elements = 20000;
+    obj **large = allocate_array(elements, sizeof(obj *), NULL);
+    obj *last = allocate(sizeof(int), NULL);
+    retain(last);
+    retain(last);
+
+    // large objects are mapped on their own pages
+    CU_ASSERT_EQUAL((uintptr_t)large % 4096, 0);
+
+    // far past the 65535 bytes a header can describe, the whole object is still scanned
+    large[elements - 1] = last;
+    deallocate(large);
+    CU_ASSERT_EQUAL(rc(last), 1);
+
+    release(last);
+    shutdown();
+}
+
+void test_autorelease_pool()
+{
+    freed_count = 0;
+
+    refmem_pool_push();
+    obj *temporary = autorelease(allocate(sizeof(int), record_destructor));
+    *(int *)temporary = 0;
+    obj *kept = autorelease(allocate(sizeof(int), record_destructor));
+    *(int *)kept = 1;
+    retain(kept);
+
+    // the count may go to zero and back while the pool holds the object
+    obj *bounced = autorelease(allocate(sizeof(int), record_destructor));
+    *(int *)bounced = 2;
+    retain(bounced);
+    release(bounced);
+    cleanup();
+    CU_ASSERT_EQUAL(freed_count, 0);
+
+    // an inner pool only frees what was autoreleased in it
+    refmem_pool_push();
+    obj *inner = autorelease(allocate(sizeof(int), record_destructor));
+    *(int *)inner = 3;
+    refmem_pool_pop();
+    cleanup();
+    CU_ASSERT_EQUAL(freed_count, 1);
+    CU_ASSERT_EQUAL(freed_order[0], 3);
+
+    refmem_pool_pop();
+    cleanup();
+    CU_ASSERT_EQUAL(freed_count, 3);
+    CU_ASSERT_EQUAL(rc(kept), 1);
+
+    release(kept);
+    cleanup();
+    CU_ASSERT_EQUAL(freed_count, 4);
+    shutdown();
+}
+
+void test_autorelease_outside_pool()
+{
+    freed_count = 0;
+
+    obj *temporary = autorelease(allocate(sizeof(int), record_destructor));
+    *(int *)temporary = 0;
+    // held until the next cleanup
+    obj *trigger = allocate(sizeof(int), NULL);
+    CU_ASSERT_EQUAL(freed_count, 0);
+
+    cleanup();
+    CU_ASSERT_EQUAL(freed_count, 1);
+
+    deallocate(trigger);
+    shutdown();
+}
+
+void test_heap_stats()
+{
+    refmem_stats_t before, after;
+    refmem_stats(&before);
+
+    obj *small = allocate(24, NULL);
+    obj *large = allocate(1000, NULL);
+    retain(small);
+    retain(large);
+    refmem_stats(&after);
+
+    CU_ASSERT_EQUAL(after.live_objects - before.live_objects, 2);
+    CU_ASSERT_EQUAL(after.live_bytes - before.live_bytes, 1024);
+    CU_ASSERT_TRUE(after.header_bytes - before.header_bytes >= 2 * 8);
+    CU_ASSERT_TRUE(after.peak_live_bytes >= after.live_bytes);
+    CU_ASSERT_EQUAL(after.allocate_calls - before.allocate_calls, 2);
+    CU_ASSERT_EQUAL(after.retain_calls - before.retain_calls, 2);
+    CU_ASSERT_EQUAL(after.size_classes[4] - before.size_classes[4], 1);
+    CU_ASSERT_EQUAL(after.size_classes[9] - before.size_classes[9], 1);
+
+    // queued objects are still live
+    release(small);
+    release(large);
+    refmem_stats(&after);
+    CU_ASSERT_EQUAL(after.release_calls - before.release_calls, 2);
+    CU_ASSERT_EQUAL(after.queued_objects, 2);
+    CU_ASSERT_EQUAL(after.live_objects - before.live_objects, 2);
+
+    cleanup();
+    refmem_stats(&after);
+    CU_ASSERT_EQUAL(after.queued_objects, 0);
+    CU_ASSERT_EQUAL(after.queued_bytes, 0);
+    CU_ASSERT_EQUAL(after.live_objects, before.live_objects);
+    CU_ASSERT_EQUAL(after.live_bytes, before.live_bytes);
+    CU_ASSERT_EQUAL(after.header_bytes, before.header_bytes);
+    CU_ASSERT_EQUAL(after.deallocate_calls - before.deallocate_calls, 2);
+    CU_ASSERT_EQUAL(after.size_classes[4], before.size_classes[4]);
+    shutdown();
+}
+
+void test_heap_profile()
+{
+    obj *objects[1000];
+    char path[] = "/tmp/refmem_test_profileXXXXXX";
+    int descriptor = mkstemp(path);
+    CU_ASSERT_TRUE(descriptor >= 0);
+    close(descriptor);
+
+    refmem_profile_start(1024);
+    for (int i = 0; i < 1000; i++)
+    {
+        objects[i] = allocate(100, NULL);
+        retain(objects[i]);
+    }
+    for (int i = 0; i < 500; i++)
+    {
+        release(objects[i]);
+    }
+    cleanup();
+    CU_ASSERT_TRUE(refmem_profile_write(path));
+
+    // about 100000 bytes allocated and 50000 freed, every sample stands for 1024 bytes
+    unsigned long long allocated = 0, freed = 0, objects_allocated, bytes, objects_freed, freed_bytes;
+    char line[256];
+    FILE *file = fopen(path, "r");
+    CU_ASSERT_PTR_NOT_NULL(file);
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (sscanf(line, "site %llu %llu %llu %llu", &objects_allocated, &bytes, &objects_freed, &freed_bytes) == 4)
+        {
+            allocated += bytes;
+            freed += freed_bytes;
+        }
+    }
+    fclose(file);
+    remove(path);
+    CU_ASSERT_TRUE(allocated > 50000 && allocated < 200000);
+    CU_ASSERT_TRUE(freed > 10000 && freed < allocated);
+
+    refmem_profile_stop();
+    for (int i = 500; i < 1000; i++)
+    {
+        release(objects[i]);
+    }
     shutdown();
 }
 
@@ -211,6 +665,19 @@ int main()
         CU_add_test(my_test_suite, "set and get cascade limit", set_get_cascade_limit) == NULL ||
         CU_add_test(my_test_suite, "cleanup test", integration_cleanup_test) == NULL ||
         CU_add_test(my_test_suite, "reference count overflow test", test_rc_overflow) == NULL ||
+        CU_add_test(my_test_suite, "immortal objects", test_immortal) == NULL ||
+        CU_add_test(my_test_suite, "objects are freed in release order", test_free_queue_order) == NULL ||
+        CU_add_test(my_test_suite, "byte budget per allocation", test_byte_budget) == NULL ||
+        CU_add_test(my_test_suite, "time budget and pause times", test_time_budget_and_pauses) == NULL ||
+        CU_add_test(my_test_suite, "the cascade limit grows with the backlog", test_adaptive_cascade) == NULL ||
+        CU_add_test(my_test_suite, "releases drain the queue past the high-water mark", test_high_water_drain) == NULL ||
+        CU_add_test(my_test_suite, "releasing does not allocate", test_release_does_not_allocate) == NULL ||
+        CU_add_test(my_test_suite, "duplicate_string allocates the exact size", test_duplicate_string_size) == NULL ||
+        CU_add_test(my_test_suite, "objects larger than 65535 bytes", test_large_object) == NULL ||
+        CU_add_test(my_test_suite, "autorelease pools", test_autorelease_pool) == NULL ||
+        CU_add_test(my_test_suite, "autorelease outside of a pool", test_autorelease_outside_pool) == NULL ||
+        CU_add_test(my_test_suite, "heap statistics", test_heap_stats) == NULL ||
+        CU_add_test(my_test_suite, "sampling heap profile", test_heap_profile) == NULL ||
         CU_add_test(my_test_suite, "shutdown test", test_shutdown) == NULL
         )
     )
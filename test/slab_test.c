@@ -0,0 +1,179 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "../src/slab.h"
+
+#define MANY_SLOTS 20000
+
+int init_suite(void)
+{
+    return 0;
+}
+
+int clean_suite(void)
+{
+    return 0;
+}
+
+void allocate_free_test()
+{
+    char *slot = slab_allocate(24);
+    CU_ASSERT_PTR_NOT_NULL(slot);
+    CU_ASSERT_EQUAL((uintptr_t)slot % SLAB_GRANULE, 0);
+    CU_ASSERT_EQUAL(slab_slot_size(slot), 32);
+
+    bool zeroed = true;
+    for (int i = 0; i < 32; i++)
+    {
+        zeroed = zeroed && slot[i] == 0;
+    }
+    CU_ASSERT_TRUE(zeroed);
+
+    slab_free(slot);
+    slab_trim();
+}
+
+void size_class_test()
+{
+    size_t sizes[] = {1, 16, 17, SLAB_MAX_SLOT};
+    size_t expected[] = {16, 16, 32, SLAB_MAX_SLOT};
+
+    for (int i = 0; i < 4; i++)
+    {
+        void *slot = slab_allocate(sizes[i]);
+        CU_ASSERT_EQUAL(slab_slot_size(slot), expected[i]);
+        slab_free(slot);
+    }
+    slab_trim();
+}
+
+void reuse_test()
+{
+    char *first = slab_allocate(48);
+    memset(first, 0xff, 48);
+    slab_free(first);
+
+    // the freed slot is handed out again, cleared
+    char *second = slab_allocate(48);
+    CU_ASSERT_PTR_EQUAL(first, second);
+    CU_ASSERT_EQUAL(second[0], 0);
+    CU_ASSERT_EQUAL(second[47], 0);
+
+    slab_free(second);
+    slab_trim();
+}
+
+void many_slabs_test()
+{
+    void **slots = calloc(MANY_SLOTS, sizeof(void *));
+
+    for (int i = 0; i < MANY_SLOTS; i++)
+    {
+        slots[i] = slab_allocate(64);
+        *(int *)slots[i] = i;
+    }
+
+    bool intact = true;
+    for (int i = 0; i < MANY_SLOTS; i++)
+    {
+        intact = intact && *(int *)slots[i] == i;
+    }
+    CU_ASSERT_TRUE(intact);
+
+    for (int i = 0; i < MANY_SLOTS; i++)
+    {
+        slab_free(slots[i]);
+    }
+
+    free(slots);
+    slab_trim();
+}
+
+void slot_in_use_test()
+{
+    char *slot = slab_allocate(32);
+
+    CU_ASSERT_TRUE(slab_contains(slot));
+    CU_ASSERT_TRUE(slab_slot_in_use(slot));
+    CU_ASSERT_FALSE(slab_slot_in_use(slot + 8));
+    CU_ASSERT_FALSE(slab_slot_in_use(slot + 32));
+
+    int on_stack;
+    CU_ASSERT_FALSE(slab_contains(&on_stack));
+
+    slab_free(slot);
+    CU_ASSERT_FALSE(slab_slot_in_use(slot));
+
+    slab_trim();
+    CU_ASSERT_FALSE(slab_contains(slot));
+}
+
+static void count_slot(void *slot, void *context)
+{
+    (*(size_t *)context)++;
+}
+
+void release_all_test()
+{
+    void *small = slab_allocate(16);
+    void *large = slab_allocate(SLAB_MAX_SLOT);
+    for (int i = 0; i < MANY_SLOTS; i++)
+    {
+        slab_allocate(64);
+    }
+    slab_free(small);
+
+    size_t visited = 0;
+    slab_for_each_slot(count_slot, &visited);
+    CU_ASSERT_EQUAL(visited, MANY_SLOTS + 1);
+
+    // full slabs go too, and nothing is left to visit
+    slab_release_all();
+    CU_ASSERT_FALSE(slab_contains(large));
+    visited = 0;
+    slab_for_each_slot(count_slot, &visited);
+    CU_ASSERT_EQUAL(visited, 0);
+
+    void *slot = slab_allocate(64);
+    CU_ASSERT_TRUE(slab_slot_in_use(slot));
+    slab_free(slot);
+    slab_trim();
+}
+
+int main()
+{
+    if (CU_initialize_registry() != CUE_SUCCESS)
+        return CU_get_error();
+
+    CU_pSuite my_test_suite = CU_add_suite("Tests for slab.c", init_suite, clean_suite);
+    if (my_test_suite == NULL)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if (
+        (CU_add_test(my_test_suite, "a simple allocate free test", allocate_free_test) == NULL ||
+        CU_add_test(my_test_suite, "size classes", size_class_test) == NULL ||
+        CU_add_test(my_test_suite, "freed slots are reused", reuse_test) == NULL ||
+        CU_add_test(my_test_suite, "allocations spanning many slabs", many_slabs_test) == NULL ||
+        CU_add_test(my_test_suite, "slots in use are recognised", slot_in_use_test) == NULL ||
+        CU_add_test(my_test_suite, "all slabs are released at once", release_all_test) == NULL
+        )
+    )
+
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    CU_basic_run_tests();
+
+    CU_cleanup_registry();
+    return CU_get_error();
+}
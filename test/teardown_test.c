@@ -0,0 +1,214 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../src/refmem.h"
+
+/**
+ * @file teardown_test.c
+ * @brief Tests for freeing everything at exit and for the leak report, see refmem_teardown.
+*/
+
+#define MANY_OBJECTS 10000
+#define REPORT_SIZE 4096
+
+typedef struct
+{
+    obj *first;
+    obj *second;
+} pair_t;
+
+REFMEM_DECLARE_TYPE(pair_type, pair_t, REFMEM_FIELD(pair_t, first) | REFMEM_FIELD(pair_t, second), 0);
+
+static int destroyed = 0;
+
+int init_suite(void)
+{
+    return 0;
+}
+
+int clean_suite(void)
+{
+    refmem_teardown(REFMEM_TEARDOWN_SKIP_DESTRUCTORS);
+    return 0;
+}
+
+static void count_destructor(obj *object)
+{
+    destroyed++;
+}
+
+// the report of refmem_leak_report as a string, which the caller frees
+static char *leak_report(size_t *objects)
+{
+    FILE *file = tmpfile();
+    char *report = calloc(REPORT_SIZE, 1);
+
+    *objects = refmem_leak_report(file);
+    rewind(file);
+    fread(report, 1, REPORT_SIZE - 1, file);
+    fclose(file);
+    return report;
+}
+
+void report_groups_by_size_and_destructor_test()
+{
+    refmem_teardown(0);
+
+    for (int i = 0; i < 3; i++)
+    {
+        retain(allocate_typed(&pair_type));
+    }
+    retain(allocate_atomic(100));
+    retain(allocate(40, count_destructor));
+    retain(allocate(100000, NULL));
+    // waiting to be freed, so not leaked
+    obj *queued = allocate(40, count_destructor);
+    retain(queued);
+    release(queued);
+
+    size_t objects;
+    char *report = leak_report(&objects);
+    CU_ASSERT_EQUAL(objects, 6);
+    CU_ASSERT_PTR_NOT_NULL(strstr(report, "refmem: 6 objects still allocated, 100188 bytes\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(report, "3 objects of 16 up to 31 bytes, 48 bytes in all, type pair_t\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(report, "1 objects of 64 up to 127 bytes, 100 bytes in all, atomic\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(report, "1 objects of 32 up to 63 bytes, 40 bytes in all, destructor "));
+    CU_ASSERT_PTR_NOT_NULL(strstr(report, "1 objects of 65536 up to 131071 bytes, 100000 bytes in all, default destructor\n"));
+    // the largest group comes first
+    CU_ASSERT_TRUE(strstr(report, "100000 bytes in all") < strstr(report, "type pair_t"));
+    free(report);
+
+    refmem_teardown(REFMEM_TEARDOWN_SKIP_DESTRUCTORS);
+}
+
+void arena_objects_are_reported_test()
+{
+    refmem_arena_t *arena = arena_create();
+    arena_allocate(arena, 24, NULL);
+    arena_allocate(arena, 24, NULL);
+
+    size_t objects;
+    char *report = leak_report(&objects);
+    CU_ASSERT_EQUAL(objects, 2);
+    CU_ASSERT_PTR_NOT_NULL(strstr(report, "2 objects of 16 up to 31 bytes, 48 bytes in all, default destructor\n"));
+    free(report);
+
+    arena_destroy(arena);
+    report = leak_report(&objects);
+    CU_ASSERT_EQUAL(objects, 0);
+    free(report);
+}
+
+void live_objects_are_freed_test()
+{
+    obj **objects = calloc(MANY_OBJECTS, sizeof(obj *));
+    for (int i = 0; i < MANY_OBJECTS; i++)
+    {
+        objects[i] = allocate(i % 3 == 0 ? 200 : 24, NULL);
+        retain(objects[i]);
+    }
+    retain(allocate(100000, NULL));
+    retain(allocate((size_t)8 << 20, NULL));
+    refmem_arena_t *arena = arena_create();
+    retain(arena_allocate(arena, 64, NULL));
+    arena_allocate(arena, 100000, NULL);
+    weak_ref_t *ref = weak_create(objects[0]);
+    retain(ref);
+    free(objects);
+
+    refmem_teardown(REFMEM_TEARDOWN_SKIP_DESTRUCTORS);
+    refmem_stats_t stats;
+    refmem_stats(&stats);
+    CU_ASSERT_EQUAL(stats.live_objects, 0);
+    CU_ASSERT_EQUAL(stats.live_bytes, 0);
+    CU_ASSERT_EQUAL(stats.size_classes[4], 0);
+
+    // refmem starts over
+    obj *object = allocate(24, NULL);
+    retain(object);
+    ref = weak_create(object);
+    CU_ASSERT_PTR_EQUAL(weak_lock(ref), object);
+    release(object);
+    release(object);
+    release(ref);
+    cleanup();
+    refmem_stats(&stats);
+    CU_ASSERT_EQUAL(stats.live_objects, 0);
+}
+
+void destructors_of_queued_objects_test()
+{
+    obj *object = allocate(40, count_destructor);
+    retain(object);
+    release(object);
+    destroyed = 0;
+    refmem_teardown(REFMEM_TEARDOWN_SKIP_DESTRUCTORS);
+    CU_ASSERT_EQUAL(destroyed, 0);
+
+    object = allocate(40, count_destructor);
+    retain(object);
+    release(object);
+    retain(allocate(40, count_destructor));
+    refmem_teardown(0);
+    // only the object that was released, the other is still referenced
+    CU_ASSERT_EQUAL(destroyed, 1);
+}
+
+void report_on_teardown_test()
+{
+    retain(allocate_typed(&pair_type));
+
+    FILE *file = tmpfile();
+    int saved = dup(STDERR_FILENO);
+    fflush(stderr);
+    dup2(fileno(file), STDERR_FILENO);
+    refmem_teardown(REFMEM_TEARDOWN_SKIP_DESTRUCTORS | REFMEM_TEARDOWN_REPORT_LEAKS);
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+
+    char report[REPORT_SIZE] = {0};
+    rewind(file);
+    fread(report, 1, REPORT_SIZE - 1, file);
+    fclose(file);
+    CU_ASSERT_PTR_NOT_NULL(strstr(report, "refmem: 1 objects still allocated, 16 bytes\n"));
+    CU_ASSERT_PTR_NOT_NULL(strstr(report, "type pair_t\n"));
+}
+
+int main()
+{
+    if (CU_initialize_registry() != CUE_SUCCESS)
+        return CU_get_error();
+
+    CU_pSuite my_test_suite = CU_add_suite("Tests for freeing everything at exit", init_suite, clean_suite);
+    if (my_test_suite == NULL)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if (
+        (CU_add_test(my_test_suite, "leaks are grouped by size and destructor", report_groups_by_size_and_destructor_test) == NULL ||
+        CU_add_test(my_test_suite, "arena objects are reported", arena_objects_are_reported_test) == NULL ||
+        CU_add_test(my_test_suite, "live objects are freed", live_objects_are_freed_test) == NULL ||
+        CU_add_test(my_test_suite, "destructors of queued objects", destructors_of_queued_objects_test) == NULL ||
+        CU_add_test(my_test_suite, "leaks are reported on teardown", report_on_teardown_test) == NULL
+        )
+    )
+
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    CU_basic_run_tests();
+
+    CU_cleanup_registry();
+    return CU_get_error();
+}
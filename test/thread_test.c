@@ -0,0 +1,401 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/refmem.h"
+
+/**
+ * @file thread_test.c
+ * @brief Tests for refmem built with REFMEM_THREAD_SAFE.
+ *
+ * Most tests hand objects over through pthread_join. The shared tests retain and
+ * release one object from several threads at once, which goes through the atomic
+ * shared counter of the biased reference counting.
+*/
+
+#define THREADS 4
+#define OBJECTS 20000
+#define SHARED_ROUNDS 50000
+#define RACE_ROUNDS 20000
+
+struct node
+{
+    struct node *next;
+    int value;
+};
+
+int init_suite(void)
+{
+    return 0;
+}
+
+int clean_suite(void)
+{
+    shutdown();
+    return 0;
+}
+
+// sizes on both sides of the slab threshold
+static size_t object_size(int i)
+{
+    size_t sizes[] = {8, 24, 64, 200, 1024};
+    return sizes[i % 5];
+}
+
+static void *allocate_and_check(void *arg)
+{
+    int seed = *(int *)arg;
+    char **objects = calloc(OBJECTS, sizeof(char *));
+    bool intact = true;
+
+    for (int i = 0; i < OBJECTS; i++)
+    {
+        objects[i] = allocate(object_size(i), NULL);
+        retain(objects[i]);
+        memset(objects[i], seed, object_size(i));
+    }
+
+    for (int i = 0; i < OBJECTS; i++)
+    {
+        intact = intact && objects[i][0] == seed && objects[i][object_size(i) - 1] == seed;
+        release(objects[i]);
+    }
+    cleanup();
+
+    free(objects);
+    return intact ? arg : NULL;
+}
+
+void parallel_allocate_test()
+{
+    pthread_t threads[THREADS];
+    int seeds[THREADS];
+
+    for (int i = 0; i < THREADS; i++)
+    {
+        seeds[i] = i + 1;
+        pthread_create(&threads[i], NULL, allocate_and_check, &seeds[i]);
+    }
+
+    for (int i = 0; i < THREADS; i++)
+    {
+        void *result;
+        pthread_join(threads[i], &result);
+        CU_ASSERT_PTR_EQUAL(result, &seeds[i]);
+    }
+}
+
+static void *build_list(void *arg)
+{
+    struct node *head = NULL;
+
+    for (int i = 0; i < OBJECTS; i++)
+    {
+        struct node *node = allocate(sizeof(struct node), NULL);
+        node->next = head;
+        node->value = i;
+        if (head != NULL)
+        {
+            retain(head);
+        }
+        head = node;
+    }
+    retain(head);
+
+    return head;
+}
+
+void cross_thread_release_test()
+{
+    pthread_t thread;
+    struct node *head;
+
+    pthread_create(&thread, NULL, build_list, NULL);
+    pthread_join(thread, (void **)&head);
+
+    int expected = OBJECTS - 1;
+    bool intact = true;
+    for (struct node *cursor = head; cursor != NULL; cursor = cursor->next)
+    {
+        intact = intact && cursor->value == expected;
+        expected--;
+    }
+    CU_ASSERT_TRUE(intact);
+    CU_ASSERT_EQUAL(expected, -1);
+
+    // the list was built by a thread that has exited, its nodes are freed here
+    release(head);
+    cleanup();
+
+    // a new thread takes over the heap of the exited one and can allocate from it
+    pthread_create(&thread, NULL, build_list, NULL);
+    pthread_join(thread, (void **)&head);
+    CU_ASSERT_EQUAL(head->value, OBJECTS - 1);
+    CU_ASSERT_EQUAL(rc(head), 1);
+
+    release(head);
+    cleanup();
+}
+
+static void *set_limit(void *arg)
+{
+    set_cascade_limit(*(size_t *)arg);
+    return NULL;
+}
+
+void cascade_limit_is_per_thread_test()
+{
+    size_t before = get_cascade_limit();
+    size_t other = before + 10;
+    pthread_t thread;
+
+    pthread_create(&thread, NULL, set_limit, &other);
+    pthread_join(thread, NULL);
+
+    CU_ASSERT_EQUAL(get_cascade_limit(), before);
+}
+
+static int destroyed = 0;
+
+static void count_destructor(obj *object)
+{
+    __atomic_add_fetch(&destroyed, 1, __ATOMIC_RELAXED);
+}
+
+static void *retain_release_shared(void *arg)
+{
+    for (int i = 0; i < SHARED_ROUNDS; i++)
+    {
+        retain(arg);
+        release(arg);
+    }
+    retain(arg);
+    return NULL;
+}
+
+void shared_counter_test()
+{
+    pthread_t threads[THREADS];
+    obj *shared = allocate(sizeof(int), count_destructor);
+    retain(shared);
+    destroyed = 0;
+
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_create(&threads[i], NULL, retain_release_shared, shared);
+    }
+    for (int i = 0; i < SHARED_ROUNDS; i++)
+    {
+        retain(shared);
+        release(shared);
+    }
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    // the owner's reference plus one left by every thread
+    CU_ASSERT_EQUAL(rc(shared), THREADS + 1);
+
+    for (int i = 0; i < THREADS; i++)
+    {
+        release(shared);
+    }
+    CU_ASSERT_EQUAL(rc(shared), 1);
+    CU_ASSERT_EQUAL(destroyed, 0);
+
+    release(shared);
+    cleanup();
+    CU_ASSERT_EQUAL(destroyed, 1);
+}
+
+static void *release_last(void *arg)
+{
+    release(arg);
+    cleanup();
+    return NULL;
+}
+
+void freed_by_other_thread_test()
+{
+    pthread_t thread;
+
+    // the other thread drops the last reference while the owner's count is biased,
+    // so the object is handed back and freed by the owner
+    obj *object = allocate(sizeof(int), count_destructor);
+    retain(object);
+    retain(object);
+    destroyed = 0;
+    release(object);
+    pthread_create(&thread, NULL, release_last, object);
+    pthread_join(thread, NULL);
+    CU_ASSERT_EQUAL(destroyed, 0);
+    cleanup();
+    CU_ASSERT_EQUAL(destroyed, 1);
+
+    // the other thread lets go first, the owner then frees it when it merges the counts
+    object = allocate(sizeof(int), count_destructor);
+    retain(object);
+    pthread_create(&thread, NULL, retain_release_shared, object);
+    pthread_join(thread, NULL);
+    pthread_create(&thread, NULL, release_last, object);
+    pthread_join(thread, NULL);
+    CU_ASSERT_EQUAL(destroyed, 1);
+    CU_ASSERT_EQUAL(rc(object), 1);
+
+    release(object);
+    cleanup();
+    CU_ASSERT_EQUAL(destroyed, 2);
+}
+
+static obj *race_object;
+static int race_arrived = 0;
+
+// both threads leave together, then one of them holds back for a while, so that
+// over the rounds the two releases overlap in every order
+static void race_start(int round, int delay)
+{
+    __atomic_add_fetch(&race_arrived, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&race_arrived, __ATOMIC_ACQUIRE) < 2 * round)
+    {
+        sched_yield();
+    }
+    for (int i = 0; i < delay; i++)
+    {
+        sched_yield();
+    }
+}
+
+static void *release_with_owner(void *arg)
+{
+    for (int i = 1; i <= RACE_ROUNDS; i++)
+    {
+        race_start(2 * i - 1, 0);
+        obj *object = race_object;
+        retain(object);
+        race_start(2 * i, i % 2 == 0 ? 0 : i / 2 % 16);
+        release(object);
+    }
+    cleanup();
+    return NULL;
+}
+
+void simultaneous_last_release_test()
+{
+    pthread_t thread;
+    destroyed = 0;
+    race_arrived = 0;
+    pthread_create(&thread, NULL, release_with_owner, NULL);
+
+    // the owner and the other thread drop the last two references at the same time,
+    // and whichever order they end up in, only one of them may queue the object
+    for (int i = 1; i <= RACE_ROUNDS; i++)
+    {
+        race_object = allocate(sizeof(int), count_destructor);
+        retain(race_object);
+        race_start(2 * i - 1, 0);
+        race_start(2 * i, i % 2 == 0 ? i / 2 % 16 : 0);
+        release(race_object);
+    }
+    pthread_join(thread, NULL);
+
+    cleanup();
+    CU_ASSERT_EQUAL(destroyed, RACE_ROUNDS);
+}
+
+static weak_ref_t *race_ref;
+static int race_errors = 0;
+
+static void *lock_while_released(void *arg)
+{
+    for (int i = 1; i <= RACE_ROUNDS; i++)
+    {
+        race_start(3 * i - 2, 0);
+        race_start(3 * i - 1, i % 2 == 0 ? 0 : i / 2 % 16);
+        obj *object = weak_lock(race_ref);
+        if (object != NULL)
+        {
+            if (*(int *)object != i)
+            {
+                __atomic_add_fetch(&race_errors, 1, __ATOMIC_RELAXED);
+            }
+            release(object);
+        }
+        cleanup();
+        race_start(3 * i, 0);
+    }
+    return NULL;
+}
+
+void weak_lock_during_last_release_test()
+{
+    pthread_t thread;
+    destroyed = 0;
+    race_arrived = 0;
+    pthread_create(&thread, NULL, lock_while_released, NULL);
+
+    // the other thread locks a weak reference while the owner drops the last reference, it
+    // either gets the object before it dies or nothing, never one that is about to be freed
+    for (int i = 1; i <= RACE_ROUNDS; i++)
+    {
+        race_object = allocate(sizeof(int), count_destructor);
+        *(int *)race_object = i;
+        retain(race_object);
+        race_ref = weak_create(race_object);
+        retain(race_ref);
+        race_start(3 * i - 2, 0);
+        race_start(3 * i - 1, i % 2 == 0 ? i / 2 % 16 : 0);
+        release(race_object);
+        race_start(3 * i, 0);
+        release(race_ref);
+        cleanup();
+        // freed once, by whichever thread let go last
+        if (destroyed != i)
+        {
+            race_errors++;
+            destroyed = i;
+        }
+    }
+    pthread_join(thread, NULL);
+
+    CU_ASSERT_EQUAL(race_errors, 0);
+}
+
+int main()
+{
+    if (CU_initialize_registry() != CUE_SUCCESS)
+        return CU_get_error();
+
+    CU_pSuite my_test_suite = CU_add_suite("Tests for refmem.c with threads", init_suite, clean_suite);
+    if (my_test_suite == NULL)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if (
+        (CU_add_test(my_test_suite, "threads allocating in parallel", parallel_allocate_test) == NULL ||
+        CU_add_test(my_test_suite, "objects released by another thread", cross_thread_release_test) == NULL ||
+        CU_add_test(my_test_suite, "the cascade limit is per thread", cascade_limit_is_per_thread_test) == NULL ||
+        CU_add_test(my_test_suite, "one object counted by several threads", shared_counter_test) == NULL ||
+        CU_add_test(my_test_suite, "the last reference held by another thread", freed_by_other_thread_test) == NULL ||
+        CU_add_test(my_test_suite, "the last references dropped by two threads at once", simultaneous_last_release_test) == NULL ||
+        CU_add_test(my_test_suite, "a weak reference locked during the last release", weak_lock_during_last_release_test) == NULL
+        )
+    )
+
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    CU_basic_run_tests();
+
+    CU_cleanup_registry();
+    return CU_get_error();
+}
@@ -0,0 +1,257 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../src/refmem.h"
+#include "../src/trace.h"
+
+/**
+ * @file trace_test.c
+ * @brief Tests for the event trace of refmem built with REFMEM_TRACE.
+*/
+
+#define TRACED_OBJECTS 10000
+
+static char trace_path[] = "/tmp/refmem_traceXXXXXX";
+
+int init_suite(void)
+{
+    return 0;
+}
+
+int clean_suite(void)
+{
+    shutdown();
+    return 0;
+}
+
+// counts the events of every kind that concern one object, or all objects if it is NULL
+static size_t read_trace(obj *object, size_t counts[TRACE_KINDS], trace_kind_t *order, size_t order_size)
+{
+    FILE *file = fopen(trace_path, "rb");
+    char magic[TRACE_MAGIC_SIZE];
+    trace_block_t block;
+    size_t ordered = 0;
+
+    memset(counts, 0, TRACE_KINDS * sizeof(size_t));
+    if (file == NULL || fread(magic, 1, TRACE_MAGIC_SIZE, file) != TRACE_MAGIC_SIZE ||
+        memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0)
+    {
+        if (file != NULL)
+        {
+            fclose(file);
+        }
+        return 0;
+    }
+
+    while (fread(&block, sizeof(block), 1, file) == 1)
+    {
+        for (uint32_t i = 0; i < block.events; i++)
+        {
+            trace_event_t event;
+            if (fread(&event, sizeof(event), 1, file) != 1)
+            {
+                break;
+            }
+            if (object == NULL || (event.object & ~(uint64_t)TRACE_KIND_MASK) == (uintptr_t)object)
+            {
+                counts[event.object & TRACE_KIND_MASK]++;
+                if (ordered < order_size)
+                {
+                    order[ordered++] = event.object & TRACE_KIND_MASK;
+                }
+            }
+        }
+    }
+    fclose(file);
+    return ordered;
+}
+
+// the size record written after the last allocation of an object
+static bool read_size_record(obj *object, trace_event_t *size)
+{
+    FILE *file = fopen(trace_path, "rb");
+    char magic[TRACE_MAGIC_SIZE];
+    trace_block_t block;
+    bool allocated = false;
+    bool found = false;
+
+    if (file == NULL || fread(magic, 1, TRACE_MAGIC_SIZE, file) != TRACE_MAGIC_SIZE)
+    {
+        if (file != NULL)
+        {
+            fclose(file);
+        }
+        return false;
+    }
+
+    while (fread(&block, sizeof(block), 1, file) == 1)
+    {
+        for (uint32_t i = 0; i < block.events; i++)
+        {
+            trace_event_t event;
+            if (fread(&event, sizeof(event), 1, file) != 1)
+            {
+                break;
+            }
+            if (allocated && (event.object & TRACE_KIND_MASK) == TRACE_SIZE)
+            {
+                *size = event;
+                found = true;
+            }
+            allocated = event.object == ((uintptr_t)object | TRACE_ALLOCATE);
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+void object_events_test()
+{
+    obj *object = allocate(sizeof(int), NULL);
+    retain(object);
+    retain(object);
+    release(object);
+    release(object);
+    cleanup();
+    refmem_trace_flush();
+
+    size_t counts[TRACE_KINDS];
+    trace_kind_t order[8];
+    size_t events = read_trace(object, counts, order, 8);
+
+    // the address may be reused by later objects, only its first lifetime is checked
+    trace_kind_t expected[] = {TRACE_ALLOCATE, TRACE_RETAIN, TRACE_RETAIN, TRACE_RELEASE, TRACE_RELEASE,
+                               TRACE_ENQUEUE, TRACE_DEALLOCATE};
+    CU_ASSERT_TRUE(events >= 7);
+    CU_ASSERT_EQUAL(memcmp(order, expected, sizeof(expected)), 0);
+}
+
+static void empty_destructor(obj *object)
+{
+}
+
+void size_records_test()
+{
+    obj *plain = allocate(24, NULL);
+    obj *destructed = allocate(40, empty_destructor);
+    obj *atomic = allocate_atomic(100);
+    retain(plain);
+    retain(destructed);
+    retain(atomic);
+    refmem_trace_flush();
+
+    trace_event_t size;
+    CU_ASSERT_TRUE(read_size_record(plain, &size));
+    CU_ASSERT_EQUAL(size.time_ns, 24);
+    CU_ASSERT_EQUAL(TRACE_ATTRIBUTES(size), 0);
+    CU_ASSERT_EQUAL(TRACE_DESTRUCTOR(size), 0);
+
+    CU_ASSERT_TRUE(read_size_record(destructed, &size));
+    CU_ASSERT_EQUAL(size.time_ns, 40);
+    CU_ASSERT_NOT_EQUAL(TRACE_DESTRUCTOR(size), 0);
+
+    CU_ASSERT_TRUE(read_size_record(atomic, &size));
+    CU_ASSERT_EQUAL(size.time_ns, 100);
+    CU_ASSERT_EQUAL(TRACE_ATTRIBUTES(size), TRACE_ATTRIBUTE_ATOMIC);
+
+    release(plain);
+    release(destructed);
+    release(atomic);
+}
+
+void buffer_overflow_test()
+{
+    size_t before[TRACE_KINDS];
+    size_t after[TRACE_KINDS];
+    read_trace(NULL, before, NULL, 0);
+
+    // more events than fit in one buffer, they are written as several blocks
+    for (int i = 0; i < TRACED_OBJECTS; i++)
+    {
+        obj *object = allocate(16, NULL);
+        retain(object);
+        release(object);
+    }
+    cleanup();
+    refmem_trace_flush();
+
+    read_trace(NULL, after, NULL, 0);
+    CU_ASSERT_EQUAL(after[TRACE_ALLOCATE] - before[TRACE_ALLOCATE], TRACED_OBJECTS);
+    CU_ASSERT_EQUAL(after[TRACE_RETAIN] - before[TRACE_RETAIN], TRACED_OBJECTS);
+    CU_ASSERT_EQUAL(after[TRACE_RELEASE] - before[TRACE_RELEASE], TRACED_OBJECTS);
+    CU_ASSERT_EQUAL(after[TRACE_ENQUEUE] - before[TRACE_ENQUEUE], TRACED_OBJECTS);
+    CU_ASSERT_EQUAL(after[TRACE_DEALLOCATE] - before[TRACE_DEALLOCATE], TRACED_OBJECTS);
+}
+
+void collected_cycle_events_test()
+{
+    size_t before[TRACE_KINDS];
+    size_t after[TRACE_KINDS];
+    read_trace(NULL, before, NULL, 0);
+
+    obj **a = allocate(sizeof(obj *), NULL);
+    obj **b = allocate(sizeof(obj *), NULL);
+    retain(a);
+    retain(b);
+    *a = b;
+    retain(b);
+    *b = a;
+    retain(a);
+    release(a);
+    release(b);
+
+    // the collector frees the cycle without the free queue, but still as two deallocations
+    CU_ASSERT_EQUAL(collect_cycles(), 2);
+    refmem_trace_flush();
+
+    read_trace(NULL, after, NULL, 0);
+    CU_ASSERT_EQUAL(after[TRACE_ENQUEUE] - before[TRACE_ENQUEUE], 0);
+    CU_ASSERT_EQUAL(after[TRACE_DEALLOCATE] - before[TRACE_DEALLOCATE], 2);
+}
+
+int main()
+{
+    // the trace stays open for the whole process, so its file outlives the suite
+    int descriptor = mkstemp(trace_path);
+    if (descriptor < 0)
+    {
+        return 1;
+    }
+    close(descriptor);
+    setenv("REFMEM_TRACE_FILE", trace_path, 1);
+
+    if (CU_initialize_registry() != CUE_SUCCESS)
+        return CU_get_error();
+
+    CU_pSuite my_test_suite = CU_add_suite("Tests for refmem.c built with REFMEM_TRACE", init_suite, clean_suite);
+    if (my_test_suite == NULL)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if (
+        (CU_add_test(my_test_suite, "the events of one object", object_events_test) == NULL ||
+        CU_add_test(my_test_suite, "allocations are followed by their size", size_records_test) == NULL ||
+        CU_add_test(my_test_suite, "more events than one buffer holds", buffer_overflow_test) == NULL ||
+        CU_add_test(my_test_suite, "a collected cycle is traced as deallocations", collected_cycle_events_test) == NULL
+        )
+    )
+
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    CU_basic_run_tests();
+
+    CU_cleanup_registry();
+    remove(trace_path);
+    return CU_get_error();
+}
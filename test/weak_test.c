@@ -0,0 +1,194 @@
+#include <CUnit/Basic.h>
+#include <CUnit/CUnit.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "../src/refmem.h"
+
+/**
+ * @file weak_test.c
+ * @brief Tests for weak references, which do not keep their target alive.
+*/
+
+#define MANY_REFERENCES 1000
+
+struct pair
+{
+    obj *first;
+    obj *second;
+};
+
+static int destroyed = 0;
+
+int init_suite(void)
+{
+    return 0;
+}
+
+int clean_suite(void)
+{
+    shutdown();
+    return 0;
+}
+
+static void count_destructor(obj *object)
+{
+    destroyed++;
+}
+
+void lock_live_object_test()
+{
+    obj *target = allocate(sizeof(int), NULL);
+    retain(target);
+
+    weak_ref_t *ref = weak_create(target);
+    CU_ASSERT_EQUAL(rc(target), 1);
+
+    obj *locked = weak_lock(ref);
+    CU_ASSERT_PTR_EQUAL(locked, target);
+    CU_ASSERT_EQUAL(rc(target), 2);
+
+    release(locked);
+    release(target);
+    release(ref);
+    cleanup();
+}
+
+void target_freed_first_test()
+{
+    obj *target = allocate(sizeof(int), count_destructor);
+    retain(target);
+    destroyed = 0;
+
+    weak_ref_t *ref = weak_create(target);
+    release(target);
+    // waiting in the free queue counts as dead already
+    CU_ASSERT_PTR_NULL(weak_lock(ref));
+
+    cleanup();
+    // the destructor is still found through the weak table
+    CU_ASSERT_EQUAL(destroyed, 1);
+    CU_ASSERT_PTR_NULL(weak_lock(ref));
+
+    release(ref);
+    cleanup();
+}
+
+void reference_freed_first_test()
+{
+    obj *target = allocate(sizeof(int), count_destructor);
+    retain(target);
+    destroyed = 0;
+
+    weak_ref_t *ref = weak_create(target);
+    release(ref);
+    cleanup();
+    CU_ASSERT_EQUAL(destroyed, 0);
+
+    // the header has its destructor back
+    release(target);
+    cleanup();
+    CU_ASSERT_EQUAL(destroyed, 1);
+}
+
+void one_reference_per_object_test()
+{
+    obj *target = allocate(sizeof(int), NULL);
+    retain(target);
+
+    weak_ref_t *first = weak_create(target);
+    weak_ref_t *second = weak_create(target);
+    CU_ASSERT_PTR_EQUAL(first, second);
+    CU_ASSERT_EQUAL(rc(first), 2);
+
+    release(first);
+    release(second);
+    release(target);
+    cleanup();
+}
+
+void default_destructor_test()
+{
+    // the default destructor still releases the children of a weakly referenced object
+    struct pair *pair = allocate(sizeof(struct pair), NULL);
+    retain(pair);
+    pair->first = allocate(sizeof(int), count_destructor);
+    retain(pair->first);
+    destroyed = 0;
+
+    weak_ref_t *ref = weak_create(pair);
+    release(pair);
+    cleanup();
+    CU_ASSERT_EQUAL(destroyed, 1);
+    CU_ASSERT_PTR_NULL(weak_lock(ref));
+
+    release(ref);
+    cleanup();
+}
+
+void slots_are_reused_test()
+{
+    obj *targets[MANY_REFERENCES];
+    weak_ref_t *refs[MANY_REFERENCES];
+
+    for (int round = 0; round < 100; round++)
+    {
+        for (int i = 0; i < MANY_REFERENCES; i++)
+        {
+            targets[i] = allocate(sizeof(int), NULL);
+            retain(targets[i]);
+            refs[i] = weak_create(targets[i]);
+        }
+        for (int i = 0; i < MANY_REFERENCES; i++)
+        {
+            release(targets[i]);
+            release(refs[i]);
+        }
+        cleanup();
+    }
+
+    // far more weak references than slots in use at once
+    obj *target = allocate(sizeof(int), NULL);
+    retain(target);
+    weak_ref_t *ref = weak_create(target);
+    obj *locked = weak_lock(ref);
+    CU_ASSERT_PTR_EQUAL(locked, target);
+    release(locked);
+    release(target);
+    release(ref);
+    cleanup();
+}
+
+int main()
+{
+    if (CU_initialize_registry() != CUE_SUCCESS)
+        return CU_get_error();
+
+    CU_pSuite my_test_suite = CU_add_suite("Tests for weak references in refmem.c", init_suite, clean_suite);
+    if (my_test_suite == NULL)
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    if (
+        (CU_add_test(my_test_suite, "lock an object that is alive", lock_live_object_test) == NULL ||
+        CU_add_test(my_test_suite, "the target is freed first", target_freed_first_test) == NULL ||
+        CU_add_test(my_test_suite, "the weak reference is freed first", reference_freed_first_test) == NULL ||
+        CU_add_test(my_test_suite, "one weak reference per object", one_reference_per_object_test) == NULL ||
+        CU_add_test(my_test_suite, "the default destructor of a target", default_destructor_test) == NULL ||
+        CU_add_test(my_test_suite, "slots are reused", slots_are_reused_test) == NULL
+        )
+    )
+
+    {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+
+    CU_basic_set_mode(CU_BRM_VERBOSE);
+
+    CU_basic_run_tests();
+
+    CU_cleanup_registry();
+    return CU_get_error();
+}
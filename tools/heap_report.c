@@ -0,0 +1,242 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @file heap_report.c
+ * @brief Turns a profile written by refmem_profile_write into a report of the top allocation sites.
+ *
+ * A site is the first function on a sampled call stack that is not one of refmem's allocation
+ * functions, so every call to allocate, allocate_array, duplicate_string and the like is charged
+ * to its caller. Stacks that end in the same site are added together. Sites are ordered by the
+ * bytes they keep alive, by the bytes they have allocated, which shows allocation churn, or by
+ * the bytes they have freed.
+ *
+ * Functions only have names in the profile if the profiled program was linked with -rdynamic,
+ * and static functions never do. Frames without a name are looked up with addr2line, which needs
+ * the program to be built with -g, and are otherwise printed as their offset in the program.
+ *
+ * Usage: ./heap_report.out <profile> [live|alloc|freed] [sites], default live 10
+*/
+
+#define LINE_SIZE 1024
+#define NAME_SIZE 256
+#define DEFAULT_SITES 10
+
+typedef struct
+{
+    char name[NAME_SIZE];
+    char caller[NAME_SIZE]; // the caller of the first stack charged to the site
+    unsigned long long allocated_objects;
+    unsigned long long allocated_bytes;
+    unsigned long long freed_objects;
+    unsigned long long freed_bytes;
+} site_t;
+
+typedef enum { ORDER_LIVE, ORDER_ALLOCATED, ORDER_FREED } order_t;
+
+static order_t order = ORDER_LIVE;
+
+static const char *allocation_functions[] = {
+    "allocate", "allocate_array", "allocate_typed", "allocate_array_typed", "allocate_atomic",
+    "allocate_array_atomic", "duplicate_string", "arena_allocate", "weak_create", NULL};
+
+// the function of a frame without a symbol, "program(+0x1f) [0x5555...]", asked from addr2line
+static bool resolve_offset(const char *frame, char *name)
+{
+    char program[NAME_SIZE];
+    char offset[32];
+    if (sscanf(frame, "%255[^(](+%31[^)])", program, offset) != 2)
+    {
+        return false;
+    }
+
+    char command[2 * NAME_SIZE];
+    snprintf(command, sizeof(command), "addr2line -f -e '%s' +%s 2>/dev/null", program, offset);
+    FILE *output = popen(command, "r");
+    if (output == NULL)
+    {
+        return false;
+    }
+
+    char function[NAME_SIZE];
+    bool resolved = fgets(function, NAME_SIZE, output) != NULL && strncmp(function, "??", 2) != 0;
+    pclose(output);
+    if (resolved)
+    {
+        function[strcspn(function, "\n")] = '\0';
+        snprintf(name, NAME_SIZE, "%s", function);
+    }
+    return resolved;
+}
+
+// the function of a frame from backtrace_symbols, "program(function+0x1f) [0x5555...]", or
+// the frame up to its address if it has no name that can be found
+static void frame_name(const char *frame, char *name)
+{
+    const char *open = strchr(frame, '(');
+    const char *plus = open != NULL ? strchr(open, '+') : NULL;
+
+    if (open != NULL && plus != NULL && plus > open + 1)
+    {
+        size_t length = plus - open - 1 < NAME_SIZE - 1 ? plus - open - 1 : NAME_SIZE - 1;
+        memcpy(name, open + 1, length);
+        name[length] = '\0';
+    }
+    else if (!resolve_offset(frame, name))
+    {
+        snprintf(name, NAME_SIZE, "%.*s", (int)strcspn(frame, " "), frame);
+    }
+}
+
+static bool is_allocation_function(const char *name)
+{
+    for (int i = 0; allocation_functions[i] != NULL; i++)
+    {
+        if (strcmp(name, allocation_functions[i]) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static unsigned long long order_bytes(const site_t *site)
+{
+    switch (order)
+    {
+    case ORDER_ALLOCATED:
+        return site->allocated_bytes;
+    case ORDER_FREED:
+        return site->freed_bytes;
+    default:
+        return site->allocated_bytes - site->freed_bytes;
+    }
+}
+
+static int compare_sites(const void *a, const void *b)
+{
+    unsigned long long first = order_bytes(a);
+    unsigned long long second = order_bytes(b);
+    return first < second ? 1 : first > second ? -1 : 0;
+}
+
+static site_t *find_site(site_t **sites, size_t *count, size_t *capacity, const char *name)
+{
+    for (size_t i = 0; i < *count; i++)
+    {
+        if (strcmp((*sites)[i].name, name) == 0)
+        {
+            return &(*sites)[i];
+        }
+    }
+
+    if (*count == *capacity)
+    {
+        *capacity = *capacity == 0 ? 64 : *capacity * 2;
+        *sites = realloc(*sites, *capacity * sizeof(site_t));
+    }
+    site_t *site = &(*sites)[(*count)++];
+    memset(site, 0, sizeof(site_t));
+    snprintf(site->name, NAME_SIZE, "%s", name);
+    return site;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <profile> [live|alloc|freed] [sites]\n", argv[0]);
+        return 1;
+    }
+
+    if (argc > 2)
+    {
+        order = strcmp(argv[2], "alloc") == 0 ? ORDER_ALLOCATED : strcmp(argv[2], "freed") == 0 ? ORDER_FREED : ORDER_LIVE;
+    }
+    size_t shown = argc > 3 ? strtoul(argv[3], NULL, 10) : DEFAULT_SITES;
+
+    FILE *file = fopen(argv[1], "r");
+    if (file == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    char line[LINE_SIZE];
+    if (fgets(line, LINE_SIZE, file) == NULL || strncmp(line, "refmem heap profile", 19) != 0)
+    {
+        fprintf(stderr, "%s: not a refmem heap profile\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    site_t *sites = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    unsigned long long interval = 0;
+    site_t stack = {0};
+    size_t charged = 0; // the site the stack read last was charged to
+    bool in_stack = false;
+    bool found_site = false;
+
+    // a stack is charged to the first frame outside of refmem, the frame after it is its caller
+    while (fgets(line, LINE_SIZE, file) != NULL)
+    {
+        line[strcspn(line, "\n")] = '\0';
+
+        if (sscanf(line, "interval %llu", &interval) == 1)
+        {
+            continue;
+        }
+        if (sscanf(line, "site %llu %llu %llu %llu", &stack.allocated_objects, &stack.allocated_bytes,
+                   &stack.freed_objects, &stack.freed_bytes) == 4)
+        {
+            in_stack = true;
+            found_site = false;
+            continue;
+        }
+        if (!in_stack || strncmp(line, "  ", 2) != 0)
+        {
+            continue;
+        }
+
+        char name[NAME_SIZE];
+        frame_name(line + 2, name);
+        if (!found_site && !is_allocation_function(name))
+        {
+            site_t *site = find_site(&sites, &count, &capacity, name);
+            site->allocated_objects += stack.allocated_objects;
+            site->allocated_bytes += stack.allocated_bytes;
+            site->freed_objects += stack.freed_objects;
+            site->freed_bytes += stack.freed_bytes;
+            charged = site - sites;
+            found_site = true;
+        }
+        else if (found_site)
+        {
+            if (sites[charged].caller[0] == '\0')
+            {
+                snprintf(sites[charged].caller, NAME_SIZE, "%s", name);
+            }
+            in_stack = false;
+        }
+    }
+    fclose(file);
+
+    qsort(sites, count, sizeof(site_t), compare_sites);
+
+    printf("sampled every %llu bytes on average, %zu sites, ordered by %s bytes\n", interval, count,
+           order == ORDER_ALLOCATED ? "allocated" : order == ORDER_FREED ? "freed" : "live");
+    printf("%12s %12s %12s %10s  %s\n", "live bytes", "allocated", "freed", "objects", "site (called from)");
+    for (size_t i = 0; i < count && i < shown; i++)
+    {
+        printf("%12llu %12llu %12llu %10llu  %s (%s)\n", sites[i].allocated_bytes - sites[i].freed_bytes,
+               sites[i].allocated_bytes, sites[i].freed_bytes, sites[i].allocated_objects,
+               sites[i].name, sites[i].caller);
+    }
+
+    free(sites);
+    return 0;
+}
@@ -0,0 +1,322 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/trace.h"
+
+/**
+ * @file trace_decode.c
+ * @brief Reports on an event trace written by refmem built with REFMEM_TRACE, see trace.h.
+ *
+ * The events of all threads are put in time order and replayed object by object. An object
+ * lives from its allocate to its deallocate event, and waits in the free queue from its enqueue
+ * to its deallocate event. Both are reported as percentiles and as a histogram of powers of two.
+ * An address is reused once its object is freed, so the retains and releases are counted per
+ * lifetime, and the lifetimes with the most retain/release pairs are listed as the hottest.
+ *
+ * Usage: ./trace_decode.out [trace] [objects], default refmem.trace 10
+*/
+
+#define DEFAULT_HOTTEST 10
+#define HISTOGRAM_BUCKETS 48
+
+typedef struct
+{
+    uint64_t time_ns;
+    uint64_t object;
+    uint32_t thread;
+    uint32_t order; // position in the file, keeps events of one thread in order on equal times
+} event_t;
+
+// one lifetime of an address
+typedef struct
+{
+    uint64_t address;
+    uint64_t allocated_ns;
+    uint64_t enqueued_ns; // 0 if it was never queued
+    uint64_t retains;
+    uint64_t releases;
+    uint64_t lifetime_ns;
+    bool live;
+} lifetime_t;
+
+typedef struct
+{
+    uint64_t *values;
+    size_t size;
+    size_t capacity;
+} samples_t;
+
+static const char *kind_names[TRACE_KINDS] = {"allocate", "retain", "release", "enqueue", "deallocate"};
+
+static void samples_add(samples_t *samples, uint64_t value)
+{
+    if (samples->size == samples->capacity)
+    {
+        samples->capacity = samples->capacity == 0 ? 1024 : samples->capacity * 2;
+        samples->values = realloc(samples->values, samples->capacity * sizeof(uint64_t));
+    }
+    samples->values[samples->size++] = value;
+}
+
+static int compare_values(const void *a, const void *b)
+{
+    uint64_t first = *(const uint64_t *)a;
+    uint64_t second = *(const uint64_t *)b;
+    return first < second ? -1 : first > second;
+}
+
+static int compare_events(const void *a, const void *b)
+{
+    const event_t *first = a;
+    const event_t *second = b;
+    if (first->time_ns != second->time_ns)
+    {
+        return first->time_ns < second->time_ns ? -1 : 1;
+    }
+    return first->order < second->order ? -1 : first->order > second->order;
+}
+
+static uint64_t pairs(const lifetime_t *lifetime)
+{
+    return lifetime->retains < lifetime->releases ? lifetime->retains : lifetime->releases;
+}
+
+static int compare_pairs(const void *a, const void *b)
+{
+    uint64_t first = pairs(a);
+    uint64_t second = pairs(b);
+    return first < second ? 1 : first > second ? -1 : 0;
+}
+
+static void print_distribution(const char *title, samples_t *samples)
+{
+    printf("\n%s, %zu objects\n", title, samples->size);
+    if (samples->size == 0)
+    {
+        return;
+    }
+
+    qsort(samples->values, samples->size, sizeof(uint64_t), compare_values);
+    printf("  p50 %llu ns, p90 %llu ns, p99 %llu ns, max %llu ns\n",
+           (unsigned long long)samples->values[samples->size / 2],
+           (unsigned long long)samples->values[samples->size * 9 / 10],
+           (unsigned long long)samples->values[samples->size * 99 / 100],
+           (unsigned long long)samples->values[samples->size - 1]);
+
+    size_t histogram[HISTOGRAM_BUCKETS] = {0};
+    for (size_t i = 0; i < samples->size; i++)
+    {
+        uint64_t value = samples->values[i];
+        size_t bucket = value == 0 ? 0 : 63 - __builtin_clzll(value);
+        histogram[bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1]++;
+    }
+    for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+    {
+        if (histogram[bucket] > 0)
+        {
+            int bar = (int)(histogram[bucket] * 50 / samples->size);
+            printf("  >= 2^%-2zu ns %10zu %.*s\n", bucket, histogram[bucket], bar,
+                   "##################################################");
+        }
+    }
+}
+
+// the live lifetime of every address, open addressing over a table of twice the objects
+typedef struct
+{
+    size_t *slots; // indexes in lifetimes, SIZE_MAX is empty
+    size_t capacity;
+} address_table_t;
+
+static size_t *address_slot(address_table_t *table, lifetime_t *lifetimes, uint64_t address)
+{
+    size_t slot = (address * 0x9e3779b97f4a7c15ull >> 20) & (table->capacity - 1);
+    while (table->slots[slot] != SIZE_MAX && lifetimes[table->slots[slot]].address != address)
+    {
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    return &table->slots[slot];
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "refmem.trace";
+    size_t hottest = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_HOTTEST;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+
+    char magic[TRACE_MAGIC_SIZE];
+    if (fread(magic, 1, TRACE_MAGIC_SIZE, file) != TRACE_MAGIC_SIZE || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0)
+    {
+        fprintf(stderr, "%s: not a refmem trace\n", path);
+        fclose(file);
+        return 1;
+    }
+
+    event_t *events = NULL;
+    size_t event_count = 0;
+    size_t event_capacity = 0;
+    uint32_t threads = 0;
+    trace_block_t block;
+
+    while (fread(&block, sizeof(block), 1, file) == 1)
+    {
+        threads = block.thread + 1 > threads ? block.thread + 1 : threads;
+        for (uint32_t i = 0; i < block.events; i++)
+        {
+            trace_event_t event;
+            if (fread(&event, sizeof(event), 1, file) != 1)
+            {
+                fprintf(stderr, "%s: the last block is cut short\n", path);
+                break;
+            }
+            // sizes describe the allocation before them, their time field is not a time
+            if ((event.object & TRACE_KIND_MASK) == TRACE_SIZE)
+            {
+                continue;
+            }
+            if (event_count == event_capacity)
+            {
+                event_capacity = event_capacity == 0 ? 4096 : event_capacity * 2;
+                events = realloc(events, event_capacity * sizeof(event_t));
+            }
+            events[event_count] = (event_t){event.time_ns, event.object, block.thread, event_count};
+            event_count++;
+        }
+    }
+    fclose(file);
+
+    qsort(events, event_count, sizeof(event_t), compare_events);
+
+    lifetime_t *lifetimes = NULL;
+    size_t lifetime_count = 0;
+    size_t lifetime_capacity = 0;
+    address_table_t table = {NULL, 0};
+    size_t kind_counts[TRACE_KINDS] = {0};
+    samples_t lifetime_samples = {NULL, 0, 0};
+    samples_t residence_samples = {NULL, 0, 0};
+
+    for (size_t i = 0; i < event_count; i++)
+    {
+        trace_kind_t kind = events[i].object & TRACE_KIND_MASK;
+        uint64_t address = events[i].object & ~(uint64_t)TRACE_KIND_MASK;
+        uint64_t time = events[i].time_ns;
+
+        if (kind >= TRACE_KINDS)
+        {
+            continue;
+        }
+        kind_counts[kind]++;
+
+        if (2 * (lifetime_count + 1) > table.capacity)
+        {
+            table.capacity = table.capacity == 0 ? 4096 : table.capacity * 2;
+            table.slots = realloc(table.slots, table.capacity * sizeof(size_t));
+            memset(table.slots, 0xff, table.capacity * sizeof(size_t));
+            for (size_t j = 0; j < lifetime_count; j++)
+            {
+                if (lifetimes[j].live)
+                {
+                    *address_slot(&table, lifetimes, lifetimes[j].address) = j;
+                }
+            }
+        }
+
+        size_t *slot = address_slot(&table, lifetimes, address);
+        if (kind == TRACE_ALLOCATE)
+        {
+            if (lifetime_count == lifetime_capacity)
+            {
+                lifetime_capacity = lifetime_capacity == 0 ? 4096 : lifetime_capacity * 2;
+                lifetimes = realloc(lifetimes, lifetime_capacity * sizeof(lifetime_t));
+            }
+            if (*slot != SIZE_MAX)
+            {
+                lifetimes[*slot].live = false; // freed without an event, such as at exit
+            }
+            lifetimes[lifetime_count] = (lifetime_t){address, time, 0, 0, 0, 0, true};
+            *slot = lifetime_count++;
+            continue;
+        }
+        if (*slot == SIZE_MAX)
+        {
+            continue; // allocated before the trace started
+        }
+
+        lifetime_t *lifetime = &lifetimes[*slot];
+        switch (kind)
+        {
+        case TRACE_RETAIN:
+            lifetime->retains++;
+            break;
+        case TRACE_RELEASE:
+            lifetime->releases++;
+            break;
+        case TRACE_ENQUEUE:
+            lifetime->enqueued_ns = time;
+            break;
+        default:
+            lifetime->lifetime_ns = time - lifetime->allocated_ns;
+            lifetime->live = false;
+            samples_add(&lifetime_samples, lifetime->lifetime_ns);
+            if (lifetime->enqueued_ns != 0)
+            {
+                samples_add(&residence_samples, time - lifetime->enqueued_ns);
+            }
+            // the address is free for the next object, the lifetime stays in the list
+            *slot = SIZE_MAX;
+            for (size_t next = (slot - table.slots + 1) & (table.capacity - 1); table.slots[next] != SIZE_MAX;
+                 next = (next + 1) & (table.capacity - 1))
+            {
+                size_t moved = table.slots[next];
+                table.slots[next] = SIZE_MAX;
+                *address_slot(&table, lifetimes, lifetimes[moved].address) = moved;
+            }
+            break;
+        }
+    }
+
+    uint64_t span = event_count > 0 ? events[event_count - 1].time_ns - events[0].time_ns : 0;
+    printf("%zu events from %u threads over %.3f ms\n", event_count, threads, span / 1e6);
+    for (int kind = 0; kind < TRACE_SIZE; kind++)
+    {
+        printf("  %-10s %zu\n", kind_names[kind], kind_counts[kind]);
+    }
+
+    size_t still_live = 0;
+    for (size_t i = 0; i < lifetime_count; i++)
+    {
+        still_live += lifetimes[i].live;
+    }
+    printf("  %zu objects were not freed during the trace\n", still_live);
+
+    print_distribution("object lifetime, allocate to deallocate", &lifetime_samples);
+    print_distribution("residence in the free queue, enqueue to deallocate", &residence_samples);
+
+    qsort(lifetimes, lifetime_count, sizeof(lifetime_t), compare_pairs);
+    printf("\nhottest retain/release pairs\n");
+    printf("  %18s %10s %10s %14s\n", "object", "retains", "releases", "lifetime ns");
+    for (size_t i = 0; i < lifetime_count && i < hottest && pairs(&lifetimes[i]) > 0; i++)
+    {
+        char lifetime[32] = "still live";
+        if (!lifetimes[i].live)
+        {
+            snprintf(lifetime, sizeof(lifetime), "%llu", (unsigned long long)lifetimes[i].lifetime_ns);
+        }
+        printf("  %#18llx %10llu %10llu %14s\n", (unsigned long long)lifetimes[i].address,
+               (unsigned long long)lifetimes[i].retains, (unsigned long long)lifetimes[i].releases, lifetime);
+    }
+
+    free(events);
+    free(lifetimes);
+    free(table.slots);
+    free(lifetime_samples.values);
+    free(residence_samples.values);
+    return 0;
+}
@@ -0,0 +1,376 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../src/refmem.h"
+#include "../src/trace.h"
+
+/**
+ * @file trace_replay.c
+ * @brief Plays a trace recorded by refmem built with REFMEM_TRACE back against several allocators.
+ *
+ * The allocations, retains, releases and frees of the trace are put in time order and every
+ * lifetime of an address becomes one object, so the replay does not depend on where the
+ * recorded objects were. Each backend then runs the same sequence in a process of its own and
+ * reports its time, its peak footprint (the growth of the resident memory) and the peak of
+ * the bytes asked for by live objects. Fragmentation is the part of the footprint that does not
+ * hold live objects.
+ *
+ * The releases that destructors made are in the trace, so replayed objects get a destructor
+ * that does nothing, or the default destructor which finds no pointers in them. An object
+ * that was freed without its count reaching zero, by deallocate, an arena or a pool, is freed
+ * explicitly. A backend is a backend_t in the backends table, add one there to compare it.
+ *
+ * Usage: ./trace_replay.out [trace] [backend], default refmem.trace and all backends
+*/
+
+#define NO_LIFETIME UINT32_MAX
+#define RSS_SAMPLE_INTERVAL 1024
+
+typedef struct
+{
+    uint64_t time_ns;
+    uint64_t object;
+    uint64_t bytes;
+    uint32_t destructor;
+    uint32_t order; // position in the file, keeps events of one thread in order on equal times
+    uint8_t attributes;
+} event_t;
+
+typedef struct
+{
+    uint64_t bytes;
+    uint32_t lifetime;
+    uint8_t kind;
+    uint8_t attributes;
+    bool default_destructor;
+} replay_op_t;
+
+typedef struct
+{
+    const char *name;
+    void *(*allocate)(size_t bytes, uint8_t attributes, bool default_destructor);
+    void (*retain)(void *object);
+    void (*release)(void *object); // frees the object when its count reaches zero, now or later
+    void (*free)(void *object);
+    void (*finish)();
+} backend_t;
+
+static void replay_destructor(obj *object)
+{
+}
+
+static void *refmem_allocate(size_t bytes, uint8_t attributes, bool default_destructor)
+{
+    if (attributes & TRACE_ATTRIBUTE_ATOMIC)
+    {
+        return allocate_atomic(bytes);
+    }
+    return allocate(bytes, default_destructor ? NULL : replay_destructor);
+}
+
+// malloc with a count in front of the object, freed as soon as the count reaches zero
+static void *malloc_allocate(size_t bytes, uint8_t attributes, bool default_destructor)
+{
+    uint64_t *header = calloc(1, sizeof(uint64_t) + bytes);
+    return header + 1;
+}
+
+static void malloc_retain(void *object)
+{
+    ((uint64_t *)object)[-1]++;
+}
+
+static void malloc_free(void *object)
+{
+    free((uint64_t *)object - 1);
+}
+
+static void malloc_release(void *object)
+{
+    if (--((uint64_t *)object)[-1] == 0)
+    {
+        malloc_free(object);
+    }
+}
+
+static void malloc_finish()
+{
+}
+
+static backend_t backends[] = {
+    {"refmem", refmem_allocate, retain, release, deallocate, shutdown},
+    {"malloc", malloc_allocate, malloc_retain, malloc_release, malloc_free, malloc_finish},
+};
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static size_t resident_bytes()
+{
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL)
+    {
+        if (fscanf(statm, "%*s %ld", &pages) != 1)
+        {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return pages * sysconf(_SC_PAGESIZE);
+}
+
+static int compare_events(const void *a, const void *b)
+{
+    const event_t *first = a;
+    const event_t *second = b;
+    if (first->time_ns != second->time_ns)
+    {
+        return first->time_ns < second->time_ns ? -1 : 1;
+    }
+    return first->order < second->order ? -1 : first->order > second->order;
+}
+
+// the events of the trace in time order, with the size records folded into their allocations
+static event_t *read_events(const char *path, size_t *count)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    char magic[TRACE_MAGIC_SIZE];
+    if (fread(magic, 1, TRACE_MAGIC_SIZE, file) != TRACE_MAGIC_SIZE || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0)
+    {
+        fprintf(stderr, "%s: not a refmem trace\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    event_t *events = NULL;
+    size_t event_count = 0;
+    size_t event_capacity = 0;
+    trace_block_t block;
+
+    while (fread(&block, sizeof(block), 1, file) == 1)
+    {
+        for (uint32_t i = 0; i < block.events; i++)
+        {
+            trace_event_t event;
+            if (fread(&event, sizeof(event), 1, file) != 1)
+            {
+                fprintf(stderr, "%s: the last block is cut short\n", path);
+                break;
+            }
+            if ((event.object & TRACE_KIND_MASK) == TRACE_SIZE)
+            {
+                if (i > 0 && event_count > 0 && (events[event_count - 1].object & TRACE_KIND_MASK) == TRACE_ALLOCATE)
+                {
+                    events[event_count - 1].bytes = event.time_ns;
+                    events[event_count - 1].destructor = TRACE_DESTRUCTOR(event);
+                    events[event_count - 1].attributes = TRACE_ATTRIBUTES(event);
+                }
+                continue;
+            }
+            if (event_count == event_capacity)
+            {
+                event_capacity = event_capacity == 0 ? 4096 : event_capacity * 2;
+                events = realloc(events, event_capacity * sizeof(event_t));
+            }
+            events[event_count] = (event_t){event.time_ns, event.object, 0, 0, event_count, 0};
+            event_count++;
+        }
+    }
+    fclose(file);
+
+    qsort(events, event_count, sizeof(event_t), compare_events);
+    *count = event_count;
+    return events;
+}
+
+// turns addresses into lifetimes, an address starts a new lifetime at every allocation
+static replay_op_t *resolve_lifetimes(event_t *events, size_t event_count, size_t *lifetime_count)
+{
+    replay_op_t *ops = calloc(event_count > 0 ? event_count : 1, sizeof(replay_op_t));
+    size_t capacity = 4096;
+    while (capacity < 2 * event_count)
+    {
+        capacity *= 2;
+    }
+    uint64_t *addresses = calloc(capacity, sizeof(uint64_t));
+    uint32_t *lifetimes = calloc(capacity, sizeof(uint32_t));
+    uint32_t next_lifetime = 0;
+
+    for (size_t i = 0; i < event_count; i++)
+    {
+        uint64_t address = events[i].object & ~(uint64_t)TRACE_KIND_MASK;
+        trace_kind_t kind = events[i].object & TRACE_KIND_MASK;
+        size_t slot = (address * 0x9e3779b97f4a7c15ull >> 20) & (capacity - 1);
+
+        while (addresses[slot] != 0 && addresses[slot] != address)
+        {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (addresses[slot] == 0)
+        {
+            addresses[slot] = address;
+            lifetimes[slot] = NO_LIFETIME;
+        }
+
+        if (kind == TRACE_ALLOCATE)
+        {
+            lifetimes[slot] = next_lifetime++;
+        }
+        ops[i] = (replay_op_t){events[i].bytes, lifetimes[slot], kind, events[i].attributes,
+                               events[i].destructor == 0 && !(events[i].attributes & TRACE_ATTRIBUTE_TYPED)};
+        if (kind == TRACE_DEALLOCATE)
+        {
+            lifetimes[slot] = NO_LIFETIME;
+        }
+    }
+
+    free(addresses);
+    free(lifetimes);
+    *lifetime_count = next_lifetime;
+    return ops;
+}
+
+static void replay(backend_t *backend, replay_op_t *ops, size_t op_count, size_t lifetime_count)
+{
+    void **objects = calloc(lifetime_count + 1, sizeof(void *));
+    uint32_t *counts = calloc(lifetime_count + 1, sizeof(uint32_t));
+    bool *dead = calloc(lifetime_count + 1, sizeof(bool));
+    uint64_t *bytes = calloc(lifetime_count + 1, sizeof(uint64_t));
+    // the tables are touched first so that they are not counted as footprint
+    memset(objects, 0, (lifetime_count + 1) * sizeof(void *));
+    memset(counts, 0, (lifetime_count + 1) * sizeof(uint32_t));
+    memset(dead, 0, (lifetime_count + 1) * sizeof(bool));
+    memset(bytes, 0, (lifetime_count + 1) * sizeof(uint64_t));
+
+    size_t baseline = resident_bytes();
+    size_t peak_resident = baseline;
+    size_t live_bytes = 0;
+    size_t peak_live_bytes = 0;
+
+    double start = now_ns();
+    for (size_t i = 0; i < op_count; i++)
+    {
+        replay_op_t *op = &ops[i];
+        uint32_t lifetime = op->lifetime;
+
+        if (lifetime == NO_LIFETIME || (op->kind != TRACE_ALLOCATE && (objects[lifetime] == NULL || dead[lifetime])))
+        {
+            continue;
+        }
+
+        switch (op->kind)
+        {
+        case TRACE_ALLOCATE:
+            objects[lifetime] = backend->allocate(op->bytes, op->attributes, op->default_destructor);
+            bytes[lifetime] = op->bytes;
+            live_bytes += op->bytes;
+            peak_live_bytes = live_bytes > peak_live_bytes ? live_bytes : peak_live_bytes;
+            break;
+        case TRACE_RETAIN:
+            backend->retain(objects[lifetime]);
+            counts[lifetime]++;
+            break;
+        case TRACE_RELEASE:
+            if (counts[lifetime] > 0)
+            {
+                backend->release(objects[lifetime]);
+                if (--counts[lifetime] == 0)
+                {
+                    dead[lifetime] = true;
+                    live_bytes -= bytes[lifetime];
+                }
+            }
+            break;
+        case TRACE_DEALLOCATE:
+            // freed while it was still counted, or never counted at all
+            backend->free(objects[lifetime]);
+            dead[lifetime] = true;
+            live_bytes -= bytes[lifetime];
+            break;
+        default:
+            break;
+        }
+
+        if (i % RSS_SAMPLE_INTERVAL == 0)
+        {
+            size_t resident = resident_bytes();
+            peak_resident = resident > peak_resident ? resident : peak_resident;
+        }
+    }
+    size_t resident = resident_bytes();
+    peak_resident = resident > peak_resident ? resident : peak_resident;
+    backend->finish();
+    double elapsed = now_ns() - start;
+
+    size_t footprint = peak_resident - baseline;
+    double fragmentation = footprint > peak_live_bytes ? 100.0 * (footprint - peak_live_bytes) / footprint : 0;
+    printf("%-8s %10.2f ms %8.1f ns/event, peak footprint %8zu KiB, peak live %8zu KiB, fragmentation %5.1f%%\n",
+           backend->name, elapsed / 1e6, op_count > 0 ? elapsed / op_count : 0, footprint / 1024, peak_live_bytes / 1024, fragmentation);
+
+    free(objects);
+    free(counts);
+    free(dead);
+    free(bytes);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "refmem.trace";
+    const char *only = argc > 2 ? argv[2] : NULL;
+    size_t event_count = 0;
+    size_t lifetime_count = 0;
+
+    event_t *events = read_events(path, &event_count);
+    if (events == NULL)
+    {
+        return 1;
+    }
+    replay_op_t *ops = resolve_lifetimes(events, event_count, &lifetime_count);
+    free(events);
+
+    printf("%zu events, %zu objects\n", event_count, lifetime_count);
+    fflush(stdout);
+
+    bool found = false;
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++)
+    {
+        if (only != NULL && strcmp(only, backends[i].name) != 0)
+        {
+            continue;
+        }
+        found = true;
+
+        // every backend starts from a fresh heap
+        pid_t child = fork();
+        if (child == 0)
+        {
+            replay(&backends[i], ops, event_count, lifetime_count);
+            fflush(stdout);
+            _exit(0);
+        }
+        waitpid(child, NULL, 0);
+    }
+
+    free(ops);
+    if (!found)
+    {
+        fprintf(stderr, "unknown backend %s\n", only);
+        return 1;
+    }
+    return 0;
+}